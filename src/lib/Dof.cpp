@@ -11,6 +11,9 @@ const char* const Dof::dofTypeLabels[] = {"UX", "UY", "UZ", "ROTX", "ROTY",
 static_assert(Dof::numberOfDofTypes == sizeof(Dof::dofTypeLabels)/sizeof(Dof::dofTypeLabels[0]) - 1,
                 "dofTypeLabels and dofType must have the same number of elements");
 
+// DofCollection keeps types of entity's DoFs in 8-bit mask
+static_assert(Dof::numberOfDofTypes <= 8, "DofCollection can't handle more than 8 DoF types");
+
 Dof::dofType Dof::label2dofType (const std::string& label) {
   for (uint16 i = 0; i < numberOfDofTypes; i++) {
     if (label.compare(dofTypeLabels[i]) == 0) {
@@ -25,88 +28,68 @@ Dof::dofType Dof::label2dofType (const std::string& label) {
 void DofCollection::initDofTable(uint32 _numberOfEntities) {
   clearDofTable();
   numberOfEntities = _numberOfEntities;
-  dofPos.assign(numberOfEntities + 1, 0);
+  dofMask.assign(numberOfEntities, 0);
 }
 
 
 // n index starts from 1
-void DofCollection::addDof(uint32 n, std::initializer_list<Dof::dofType> __dofs) {
-  assert(n <= numberOfEntities);
-  assert(dofPos.size() > 0);
-  std::set<Dof::dofType> _dofs(__dofs);
-  std::vector<Dof> newDofs;
-  // if already registered - just return
-  if (dofPos[n-1] == dofPos[n]) {
-    for (auto& v : _dofs)
-      newDofs.push_back(Dof(v));
-  } else {
-    for (auto& v : _dofs) {
-      bool isFound = false;
-      for (auto it = dofs.begin() + dofPos[n-1]; it < dofs.begin() + dofPos[n]; it++) {
-        if (it->type == v) {
-          isFound = true;
-          break;
-        }
-      }
-      if (!isFound) {
-        newDofs.push_back(Dof(v));
-      }
-    }
+void DofCollection::addDof(uint32 n, std::initializer_list<Dof::dofType> _dofs) {
+  assert(n > 0 && n <= numberOfEntities);
+  uint8 mask = dofMask[n-1];
+  for (auto v : _dofs) {
+    assert(v < Dof::UNDEFINED);
+    mask |= static_cast<uint8> (1 << v);
   }
+  if (mask == dofMask[n-1]) return;
+  if (isBuilt) {
+    LOG(FATAL) << "Can't add new DoFs after DofCollection::buildDofTable()";
+  }
+  dofMask[n-1] = mask;
+  usedDofTypes |= mask;
+}
 
-  if (newDofs.size() == 0) return;
-
-  dofs.insert(dofs.begin() + dofPos[n], newDofs.begin(), newDofs.end());
-  uniqueDofTypes.insert(std::begin(_dofs), std::end(_dofs));
 
-  // incement dofPos with newDofs.size() for all above
-  uint32 i = n;
-  while (i <= numberOfEntities) dofPos[i++] += newDofs.size();
+void DofCollection::buildDofTable() {
+  // count pass: positions of entities' Dofs
+  dofPos.assign(numberOfEntities + 1, 0);
+  for (uint32 n = 1; n <= numberOfEntities; n++) {
+    dofPos[n] = dofPos[n-1] + countBits(dofMask[n-1]);
+  }
+  numberOfUsedDofs = dofPos[numberOfEntities];
 
-  numberOfUsedDofs += newDofs.size();
+  // fill pass: Dofs of every entity sorted by type
+  dofs.clear();
+  dofs.reserve(numberOfUsedDofs);
+  for (uint32 n = 1; n <= numberOfEntities; n++) {
+    for (uint16 t = 0; t < Dof::numberOfDofTypes; t++) {
+      if (dofMask[n-1] & (1 << t)) {
+        dofs.push_back(Dof(static_cast<Dof::dofType> (t)));
+      }
+    }
+  }
+  isBuilt = true;
 }
 
 
 void DofCollection::clearDofTable() {
   dofs.clear();
   dofPos.clear();
-  uniqueDofTypes.clear();
+  dofMask.clear();
+  usedDofTypes = 0;
   numberOfUsedDofs = 0;
   numberOfEntities = 0;
+  isBuilt = false;
 }
 
 
-// n index starts from 1
-bool DofCollection::isDofUsed(uint32 n, Dof::dofType dof) {
-  assert(n <= numberOfEntities);
-  assert(dofPos.size() > 0);
-  if (dofPos[n-1] == dofPos[n]) return false;
-  for (auto it = dofs.begin() + dofPos[n-1]; it < dofs.begin() + dofPos[n]; it++) {
-    if (it->type == dof) return true;
-  }
-  return false;
-}
-
-
-// return nullptr if Dof was not found
-Dof* DofCollection::getDof(uint32 n, Dof::dofType dof) {
-  assert(n <= numberOfEntities);
-  assert(dofPos.size() > 0);
-
-  Dof* pdof = nullptr;
-
-  for (auto it = dofs.begin() + dofPos[n-1]; it < dofs.begin() + dofPos[n]; it++) {
-    if (it->type == dof) {
-      pdof = &(*it);
-      break;
+std::set<Dof::dofType> DofCollection::getUniqueDofTypes() {
+  std::set<Dof::dofType> types;
+  for (uint16 t = 0; t < Dof::numberOfDofTypes; t++) {
+    if (usedDofTypes & (1 << t)) {
+      types.insert(static_cast<Dof::dofType> (t));
     }
   }
-  return pdof;
-}
-
-
-std::set<Dof::dofType> DofCollection::getUniqueDofTypes() {
-  return uniqueDofTypes;
+  return types;
 }
 
 
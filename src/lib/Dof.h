@@ -12,7 +12,8 @@ class DofCollection;
 // (is it fixed boundary condition, what its number in equation system, ..)
 class Dof {
   public:
-    enum dofType {
+    // NOTE: DofCollection uses 8-bit masks of DoF types, so there could be no more than 8 types
+    enum dofType : uint8 {
       UX = 0,
       UY,
       UZ,
@@ -47,35 +48,51 @@ class DofCollection {
     uint32 getNumberOfUsedDofs();
     uint32 getNumberOfEntities();
 
-    // return a poiner to Dof class for Entity n and for type dof
+    // return a poiner to Dof class for Entity n and for type dof (nullptr if the entity doesn't
+    // have such DoF). This is constant time operation.
     Dof* getDof(uint32 n, Dof::dofType dof);
 
     // return begin and end iterator of Dofs for Entity n
     std::pair<std::vector<Dof>::iterator,
               std::vector<Dof>::iterator> getEntityDofs(uint32 n);
 
+    // Registration of DoFs is done in two passes. addDof() only marks DoF types used by the
+    // entity, then buildDofTable() creates Dof objects for all entities at once. getDof(),
+    // getEntityDofs() and getNumberOfUsedDofs() should be called after buildDofTable().
     void initDofTable(uint32 _numberOfEntities);
     void addDof(uint32 n, std::initializer_list<Dof::dofType> _dofs);
+    void buildDofTable();
     void clearDofTable();
     bool isDofUsed(uint32 n, Dof::dofType dof);
 
     std::set<Dof::dofType> getUniqueDofTypes();
 
   private:
+    // number of set bits in 8-bit mask
+    static uint16 countBits(uint8 mask);
+
     uint32 numberOfUsedDofs = 0;
     uint32 numberOfEntities = 0;
 
+    // true if Dof objects are created by buildDofTable()
+    bool isBuilt = false;
+
     // vector of Dof objects 
     std::vector<Dof> dofs;
     // array of indexes to find where dofs for particular entity is located in dofs
-    // Dof for entity n will be located from dofPos[n-1] included to dofPos[n] excluded 
+    // Dof for entity n will be located from dofPos[n-1] included to dofPos[n] excluded. Dofs of an
+    // entity are sorted by type.
     std::vector<uint32> dofPos;
-    // set of unique dofs used in collection
-    std::set<Dof::dofType> uniqueDofTypes;
+    // dofMask[n-1] - mask of DoF types used by entity n (bit t is set if the entity has Dof of type
+    // t). Dof of type t is located at dofs[dofPos[n-1] + countBits(dofMask[n-1] & ((1 << t) - 1))].
+    std::vector<uint8> dofMask;
+    // mask of all DoF types used in collection
+    uint8 usedDofTypes = 0;
 };
 
 
 inline uint32 DofCollection::getNumberOfUsedDofs() {
+  assert(isBuilt);
   return numberOfUsedDofs;
 }
 
@@ -85,8 +102,37 @@ inline uint32 DofCollection::getNumberOfEntities() {
 }
 
 
+inline uint16 DofCollection::countBits(uint8 mask) {
+  mask = mask - ((mask >> 1) & 0x55);
+  mask = (mask & 0x33) + ((mask >> 2) & 0x33);
+  return (mask + (mask >> 4)) & 0x0F;
+}
+
+
+// n index starts from 1
+// return nullptr if Dof was not found
+inline Dof* DofCollection::getDof(uint32 n, Dof::dofType dof) {
+  assert(isBuilt);
+  assert(n > 0 && n <= numberOfEntities);
+  assert(dof < Dof::UNDEFINED);
+  const uint8 mask = dofMask[n-1];
+  const uint8 bit = static_cast<uint8> (1 << dof);
+  if ((mask & bit) == 0) return nullptr;
+  return &dofs[dofPos[n-1] + countBits(mask & (bit - 1))];
+}
+
+
+// n index starts from 1
+inline bool DofCollection::isDofUsed(uint32 n, Dof::dofType dof) {
+  assert(n > 0 && n <= numberOfEntities);
+  assert(dof < Dof::UNDEFINED);
+  return (dofMask[n-1] & (1 << dof)) != 0;
+}
+
+
 inline std::pair<std::vector<Dof>::iterator,
                  std::vector<Dof>::iterator> DofCollection::getEntityDofs(uint32 n) {
+  assert(isBuilt);
   assert(n > 0);
   assert(n <= numberOfEntities);
   assert(dofPos.size() > 0);
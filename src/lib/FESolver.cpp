@@ -32,6 +32,11 @@ uint16 TimeControl::getTotalNumberOfEquilibriumSteps() {
 
 
 bool TimeControl::nextStep(double delta) {
+  return nextStep(delta, endTime);
+}
+
+
+bool TimeControl::nextStep(double delta, double _stopTime) {
   if (currentEquilibriumStep > 0) {
     equilibriumSteps.push_back(currentEquilibriumStep);
     convergedTimeInstances.push_back(currentTime);
@@ -39,16 +44,23 @@ bool TimeControl::nextStep(double delta) {
   if (currentTime >= endTime) {
     return false;    
   }
-  // if delta bigger than endTime-currentTime
-  if (currentTime + delta >= endTime) {
-    currentTimeDelta = endTime - currentTime;
-  } else if (currentTime + 2*delta >= endTime) {
-    currentTimeDelta = (endTime - currentTime)/2.0;
+  // stop times closer to endTime than round-off errors are treated as endTime
+  const double eps = 1.0e-9 * (endTime - startTime);
+  stopTime = (_stopTime < endTime - eps) ? _stopTime : endTime;
+  previousTime = currentTime;
+  // if delta bigger than stopTime-currentTime
+  if (currentTime + delta >= stopTime - eps) {
+    currentTimeDelta = stopTime - currentTime;
+    currentTime = stopTime;
   } else {
-    currentTimeDelta = delta;
+    if (currentTime + 2*delta >= stopTime) {
+      currentTimeDelta = (stopTime - currentTime)/2.0;
+    } else {
+      currentTimeDelta = delta;
+    }
+    currentTime += currentTimeDelta;
   }
   DCHECK (currentTimeDelta > 0.0);
-  currentTime += currentTimeDelta;
   currentEquilibriumStep = 0;
   LOG(INFO) << "***** Loadstep = " << getCurrentStep() << ", Time = "
       << getCurrentTime() << " of " << getEndTime();
@@ -64,6 +76,16 @@ void TimeControl::nextEquilibriumStep() {
 }
 
 
+double TimeControl::rollbackStep() {
+  double delta = currentTime - previousTime;
+  currentTime = previousTime;
+  currentEquilibriumStep = 0;
+  LOG(INFO) << "***** Loadstep = " << getCurrentStep() << " is rolled back to Time = "
+      << getCurrentTime();
+  return delta;
+}
+
+
 double TimeControl::getCurrentTime() {
   return currentTime;
 }
@@ -102,6 +124,11 @@ double TimeControl::getCurrentNormalizedTimeDelta() {
 }
 
 
+double TimeControl::getStopTime() {
+  return stopTime;
+}
+
+
 void TimeControl::setEndTime(double _endTime) {
   LOG_IF(currentTime > 0.0, ERROR) << "Trying to set end time = " << _endTime
       << " when solution is running (current time = " << currentTime << ")";
@@ -199,6 +226,13 @@ void FESolver::initSolutionData() {
   vecRl.reinit(*(storage->getR()), storage->nConstrainedDofs() + storage->nUnknownDofs(), storage->nMpc());
   vecRsl.reinit(*(storage->getR()), storage->nConstrainedDofs(), storage->nUnknownDofs() + storage->nMpc());
 
+  if (eqSolver && eqSolver->isNearNullSpaceNeeded()) {
+    std::vector<double> modes;
+    std::vector<uint32> eqNodes;
+    storage->getRigidBodyModes(modes, eqNodes);
+    eqSolver->setNearNullSpace(6, modes, eqNodes);
+  }
+
   if (storage->isTransient()) {
     matC = storage->getC();
     matM = storage->getM();
@@ -430,20 +464,76 @@ void NonlinearFESolver::solve() {
   dVec deltaUsl(deltaU, storage->nConstrainedDofs(), storage->nUnknownDofs() + storage->nMpc());
   dVec deltaUs(deltaU, storage->nConstrainedDofs(), storage->nUnknownDofs());
   dVec deltaUl(deltaU, storage->nConstrainedDofs() + storage->nUnknownDofs(), storage->nMpc());
+  // for the line search: unknown DoF values before the increment and forces of Mpc equations on
+  // unknown DoFs
+  dVec Us0(storage->nUnknownDofs());
+  dVec constraintForces(storage->nUnknownDofs());
+
+  IterationMethod method = iterationMethod;
+  if (method != FULL_NEWTON && storage->nMpcCollections() > 0) {
+    LOG(WARNING) << "Full Newton-Raphson iterations are used for the model with Mpc collections";
+    method = FULL_NEWTON;
+  }
+  if (method == BFGS && storage->nMpc() > 0) {
+    LOG(WARNING) << "Modified Newton-Raphson iterations are used for the model with Mpc equations";
+    method = MODIFIED_NEWTON;
+  }
+  // number of iterations made with the current factorization of matK
+  uint16 factorizationAge = 0;
+  bool forceRefactorize = true;
+  // for BFGS: rhs and applied increment of unknowns of the previous iteration
+  dVec prevRhs(storage->nUnknownDofs() + storage->nMpc());
+  dVec prevStep(storage->nUnknownDofs() + storage->nMpc());
 
   for (size_t i = 0; i < getNumberOfPostProcessors(); i++) {
     postProcessors[i]->pre();
   }
 
   double currentCriteria = 0.0;
-  double timeDelta = (timeControl.getEndTime() - timeControl.getStartTime()) / numberOfLoadsteps;
+  // PostProcessors are called at the ends of loadsteps. With adaptive stepping a loadstep can be
+  // solved in several steps of timeControl with time increment timeDelta
+  double loadstepDelta = (timeControl.getEndTime() - timeControl.getStartTime()) / numberOfLoadsteps;
+  double timeDelta = loadstepDelta;
+  uint16 loadstep = 0;
+  // number of easy steps in a row (see easyIterations)
+  uint16 easySteps = 0;
+  // true if matK and vecF (assembledK) or only vecF (assembledF) are already assembled for current
+  // DoF values (by the line search). Element matrices don't depend on time, so they are valid for
+  // the next loadstep as well.
+  bool assembledK = false;
+  bool assembledF = false;
+  // the last converged state to roll back to
+  dVec U0;
+  dVec Ucprev0;
+  if (useAdaptiveStepping) {
+    U0 = vecU;
+    Ucprev0 = Ucprev;
+    storage->saveElementStates();
+  }
 
-  while (timeControl.nextStep(timeDelta)) {
+  while (timeControl.nextStep(timeDelta,
+        timeControl.getStartTime() + (loadstep + 1) * loadstepDelta)) {
     bool converged = false;
+    bool diverged = false;
+    // the best convergence criteria of the step and the number of iterations in a row which didn't
+    // improve it
+    double bestCriteria = 0.0;
+    uint16 stalledIterations = 0;
     for (;;) {
       timeControl.nextEquilibriumStep();
+      bool refactorize = method == FULL_NEWTON || forceRefactorize ||
+          (refactorizeIterations > 0 && factorizationAge >= refactorizeIterations);
+      forceRefactorize = false;
+      if (refactorize) {
+        if (!assembledK) {
+          storage->assembleGlobalEqMatrices();
+        }
+      } else if (!assembledF) {
+        storage->assembleResidual();
+      }
+      assembledK = false;
+      assembledF = false;
       vecR.zero();
-      storage->assembleGlobalEqMatrices();
       applyBoundaryConditions(timeControl.getCurrentNormalizedTime());
 
       deltaUc = vecUc - Ucprev;
@@ -451,16 +541,26 @@ void NonlinearFESolver::solve() {
       rhs += vecFsl;
       rhs += vecRsl;
       // nConstr x (nUnknown + nMPC)
+      // NOTE: deltaUc != 0 only on the first iteration of a step
       matBTVprod(*(matK->block(1,2)), deltaUc, -1.0, rhs);
 
       // solve equation system
-      eqSolver->solveEquations(matK->block(2), rhs.ptr(), deltaUsl.ptr());
-
-      // restore DoF values from increments
-      vecUs += deltaUs;
-      vecUl = deltaUl;
+      if (refactorize) {
+        eqSolver->factorizeEquations(matK->block(2));
+        factorizationAge = 0;
+        clearBfgsUpdates();
+      } else if (method == BFGS && timeControl.getCurrentEquilibriumStep() > 2) {
+        // the first iteration of a step isn't used because of the increment of constrained DoFs
+        addBfgsUpdate(prevStep, prevRhs, rhs);
+      }
+      factorizationAge++;
+      if (method == BFGS) {
+        bfgsSubstitute(rhs, deltaUsl);
+      } else {
+        eqSolver->substituteEquations(matK->block(2), rhs.ptr(), deltaUsl.ptr());
+      }
 
-      // restore constrained DoFs reactions
+      // restore constrained DoFs reactions (the line search below reassembles matK)
       vecRc.zero();
       matBVprod(*(matK->block(1)), deltaUc, 1.0, vecRc);
       matBVprod(*(matK->block(1,2)), deltaUsl, 1.0, vecRc);
@@ -468,11 +568,66 @@ void NonlinearFESolver::solve() {
 
       Ucprev = vecUc;
 
-      storage->updateResults();
-
       // calculate convergence criteria
+      double previousCriteria = currentCriteria;
       currentCriteria = calculateCriteria(deltaUs);
 
+      // Iterations with the reused matrix converge linearly. If the rate of the last iteration isn't
+      // enough to converge in the rest of numberOfIterations, it's cheaper to refactorize matK than
+      // to fail the step.
+      if (method != FULL_NEWTON && timeControl.getCurrentEquilibriumStep() > 1 &&
+          currentCriteria >= convergenceCriteria) {
+        double rate = currentCriteria / previousCriteria;
+        uint16 rest = numberOfIterations - timeControl.getCurrentEquilibriumStep();
+        if (rate >= 1.0 || currentCriteria * pow(rate, rest) >= convergenceCriteria) {
+          LOG(INFO) << "Slow convergence (rate " << rate << "), the matrix will be refactorized";
+          forceRefactorize = true;
+        }
+      }
+      // matK is needed on the next iteration
+      bool nextWithK = method == FULL_NEWTON || forceRefactorize ||
+          (refactorizeIterations > 0 && factorizationAge >= refactorizeIterations);
+
+      // restore DoF values from increments
+      vecUl = deltaUl;
+      double alpha = 1.0;
+      // the increment of the converged iteration is small enough to be applied as is
+      if (useLineSearch && currentCriteria >= convergenceCriteria) {
+        // Mpc equations add forces C^T * lambda on unknown DoFs. rhs - C^T * lambda is the
+        // out-of-balance force on unknown DoFs predicted by the linearized system at alpha = 0.
+        constraintForces.zero();
+        if (storage->nMpc() > 0) {
+          dVec lambdas(storage->nUnknownDofs() + storage->nMpc());
+          dVec forces(storage->nUnknownDofs() + storage->nMpc());
+          dVec lambdasl(lambdas, storage->nUnknownDofs(), storage->nMpc());
+          lambdasl = deltaUl;
+          matBVprod(*(matK->block(2)), lambdas, 1.0, forces);
+          for (uint32 i = 0; i < constraintForces.size(); i++) {
+            constraintForces[i] = forces[i];
+          }
+        }
+        double s0 = 0.0;
+        double r0 = 0.0;
+        for (uint32 i = 0; i < deltaUs.size(); i++) {
+          double r = rhs[i] - constraintForces[i];
+          s0 += deltaUs[i] * r;
+          r0 += r * r;
+        }
+        Us0 = vecUs;
+        alpha = lineSearch(Us0, deltaUs, constraintForces, s0, sqrt(r0), nextWithK);
+        assembledK = nextWithK;
+        assembledF = true;
+      } else {
+        vecUs += deltaUs;
+        storage->updateResults();
+      }
+      if (method == BFGS) {
+        prevRhs = rhs;
+        for (uint32 i = 0; i < prevStep.size(); i++) {
+          prevStep[i] = alpha * deltaUsl[i];
+        }
+      }
+
       // TODO: 1. It seems that currentCriteria is already normalized in calculateCriteria(). we
       //          need to compare currentCriteria with 1.0 
       // TODO: 2. Current convergence criteria is not good. We need to introduce equilibrium balance
@@ -481,20 +636,71 @@ void NonlinearFESolver::solve() {
         converged = true;
         break;
       }
-      LOG_IF(currentCriteria > 1.0e6 || std::isnan(currentCriteria), FATAL) << "The solution is diverged!";
+      if (currentCriteria > 1.0e6 || std::isnan(currentCriteria)) {
+        LOG_IF(!useAdaptiveStepping, FATAL) << "The solution is diverged!";
+        LOG(WARNING) << "The solution is diverged!";
+        diverged = true;
+        break;
+      }
+      if (timeControl.getCurrentEquilibriumStep() == 1 || currentCriteria < bestCriteria) {
+        bestCriteria = currentCriteria;
+        stalledIterations = 0;
+      } else {
+        stalledIterations++;
+      }
+      // Newton iterations which are going to converge improve the criteria every iteration (but the
+      // first ones). Don't waste iterations if the step will be repeated with smaller increment.
+      if (useAdaptiveStepping && stalledIterations >= maxStalledIterations) {
+        LOG(WARNING) << "The convergence criteria isn't improved in " << stalledIterations
+            << " iterations in a row";
+        break;
+      }
 
       if (timeControl.getCurrentEquilibriumStep() >= numberOfIterations) 
         break;
     }//iterations
 
+    if (!converged && useAdaptiveStepping) {
+      // roll back to the last converged step and repeat it with smaller time increment
+      double failedDelta = timeControl.rollbackStep();
+      LOG_IF(failedDelta <= minTimeDeltaFraction * loadstepDelta * (1.0 + 1.0e-9), FATAL)
+          << "The solution is not converged with the minimal time increment " << failedDelta;
+      timeDelta = std::max(failedDelta * cutbackFactor, minTimeDeltaFraction * loadstepDelta);
+      LOG(INFO) << "The step is " << (diverged ? "diverged" : "not converged")
+          << ", time increment is reduced to " << timeDelta;
+      vecU = U0;
+      Ucprev = Ucprev0;
+      storage->restoreElementStates();
+      easySteps = 0;
+      assembledK = false;
+      assembledF = false;
+      forceRefactorize = true;
+      continue;
+    }
     LOG_IF(!converged, FATAL) << "The solution is not converged with "
         << timeControl.getCurrentEquilibriumStep() << " equilibrium iterations";
     LOG(INFO) << "Loadstep " << timeControl.getCurrentStep() << " completed with " << timeControl.getCurrentEquilibriumStep();
 
+    if (useAdaptiveStepping) {
+      U0 = vecU;
+      Ucprev0 = Ucprev;
+      storage->saveElementStates();
+      easySteps = (timeControl.getCurrentEquilibriumStep() <= easyIterations) ? easySteps + 1 : 0;
+      if (easySteps >= growthSteps && timeDelta < loadstepDelta) {
+        timeDelta = std::min(timeDelta * growthFactor, loadstepDelta);
+        easySteps = 0;
+        LOG(INFO) << "Time increment is increased to " << timeDelta;
+      }
+    }
+
+    if (timeControl.getCurrentTime() < timeControl.getStopTime()) {
+      continue;
+    }
+    loadstep++;
     // TODO: figure out why TIMED_BLOCK doesn't work here..
     // TIMED_BLOCK(t, "PostProcessor::process") {
         for (size_t i = 0; i < getNumberOfPostProcessors(); i++) {
-          postProcessors[i]->process (timeControl.getCurrentStep());
+          postProcessors[i]->process (loadstep);
         }
 //    }
   } //loadsteps
@@ -502,12 +708,130 @@ void NonlinearFESolver::solve() {
 
 //  TIMED_BLOCK(t, "PostProcessor::post") {
       for (size_t i = 0; i < getNumberOfPostProcessors(); i++) {
-        postProcessors[i]->post (timeControl.getCurrentStep());
+        postProcessors[i]->post (loadstep);
       }
 //  }
 }
 
 
+double NonlinearFESolver::lineSearch(dVec& Us0, dVec& deltaUs, dVec& constraintForces, double s0,
+                                     double r0, bool withK) {
+  double alpha = 1.0;
+  // the full step is accepted in most iterations, so matK is assembled along with vecF for it to
+  // be used by the next iteration
+  bool assembledK = withK;
+  for (uint16 i = 0; ; i++) {
+    for (uint32 j = 0; j < vecUs.size(); j++) {
+      vecUs[j] = Us0[j] + alpha * deltaUs[j];
+    }
+    storage->updateResults();
+    if (i == 0 && withK) {
+      storage->assembleGlobalEqMatrices();
+    } else {
+      storage->assembleResidual();
+      assembledK = false;
+    }
+    double s, r;
+    outOfBalance(deltaUs, constraintForces, s, r);
+    LOG(INFO) << "Line search: step length = " << alpha << ", s/s0 = " << s / s0
+              << ", |r|/|r0| = " << r / r0;
+    if (r < r0 || fabs(s) <= lineSearchTolerance * fabs(s0)) {
+      break;
+    }
+    if (i == lineSearchIterations || alpha <= lineSearchMinStep) {
+      break;
+    }
+    // root of linear interpolation of s(alpha) between 0 and alpha if s changes the sign,
+    // otherwise (or if the residual isn't a number) the step is halved
+    double nextAlpha = 0.5 * alpha;
+    if (!std::isnan(s) && s * s0 < 0.0) {
+      nextAlpha = alpha * s0 / (s0 - s);
+    }
+    alpha = std::max(nextAlpha, lineSearchMinStep);
+  }
+  if (withK && !assembledK) {
+    storage->assembleGlobalEqMatrices();
+  }
+  return alpha;
+}
+
+
+void NonlinearFESolver::outOfBalance(dVec& deltaUs, dVec& constraintForces, double& s, double& r) {
+  s = 0.0;
+  r = 0.0;
+  for (uint32 i = 0; i < deltaUs.size(); i++) {
+    double f = vecFs[i] + vecRs[i] - constraintForces[i];
+    s += deltaUs[i] * f;
+    r += f * f;
+  }
+  r = sqrt(r);
+}
+
+
+void NonlinearFESolver::clearBfgsUpdates() {
+  bfgsS.clear();
+  bfgsY.clear();
+  bfgsRho.clear();
+}
+
+
+void NonlinearFESolver::addBfgsUpdate(dVec& step, dVec& prevRhs, dVec& rhs) {
+  dVec y(rhs.size());
+  double ys = 0.0;
+  double yy = 0.0;
+  double ss = 0.0;
+  for (uint32 i = 0; i < y.size(); i++) {
+    y[i] = prevRhs[i] - rhs[i];
+    ys += y[i] * step[i];
+    yy += y[i] * y[i];
+    ss += step[i] * step[i];
+  }
+  // the update is undefined if the residual doesn't change along the step
+  if (!(ys > 1.0e-12 * sqrt(yy * ss))) {
+    LOG(INFO) << "BFGS update is skipped";
+    return;
+  }
+  if (bfgsS.size() >= bfgsUpdates) {
+    bfgsS.erase(bfgsS.begin());
+    bfgsY.erase(bfgsY.begin());
+    bfgsRho.erase(bfgsRho.begin());
+  }
+  bfgsS.push_back(step);
+  bfgsY.push_back(std::move(y));
+  bfgsRho.push_back(1.0 / ys);
+}
+
+
+void NonlinearFESolver::bfgsSubstitute(dVec& rhs, dVec& deltaUsl) {
+  // two-loop recursion: H = V_k^T * H_{k-1} * V_k + rho_k * s_k * s_k^T, V_k = I - rho_k * y_k *
+  // s_k^T, H_0 - inverse of the factorized matrix
+  size_t m = bfgsS.size();
+  dVec q(rhs);
+  std::vector<double> a(m);
+  for (size_t k = m; k-- > 0; ) {
+    double sq = 0.0;
+    for (uint32 i = 0; i < q.size(); i++) {
+      sq += bfgsS[k][i] * q[i];
+    }
+    a[k] = bfgsRho[k] * sq;
+    for (uint32 i = 0; i < q.size(); i++) {
+      q[i] -= a[k] * bfgsY[k][i];
+    }
+  }
+  eqSolver->substituteEquations(matK->block(2), q.ptr(), deltaUsl.ptr());
+  for (size_t k = 0; k < m; k++) {
+    double yz = 0.0;
+    for (uint32 i = 0; i < deltaUsl.size(); i++) {
+      yz += bfgsY[k][i] * deltaUsl[i];
+    }
+    double b = a[k] - bfgsRho[k] * yz;
+    for (uint32 i = 0; i < deltaUsl.size(); i++) {
+      deltaUsl[i] += b * bfgsS[k][i];
+    }
+  }
+}
+
+
 double NonlinearFESolver::calculateCriteria(dVec& delta) {
   double curCriteria = 0.0;
   for (uint32 i = 0; i < delta.size(); i++) {
@@ -23,7 +23,9 @@ class PostProcessor;
 // nextStep(delta) where delta is solver specific time step. For every time step many equilibrium
 // iterations could be performed by nextEquilibriumStep(). All intermediate time steps are stored in
 // convergedTimeInstances, for every time steps number of equilibrium steps are stored in
-// equilibriumSteps.
+// equilibriumSteps. nextStep(delta, stopTime) doesn't step over `stopTime`, it's used to split a
+// loadstep into substeps. A step which isn't converged can be discarded by rollbackStep() and then
+// repeated with a smaller delta.
 class TimeControl {
 public:
   uint16 getCurrentStep ();
@@ -33,7 +35,10 @@ public:
   uint16 getTotalNumberOfEquilibriumSteps ();
 
   bool nextStep (double delta);
+  bool nextStep (double delta, double stopTime);
   void nextEquilibriumStep ();
+  // return to the time of the last converged step, returns time increment of the discarded step
+  double rollbackStep ();
 
   double getCurrentTime ();
   double getCurrentNormalizedTime ();
@@ -41,6 +46,7 @@ public:
   double getStartTime ();
   double getCurrentTimeDelta ();
   double getCurrentNormalizedTimeDelta ();
+  double getStopTime ();
 
   void setEndTime (double _endTime);
   void setStartTime (double _startTime);
@@ -53,6 +59,8 @@ protected:
   double endTime = 1.0;
   double startTime = 0.0;
   double currentTime = 0.0;
+  double previousTime = 0.0;
+  double stopTime = 1.0;
 };
 
 // The abstract class that represents the FE solver. This class use information and methods from
@@ -212,9 +220,83 @@ class NonlinearFESolver : public FESolver {
 
     double convergenceCriteria = 1.0e-3;
 
+    // Backtracking line search along Newton increments (see lineSearch()). The step length alpha is
+    // accepted if the norm of out-of-balance force at U + alpha * deltaU is less than at alpha = 0
+    // or if |s(alpha)| <= lineSearchTolerance * |s(0)|, where s(alpha) is the out-of-balance force
+    // projected onto deltaU. Trial steps are shortened at most lineSearchIterations times, but not
+    // below lineSearchMinStep. The line search isn't done for the increment of the converged
+    // iteration.
+    bool useLineSearch = true;
+    double lineSearchTolerance = 0.8;
+    uint16 lineSearchIterations = 5;
+    double lineSearchMinStep = 0.1;
+
+    // Adaptive load stepping (off by default: a step which isn't converged stops the solution). A
+    // loadstep (numberOfLoadsteps of them divide the time range evenly) is solved in one or more
+    // steps. If equilibrium iterations of a step don't converge or diverge, DoF values and element
+    // states (see FEStorage::saveElementStates(), elements which keep their state outside of
+    // IntPointArena should implement Element::saveState()) are rolled back to the last converged
+    // step and the step is repeated with the time increment multiplied by cutbackFactor, but not
+    // less than minTimeDeltaFraction of the loadstep. A step is treated as failed as well if the
+    // convergence criteria isn't improved in maxStalledIterations iterations in a row. After
+    // growthSteps steps in a row converged in at most easyIterations iterations the time increment
+    // is multiplied by growthFactor, but it's never bigger than the loadstep. PostProcessors are
+    // called only at the ends of loadsteps.
+    bool useAdaptiveStepping = false;
+    double cutbackFactor = 0.5;
+    double minTimeDeltaFraction = 1.0 / 64;
+    uint16 maxStalledIterations = 2;
+    uint16 easyIterations = 5;
+    uint16 growthSteps = 2;
+    double growthFactor = 2.0;
+
+    // Method of equilibrium iterations:
+    // FULL_NEWTON - matK is assembled and factorized on every iteration;
+    // MODIFIED_NEWTON - the factorized matK is reused by next iterations and steps, they assemble
+    //   only vecF (see FEStorage::assembleResidual());
+    // BFGS - as MODIFIED_NEWTON, but increments are corrected by BFGS updates of the inverse of the
+    //   factorized matrix (Matthies H., Strang G. The solution of nonlinear finite element
+    //   equations, 1979). At most bfgsUpdates latest updates are kept.
+    // matK is refactorized when the convergence rate of the last iteration predicts that the step
+    // doesn't converge in numberOfIterations, after a cutback and every refactorizeIterations
+    // iterations if refactorizeIterations > 0. Coefficients of Mpc
+    // collections change from iteration to iteration, so models with Mpc collections are always
+    // solved by FULL_NEWTON. Lagrange multipliers of Mpc equations are solved as total values, which
+    // doesn't fit BFGS updates, so BFGS falls back to MODIFIED_NEWTON for models with Mpc equations.
+    enum IterationMethod {
+      FULL_NEWTON,
+      MODIFIED_NEWTON,
+      BFGS
+    };
+    IterationMethod iterationMethod = FULL_NEWTON;
+    uint16 refactorizeIterations = 0;
+    uint16 bfgsUpdates = 20;
+
     virtual void solve();
   protected:
     double calculateCriteria(dVec& delta);
+    // find the step length along `deltaUs` from `Us0`. `constraintForces` - forces of Mpc equations
+    // on unknown DoFs, `s0` and `r0` - projection onto `deltaUs` and norm of the linearized
+    // out-of-balance force at alpha = 0. On exit vecUs = Us0 + alpha * deltaUs, element states and
+    // vecF correspond to these values. `withK` - matK is assembled for the accepted step too: along
+    // with vecF of the full step, or once more after shortened trial steps, which assemble only
+    // vecF (see FEStorage::assembleResidual()).
+    double lineSearch(dVec& Us0, dVec& deltaUs, dVec& constraintForces, double s0, double r0,
+                      bool withK);
+    // out-of-balance force on unknown DoFs for current vecF and vecR: `s` - its projection onto
+    // `deltaUs`, `r` - its norm
+    void outOfBalance(dVec& deltaUs, dVec& constraintForces, double& s, double& r);
+
+    // BFGS updates since the last factorization of matK: `bfgsS` - applied increments of unknowns,
+    // `bfgsY` - corresponding decrements of the rhs, bfgsRho[k] = 1 / (bfgsY[k] * bfgsS[k])
+    std::vector<dVec> bfgsS;
+    std::vector<dVec> bfgsY;
+    std::vector<double> bfgsRho;
+    void clearBfgsUpdates();
+    // add the update for `step` made from the state with rhs `prevRhs` to the state with `rhs`
+    void addBfgsUpdate(dVec& step, dVec& prevRhs, dVec& rhs);
+    // solve for `deltaUsl` with the factorized matK corrected by BFGS updates
+    void bfgsSubstitute(dVec& rhs, dVec& deltaUsl);
 };
 
 
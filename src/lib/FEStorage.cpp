@@ -4,6 +4,15 @@
 
 #include "FEStorage.h"
 #include "elements/element.h"
+#include "elements/ElementDispatch.h"
+#include "math/GraphOrdering.h"
+#include "math/MatBatch.h"
+
+#include <typeinfo>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace nla3d {
 using namespace math;
@@ -23,18 +32,83 @@ FEStorage::~FEStorage () {
 }
 
 
+// assemble a batch of elements of one bucket (see assembleElementBatch())
+struct FEStorage::BatchAssembler {
+  FEStorage* storage;
+  const uint32* ind;
+  uint16 n;
+  ElementMatrices* em;
+
+  template <class ET>
+  void apply() {
+    storage->assembleElementBatch<ET>(ind, n, em);
+  }
+};
+
+
+// assemble rhs of a batch of elements of one bucket (see assembleElementFBatch())
+struct FEStorage::ResidualAssembler {
+  FEStorage* storage;
+  const uint32* ind;
+  uint16 n;
+  ElementMatrices* em;
+
+  template <class ET>
+  void apply() {
+    storage->assembleElementFBatch<ET>(ind, n, em);
+  }
+};
+
+
+// update elements of a bucket (see updateElements())
+struct FEStorage::BucketUpdater {
+  FEStorage* storage;
+  const std::vector<uint32>& ind;
+
+  template <class ET>
+  void apply() {
+    storage->updateElements<ET>(ind);
+  }
+};
+
+
+template <class Func>
+void FEStorage::dispatchBucket(const ElementBucket& bucket, Func& f) {
+  if (!bucket.exact || !dispatchElementType(bucket.type, f)) {
+    f.template apply<Element>();
+  }
+}
+
+
 void FEStorage::assembleGlobalEqMatrices() {
 	assert(matK);
   assert(matK->isCompressed());
 
   TIMED_SCOPE(t, "assembleGlobalEqMatrix");
+  numberOfAssemblies++;
   LOG(INFO) << "Start formulation of global eq. matrices ( " << nElements() << " elements)";
 
   zeroK();
   zeroF();
 
-  for (uint32 el = 0; el < nElements(); el++) {
-    elements[el]->buildK();
+  // Elements of one color don't share nodes, so they can be assembled concurrently. Every entry of
+  // global matrices gets contributions in the same order (color by color) regardless of number of
+  // threads, therefore the result is always the same.
+  for (size_t c = 0; c < elementColors.size(); c++) {
+    const std::vector<uint32>& color = elementColors[c];
+    const std::vector<uint32>& batches = colorBatches[c];
+    int32 nBatches = static_cast<int32> (batches.size()) - 1;
+#pragma omp parallel
+    {
+      std::vector<ElementMatrices> em(BATCH_LANES);
+#pragma omp for schedule(dynamic, 2)
+      for (int32 b = 0; b < nBatches; b++) {
+        // all elements of a batch are from the same bucket
+        BatchAssembler assembler{this, &color[batches[b]],
+                                 static_cast<uint16> (batches[b + 1] - batches[b]), em.data()};
+        dispatchBucket(elementBuckets[elementBucket[color[batches[b]]]], assembler);
+      }
+    }
   }
   //t.checkpoint("Element::build()");
 
@@ -69,12 +143,251 @@ void FEStorage::assembleGlobalEqMatrices() {
     zeroC();
     zeroM();
 
-    for (uint32 el = 0; el < nElements(); el++) {
-      elements[el]->buildC();
-      elements[el]->buildM();
+    for (auto& color : elementColors) {
+      int32 n = static_cast<int32> (color.size());
+#pragma omp parallel for schedule(dynamic, 16)
+      for (int32 i = 0; i < n; i++) {
+        elements[color[i]]->buildC();
+        elements[color[i]]->buildM();
+      }
+    }
+  }
+
+}
+
+
+void FEStorage::assembleResidual() {
+  TIMED_SCOPE(t, "assembleResidual");
+  numberOfResidualAssemblies++;
+
+  zeroF();
+  assemblingResidual = true;
+  // the same order of contributions as in assembleGlobalEqMatrices()
+  for (size_t c = 0; c < elementColors.size(); c++) {
+    const std::vector<uint32>& color = elementColors[c];
+    const std::vector<uint32>& batches = colorBatches[c];
+    int32 nBatches = static_cast<int32> (batches.size()) - 1;
+#pragma omp parallel
+    {
+      std::vector<ElementMatrices> em(BATCH_LANES);
+#pragma omp for schedule(dynamic, 2)
+      for (int32 b = 0; b < nBatches; b++) {
+        ResidualAssembler assembler{this, &color[batches[b]],
+                                    static_cast<uint16> (batches[b + 1] - batches[b]), em.data()};
+        dispatchBucket(elementBuckets[elementBucket[color[batches[b]]]], assembler);
+      }
+    }
+  }
+  assemblingResidual = false;
+
+  for (size_t i = 0; i < mpcCollections.size(); i++) {
+    mpcCollections[i]->update();
+  }
+  for (auto& mpc : mpcs) {
+    assert(mpc->eqNum > 0 && mpc->eqNum <= vecF.size());
+    vecF[mpc->eqNum - 1] = mpc->b;
+  }
+}
+
+
+template <class ET>
+void FEStorage::assembleElementK(uint32 ind, ElementMatrices& em) {
+  Element* el = elements[ind];
+  ElementCache* cache = nullptr;
+  if (useElementCache && ElementCalls<ET>::isLinear(el)) {
+    cache = &elementCache[ind];
+    if (cache->ready) {
+      replayElementK(ind);
+      return;
+    }
+    // scatterElementK/F() record values while the element is assembled
+    *cache = ElementCache();
+    cache->recording = true;
+  }
+
+  if (ElementCalls<ET>::computeK(el, em)) {
+    scatterElementMatrices(el->getElNum(), em);
+  } else {
+    ElementCalls<ET>::buildK(el);
+  }
+
+  if (cache) {
+    cache->recording = false;
+    cache->ready = true;
+  }
+}
+
+
+template <class ET>
+void FEStorage::assembleElementBatch(const uint32* ind, uint16 n, ElementMatrices* em) {
+  assert(n > 0 && n <= BATCH_LANES);
+  Element* first = elements[ind[0]];
+  // linear elements are taken from the cache (see assembleElementK())
+  if (n > 1 && !(useElementCache && ElementCalls<ET>::isLinear(first))) {
+    Element* batch[BATCH_LANES];
+    for (uint16 i = 0; i < n; i++) {
+      batch[i] = elements[ind[i]];
+    }
+    if (ElementCalls<ET>::computeKBatch(batch, n, em)) {
+      for (uint16 i = 0; i < n; i++) {
+        scatterElementMatrices(batch[i]->getElNum(), em[i]);
+      }
+      return;
+    }
+  }
+  for (uint16 i = 0; i < n; i++) {
+    assembleElementK<ET>(ind[i], em[0]);
+  }
+}
+
+
+template <class ET>
+void FEStorage::assembleElementF(uint32 ind, ElementMatrices& em) {
+  Element* el = elements[ind];
+  if (useElementCache && ElementCalls<ET>::isLinear(el) && elementCache[ind].ready) {
+    replayElementF(ind);
+    return;
+  }
+
+  if (ElementCalls<ET>::computeF(el, em)) {
+    if (em.Fe.size()) {
+      scatterElementF(el->getElNum(), static_cast<uint16> (em.eq.size()), em.eq.data(),
+                      em.Fe.data());
+    }
+  } else {
+    ElementCalls<ET>::buildK(el);
+  }
+}
+
+
+template <class ET>
+void FEStorage::assembleElementFBatch(const uint32* ind, uint16 n, ElementMatrices* em) {
+  assert(n > 0 && n <= BATCH_LANES);
+  Element* first = elements[ind[0]];
+  if (n > 1 && !(useElementCache && ElementCalls<ET>::isLinear(first))) {
+    Element* batch[BATCH_LANES];
+    for (uint16 i = 0; i < n; i++) {
+      batch[i] = elements[ind[i]];
+    }
+    if (ElementCalls<ET>::computeFBatch(batch, n, em)) {
+      for (uint16 i = 0; i < n; i++) {
+        if (em[i].Fe.size()) {
+          scatterElementF(batch[i]->getElNum(), static_cast<uint16> (em[i].eq.size()),
+                          em[i].eq.data(), em[i].Fe.data());
+        }
+      }
+      return;
+    }
+  }
+  for (uint16 i = 0; i < n; i++) {
+    assembleElementF<ET>(ind[i], em[0]);
+  }
+}
+
+
+void FEStorage::scatterElementMatrices(uint32 el, ElementMatrices& em) {
+  uint16 n = static_cast<uint16> (em.eq.size());
+  assert(em.Ke.size() == (size_t) n * (n + 1) / 2);
+  scatterElementK(el, n, em.eq.data(), em.Ke.data());
+  if (em.Fe.size()) {
+    assert(em.Fe.size() == n);
+    scatterElementF(el, n, em.eq.data(), em.Fe.data());
+  }
+}
+
+
+void FEStorage::replayElementK(uint32 ind) {
+  const ElementCache& cache = elementCache[ind];
+  const std::vector<uint32>& slots = elementSlots[ind];
+  assert(slots.size() == cache.Ke.size());
+  for (size_t k = 0; k < slots.size(); k++) {
+    matK->addValueBySlot(slots[k], cache.Ke[k]);
+  }
+  replayElementF(ind);
+}
+
+
+void FEStorage::replayElementF(uint32 ind) {
+  const ElementCache& cache = elementCache[ind];
+  for (size_t i = 0; i < cache.Fe.size(); i++) {
+    vecF[cache.eqF[i] - 1] += cache.Fe[i];
+  }
+}
+
+
+void FEStorage::clearElementCache() {
+  elementCache.clear();
+  elementCache.resize(elementSlots.size());
+}
+
+
+const std::vector<uint32>& FEStorage::getElementSlots(uint32 el, uint16 n, const uint32* eq) {
+  assert(el > 0 && el <= elementSlots.size());
+  // NOTE: elements assembled in parallel have different maps, so it's safe to build them here
+  std::vector<uint32>& slots = elementSlots[el - 1];
+  if (slots.size() == 0) {
+    slots.reserve(n * (n + 1) / 2);
+    for (uint16 i = 0; i < n; i++) {
+      for (uint16 j = i; j < n; j++) {
+        slots.push_back(getMatrixSlot(eq[i], eq[j]));
+      }
+    }
+  }
+  assert(slots.size() == (size_t) n * (n + 1) / 2);
+  return slots;
+}
+
+
+void FEStorage::scatterElementK(uint32 el, uint16 n, const uint32* eq, const double* Ke) {
+  if (assemblingResidual) {
+    return;
+  }
+  const std::vector<uint32>& slots = getElementSlots(el, n, eq);
+  for (size_t k = 0; k < slots.size(); k++) {
+    matK->addValueBySlot(slots[k], Ke[k]);
+  }
+  ElementCache& cache = elementCache[el - 1];
+  if (cache.recording) {
+    // an element could scatter its matrix by parts
+    if (cache.Ke.size() == 0) {
+      cache.Ke.assign(Ke, Ke + slots.size());
+    } else {
+      assert(cache.Ke.size() == slots.size());
+      for (size_t k = 0; k < slots.size(); k++) {
+        cache.Ke[k] += Ke[k];
+      }
     }
   }
+}
+
 
+void FEStorage::scatterElementC(uint32 el, uint16 n, const uint32* eq, const double* Ce) {
+  const std::vector<uint32>& slots = getElementSlots(el, n, eq);
+  for (size_t k = 0; k < slots.size(); k++) {
+    matC->addValueBySlot(slots[k], Ce[k]);
+  }
+}
+
+
+void FEStorage::scatterElementM(uint32 el, uint16 n, const uint32* eq, const double* Me) {
+  const std::vector<uint32>& slots = getElementSlots(el, n, eq);
+  for (size_t k = 0; k < slots.size(); k++) {
+    matM->addValueBySlot(slots[k], Me[k]);
+  }
+}
+
+
+void FEStorage::scatterElementF(uint32 el, uint16 n, const uint32* eq, const double* Fe) {
+  for (uint16 i = 0; i < n; i++) {
+    assert(eq[i] > 0 && eq[i] <= vecF.size());
+    vecF[eq[i] - 1] += Fe[i];
+  }
+  assert(el > 0 && el <= elementCache.size());
+  ElementCache& cache = elementCache[el - 1];
+  if (cache.recording) {
+    cache.eqF.insert(cache.eqF.end(), eq, eq + n);
+    cache.Fe.insert(cache.Fe.end(), Fe, Fe + n);
+  }
 }
 
 
@@ -129,7 +442,70 @@ void FEStorage::getElementNodes(uint32 el, Node** node_ptr) {
 	assert(el <= nElements());
   Element* elp = elements[el-1];
 	for (uint16 i=0; i<elp->getNNodes(); i++)
-		node_ptr[i] = nodes[elp->getNodeNumber(i)-1];
+		node_ptr[i] = &nodes[elp->getNodeNumber(i)-1];
+}
+
+
+void FEStorage::getRigidBodyModes(std::vector<double>& modes, std::vector<uint32>& eqNodes) {
+  const uint16 nModes = 6;
+  uint32 n = nUnknownDofs() + nMpc();
+  modes.assign(nModes * n, 0.0);
+  eqNodes.assign(n, 0);
+  if (nNodes() == 0) return;
+
+  // rotations are taken around the center of the model to keep the modes well scaled
+  double center[3] = {0.0, 0.0, 0.0};
+  double pos[3];
+  for (uint32 node = 1; node <= nNodes(); node++) {
+    getNodePosition(node, pos);
+    for (uint16 i = 0; i < 3; i++) {
+      center[i] += pos[i] / nNodes();
+    }
+  }
+
+  std::set<Dof::dofType> dofTypes = getUniqueNodeDofTypes();
+  for (uint32 node = 1; node <= nNodes(); node++) {
+    getNodePosition(node, pos);
+    double x = pos[0] - center[0];
+    double y = pos[1] - center[1];
+    double z = pos[2] - center[2];
+    for (auto type : dofTypes) {
+      if (!isNodeDofUsed(node, type)) continue;
+      Dof* dof = getNodeDof(node, type);
+      if (dof->isConstrained) continue;
+      uint32 row = dof->eqNumber - nConstrainedDofs() - 1;
+      eqNodes[row] = node;
+      // translations X, Y, Z and rotations around X, Y, Z
+      switch (type) {
+        case Dof::UX:
+          modes[0 * n + row] = 1.0;
+          modes[4 * n + row] = z;
+          modes[5 * n + row] = -y;
+          break;
+        case Dof::UY:
+          modes[1 * n + row] = 1.0;
+          modes[3 * n + row] = -z;
+          modes[5 * n + row] = x;
+          break;
+        case Dof::UZ:
+          modes[2 * n + row] = 1.0;
+          modes[3 * n + row] = y;
+          modes[4 * n + row] = -x;
+          break;
+        case Dof::ROTX:
+          modes[3 * n + row] = 1.0;
+          break;
+        case Dof::ROTY:
+          modes[4 * n + row] = 1.0;
+          break;
+        case Dof::ROTZ:
+          modes[5 * n + row] = 1.0;
+          break;
+        default:
+          break;
+      }
+    }
+  }
 }
 
 
@@ -137,7 +513,7 @@ void FEStorage::getElementNodes(uint32 el, Node** node_ptr) {
 void FEStorage::getNodePosition(uint32 n, double* ptr, bool deformed) {
 	assert(n > 0 && n <= nNodes());
 	for (uint16 i = 0; i < 3; i++) {
-		ptr[i] = nodes[n-1]->pos[i];
+		ptr[i] = nodes[n-1].pos[i];
   }
 	if (deformed) {
     if (isNodeDofUsed(n, Dof::UX)) {
@@ -191,9 +567,9 @@ void FEStorage::addFEComponent (FEComponent* comp) {
 
 
 void FEStorage::addNode (Node* node) {
-  //Node() fires Vec<3> constructor, thus Node coordinates are (0,0,0) by default
   //TODO: try-catch of memory overflow
-	nodes.push_back(node);
+	nodes.push_back(*node);
+  delete node;
 }
 
 
@@ -204,12 +580,7 @@ std::vector<uint32> FEStorage::createNodes (uint32 _nn) {
   newIndexes.reserve(_nn);
   uint32 nextNumber = nodes.size() + 1;
 
-  nodes.reserve(elements.size() + _nn);
-
-  for (uint32 i = 0; i < _nn; i++) {
-    Node* pnode = new Node;
-    nodes.push_back(pnode);
-  }
+  nodes.resize(nodes.size() + _nn);
 
   for (uint32 i = nextNumber; i <= nodes.size(); i++) {
     newIndexes.push_back(i);
@@ -219,10 +590,12 @@ std::vector<uint32> FEStorage::createNodes (uint32 _nn) {
 
 
 void FEStorage::addElement (Element* el) {
-  el->storage = this;
-  el->elNum = nElements() + 1;
   //TODO: try-catch of memory overflow
+  elementBlocks.emplace_back(new SingleElement(el));
 	elements.push_back(el);
+  el->elNum = nElements();
+  bindElementNodes(nElements() - 1);
+  el->storage = this;
 }
 
 
@@ -231,17 +604,46 @@ std::vector<uint32> FEStorage::createElements(uint32 _en, ElementType elType) {
   std::vector<uint32> newIndexes;
   newIndexes.reserve(_en);
   uint32 nextNumber = elements.size() + 1;
-  ElementFactory::createElements(elType, _en, elements); 
+  ElementBlock* block = ElementFactory::createElements(elType, _en, elements); 
+  if (block == nullptr) {
+    return newIndexes;
+  }
+  elementBlocks.emplace_back(block);
   for (uint32 i = nextNumber; i <= elements.size(); i++) {
     //access elNum protected values as friend
     elements[i - 1]->elNum = i;
     elements[i - 1]->storage = this;
     newIndexes.push_back(i);
   }
+  bindElementNodes(nextNumber - 1);
   return newIndexes;
 }
 
 
+void FEStorage::bindElementNodes(uint32 firstEl) {
+  if (elementNodesPtr.empty()) {
+    elementNodesPtr.push_back(0);
+  }
+  for (uint32 i = firstEl; i < nElements(); i++) {
+    elementNodesPtr.push_back(elementNodesPtr.back() + elements[i]->getNNodes());
+  }
+  uint32* oldData = elementNodes.data();
+  elementNodes.resize(elementNodesPtr.back(), 0);
+  // if the array was reallocated all elements should be rebound
+  uint32 from = (elementNodes.data() == oldData) ? firstEl : 0;
+  for (uint32 i = from; i < nElements(); i++) {
+    Element* el = elements[i];
+    uint32* nodes = elementNodes.data() + elementNodesPtr[i];
+    if (i >= firstEl && el->nodes != nullptr) {
+      // the element was filled before it was added to the storage (see addElement())
+      std::copy(el->nodes, el->nodes + el->getNNodes(), nodes);
+      delete[] el->nodes;
+    }
+    el->nodes = nodes;
+  }
+}
+
+
 void FEStorage::deleteMesh() {
 	deleteElements();
 	deleteNodes();
@@ -253,18 +655,16 @@ void FEStorage::deleteMesh() {
 
 
 void FEStorage::deleteNodes() {
-  for (uint32 i = 0; i < nNodes(); i++) {
-    delete nodes[i];
-  }
   nodes.clear();
 }
 
 
 void FEStorage::deleteElements() {
-  for (uint32 i = 0; i < nElements(); i++) {
-    delete elements[i];
-  }
+  elementBlocks.clear();
   elements.clear();
+  elementNodes.clear();
+  elementNodesPtr.clear();
+  intPointArena.clear();
 }
 
 
@@ -325,6 +725,11 @@ void FEStorage::deleteSolutionData() {
   vecDDU.clear();
   vecR.clear();
   vecF.clear();
+
+  elementColors.clear();
+  colorBatches.clear();
+  elementSlots.clear();
+  elementCache.clear();
 }
 
 
@@ -353,6 +758,10 @@ void FEStorage::initDofs() {
     mpcCollections[i]->registerMpcsInStorage();
   }
 
+  // all DoFs are registered, now Dof objects can be created
+  nodeDofs.buildDofTable();
+  elementDofs.buildDofTable();
+
   // Total number of dofs (only registered by elements)
 	_nDofs = elementDofs.getNumberOfUsedDofs() + nodeDofs.getNumberOfUsedDofs();
   CHECK(_nDofs);
@@ -380,46 +789,66 @@ void FEStorage::initDofs() {
 
 
 void FEStorage::assignEquationNumbers() {
+  TIMED_SCOPE(t, "assignEquationNumbers");
   // _nUnknownDofs - number of Dof need to be found on every step
 	_nUnknownDofs = nDofs() - nConstrainedDofs();
   CHECK(_nUnknownDofs);
 
+  // topology is needed to compute the ordering (and later in initSolutionData())
+  learnTopology();
+
 	uint32 next_eq_solve = nConstrainedDofs() + 1;
 	uint32 next_eq_const = 1;
 
-  // TODO: we can try to do numbering in more efficient way if will loop over element nodes  (as it
-  // does in buildK() procedure)
+  // natural numbering: element DoFs first, then node DoFs
   for (uint32 i = 1; i <= nElements(); i++) {
-    for (uint16 it = 0; it < Dof::numberOfDofTypes; it++) {
-      Dof::dofType t = static_cast<Dof::dofType> (it);
-      Dof* d = elementDofs.getDof(i, t);
-      if (d) {
-        if (d->isConstrained) {
-          d->eqNumber = next_eq_const++;
-        } else {
-          d->eqNumber = next_eq_solve++;
-        }
-      }
-    }
+    assignEntityEquationNumbers(elementDofs, i, next_eq_const, next_eq_solve);
   }
-
   for (uint32 i = 1; i <= nNodes(); i++) {
-    for (uint16 it = 0; it < Dof::numberOfDofTypes; it++) {
-      Dof::dofType t = static_cast<Dof::dofType> (it);
-      Dof* d = nodeDofs.getDof(i, t);
-      if (d) {
-        if (d->isConstrained) {
-          d->eqNumber = next_eq_const++;
-        } else {
-          d->eqNumber = next_eq_solve++;
-        }
-      }
-    }
+    assignEntityEquationNumbers(nodeDofs, i, next_eq_const, next_eq_solve);
   }
 
   assert(next_eq_const - 1 == nConstrainedDofs());
   assert(next_eq_solve - 1 == nDofs());
 
+  if (ordering != NATURAL_ORDERING) {
+    uint32 bandwidth;
+    uint64 profile;
+    getEquationsProfile(bandwidth, profile);
+    LOG(INFO) << "Natural equations ordering: bandwidth = " << bandwidth << ", profile = "
+      << profile;
+
+    std::vector<uint32> order;
+    getNodesOrder(order);
+
+    // Element DoFs are numbered just before the first node of the element. Elimination of such
+    // DoFs doesn't introduce any fill-in as the element nodes are already coupled with each other.
+    next_eq_solve = nConstrainedDofs() + 1;
+    next_eq_const = 1;
+    std::vector<bool> elementNumbered(nElements(), false);
+    for (auto nn : order) {
+      for (auto en : topology[nn - 1]) {
+        if (elementNumbered[en - 1]) continue;
+        assignEntityEquationNumbers(elementDofs, en, next_eq_const, next_eq_solve);
+        elementNumbered[en - 1] = true;
+      }
+      assignEntityEquationNumbers(nodeDofs, nn, next_eq_const, next_eq_solve);
+    }
+    for (uint32 en = 1; en <= nElements(); en++) {
+      if (!elementNumbered[en - 1]) {
+        assignEntityEquationNumbers(elementDofs, en, next_eq_const, next_eq_solve);
+      }
+    }
+
+    assert(next_eq_const - 1 == nConstrainedDofs());
+    assert(next_eq_solve - 1 == nDofs());
+
+    getEquationsProfile(bandwidth, profile);
+    static const char* orderingNames[] = {"Natural", "RCM", "AMD", "Nested dissection"};
+    LOG(INFO) << orderingNames[ordering] << " equations ordering: bandwidth = " << bandwidth
+      << ", profile = " << profile;
+  }
+
   for (auto& mpc : mpcs) {
     assert(mpc->eq.size());
     mpc->eqNum = next_eq_solve++;
@@ -431,11 +860,231 @@ void FEStorage::assignEquationNumbers() {
       <<  nMpc() << ", TOTAL eq. = " << nUnknownDofs() + nMpc();
 }
 
+
+void FEStorage::assignEntityEquationNumbers(DofCollection& dofs, uint32 entity,
+                                            uint32& nextConstrained, uint32& nextUnknown) {
+  for (uint16 it = 0; it < Dof::numberOfDofTypes; it++) {
+    Dof::dofType t = static_cast<Dof::dofType> (it);
+    Dof* d = dofs.getDof(entity, t);
+    if (d) {
+      if (d->isConstrained) {
+        d->eqNumber = nextConstrained++;
+      } else {
+        d->eqNumber = nextUnknown++;
+      }
+    }
+  }
+}
+
+
+void FEStorage::getNodesOrder(std::vector<uint32>& order) {
+  TIMED_SCOPE(t, "getNodesOrder");
+  // graph of nodes with at least one unknown DoF
+  std::vector<int32> vertex(nNodes(), -1);
+  std::vector<uint32> vertexNode;
+  for (uint32 nn = 1; nn <= nNodes(); nn++) {
+    auto nn_dofs = nodeDofs.getEntityDofs(nn);
+    for (auto d = nn_dofs.first; d != nn_dofs.second; d++) {
+      if (!d->isConstrained) {
+        vertex[nn - 1] = static_cast<int32>(vertexNode.size());
+        vertexNode.push_back(nn);
+        break;
+      }
+    }
+  }
+
+  uint32 nv = static_cast<uint32>(vertexNode.size());
+  std::vector<uint32> xadj(nv + 1, 0);
+  std::vector<uint32> adj;
+  std::vector<uint32> marker(nNodes(), 0);
+  for (uint32 v = 0; v < nv; v++) {
+    uint32 nn = vertexNode[v];
+    marker[nn - 1] = v + 1;
+    for (auto en : topology[nn - 1]) {
+      Element& el = getElement(en);
+      for (uint16 enn = 0; enn < el.getNNodes(); enn++) {
+        uint32 nn2 = el.getNodeNumber(enn);
+        if (vertex[nn2 - 1] < 0 || marker[nn2 - 1] == v + 1) continue;
+        marker[nn2 - 1] = v + 1;
+        adj.push_back(vertex[nn2 - 1]);
+      }
+    }
+    xadj[v + 1] = static_cast<uint32>(adj.size());
+  }
+
+  std::vector<uint32> perm;
+  switch (ordering) {
+    case RCM_ORDERING:
+      math::reverseCuthillMcKee(xadj, adj, perm);
+      break;
+    case AMD_ORDERING:
+      math::approximateMinimumDegree(xadj, adj, perm);
+      break;
+    case NESTED_DISSECTION_ORDERING:
+      math::nestedDissection(xadj, adj, perm);
+      break;
+    default:
+      for (uint32 v = 0; v < nv; v++) {
+        perm.push_back(v);
+      }
+  }
+
+  order.clear();
+  order.reserve(nNodes());
+  for (auto v : perm) {
+    order.push_back(vertexNode[v]);
+  }
+  // nodes without unknown DoFs go last
+  for (uint32 nn = 1; nn <= nNodes(); nn++) {
+    if (vertex[nn - 1] < 0) {
+      order.push_back(nn);
+    }
+  }
+}
+
+
+void FEStorage::getEquationsProfile(uint32& bandwidth, uint64& profile) {
+  // for every unknown equation find the minimal equation number coupled with it. Equations of an
+  // element (its node DoFs and element DoFs) are coupled with each other.
+  uint32 first = nConstrainedDofs() + 1;
+  std::vector<uint32> rowMin(nUnknownDofs());
+  for (uint32 eq = 0; eq < nUnknownDofs(); eq++) {
+    rowMin[eq] = eq + first;
+  }
+  std::vector<uint32> eqs;
+  for (uint32 en = 1; en <= nElements(); en++) {
+    eqs.clear();
+    auto en_dofs = elementDofs.getEntityDofs(en);
+    for (auto d = en_dofs.first; d != en_dofs.second; d++) {
+      if (!d->isConstrained) eqs.push_back(d->eqNumber);
+    }
+    Element& el = getElement(en);
+    for (uint16 enn = 0; enn < el.getNNodes(); enn++) {
+      auto nn_dofs = nodeDofs.getEntityDofs(el.getNodeNumber(enn));
+      for (auto d = nn_dofs.first; d != nn_dofs.second; d++) {
+        if (!d->isConstrained) eqs.push_back(d->eqNumber);
+      }
+    }
+    if (eqs.size() == 0) continue;
+    uint32 minEq = *std::min_element(eqs.begin(), eqs.end());
+    for (auto eq : eqs) {
+      rowMin[eq - first] = std::min(rowMin[eq - first], minEq);
+    }
+  }
+  bandwidth = 0;
+  profile = 0;
+  for (uint32 eq = 0; eq < nUnknownDofs(); eq++) {
+    uint32 width = eq + first - rowMin[eq];
+    bandwidth = std::max(bandwidth, width);
+    profile += width;
+  }
+}
+
+
+bool FEStorage::getEquationGroups(std::vector<uint32>& groups) {
+  groups.clear();
+  if (!useBlockStorage) {
+    return false;
+  }
+
+  uint32 nEq = nDofs() + nMpc();
+  std::vector<bool> first(nEq + 1, false);
+  // DoFs of an entity are numbered one after another in constrained and unknown ranges (see
+  // assignEntityEquationNumbers()), every run is split into groups of up to maxBlockSize
+  typedef std::vector<Dof>::iterator DofIt;
+  auto markEntity = [&first] (std::pair<DofIt, DofIt> dofs) {
+    for (bool constrained : {true, false}) {
+      uint16 n = 0;
+      for (auto d = dofs.first; d != dofs.second; d++) {
+        if (d->isConstrained != constrained) continue;
+        if (n % SparsityInfo::maxBlockSize == 0) first[d->eqNumber] = true;
+        n++;
+      }
+    }
+  };
+  for (uint32 nn = 1; nn <= nNodes(); nn++) {
+    markEntity(nodeDofs.getEntityDofs(nn));
+  }
+  for (uint32 en = 1; en <= nElements(); en++) {
+    markEntity(elementDofs.getEntityDofs(en));
+  }
+  for (uint32 eq = nDofs() + 1; eq <= nEq; eq++) {
+    first[eq] = true;
+  }
+
+  for (uint32 eq = 1; eq <= nEq; eq++) {
+    if (first[eq]) groups.push_back(eq);
+  }
+  // blocks of 1x1 only waste memory on block rows pointers
+  if (groups.size() * 3 > nEq * 2) {
+    groups.clear();
+    return false;
+  }
+  groups.push_back(nEq + 1);
+  return true;
+}
+
+
+template <typename Func>
+void FEStorage::forEachMatrixEntry(Func entry) {
+  // mark[nn2-1] == nn means that node nn2 dofs are already registered against node nn dofs
+  std::vector<uint32> mark(nNodes(), 0);
+
+  for (uint32 nn = 1; nn <= nNodes(); nn++) {
+    auto nn_dofs = nodeDofs.getEntityDofs(nn);
+
+    for (auto& en : topology[nn-1]) {
+      // register element dofs to node nn
+      auto en_dofs = elementDofs.getEntityDofs(en);
+      for (auto d1 = en_dofs.first; d1 != en_dofs.second; d1++)
+        for (auto d2 = nn_dofs.first; d2 != nn_dofs.second; d2++)
+          entry(d1->eqNumber, d2->eqNumber);
+
+      // cycle over element en Nodes and register nn vs nn2 nodes dofs
+      for (uint16 enn = 0; enn < getElement(en).getNNodes(); enn++) {
+        uint32 nn2 = getElement(en).getNodeNumber(enn);
+        if (nn2 < nn || mark[nn2-1] == nn) continue;
+        mark[nn2-1] = nn;
+        // register node nn2 dofs to node nn dofs (only upper triangle of the node's own block)
+        auto nn2_dofs = nodeDofs.getEntityDofs(nn2);
+        for (auto d1 = nn2_dofs.first; d1 != nn2_dofs.second; d1++)
+          for (auto d2 = nn_dofs.first; d2 != nn_dofs.second; d2++)
+            if (nn2 != nn || d1->eqNumber <= d2->eqNumber)
+              entry(d1->eqNumber, d2->eqNumber);
+      }
+    }
+  }
+
+  // register element dofs vs element dofs
+  for (uint32 en = 1; en <= nElements(); en++) {
+    auto en_dofs = elementDofs.getEntityDofs(en);
+    for (auto d1 = en_dofs.first; d1 != en_dofs.second; d1++)
+      for (auto d2 = d1; d2 != en_dofs.second; d2++)
+        entry(d1->eqNumber, d2->eqNumber);
+  }
+
+  // register MPC coefficients
+  for (auto& mpc : mpcs) {
+    assert(mpc->eq.size());
+    assert(mpc->eqNum > nConstrainedDofs() + nUnknownDofs());
+    assert(mpc->eqNum <= nConstrainedDofs() + nUnknownDofs() + nMpc());
+    for (auto& term : mpc->eq) {
+      uint32 eq_j = getNodeDofEqNumber(term.node, term.node_dof);
+      assert(eq_j > 0 && eq_j <= nConstrainedDofs() + nUnknownDofs());
+      entry(mpc->eqNum, eq_j);
+    }
+  }
+}
+
+
 void FEStorage::initSolutionData () {
   TIMED_SCOPE(t, "initSolutionData");
   
   // We need to know topology of the mesh in order to determine SparsityInfo for sparse matrices
-  learnTopology();
+  // NOTE: topology is learned in assignEquationNumbers()
+  if (topology.size() != nNodes()) {
+    learnTopology();
+  }
 
 
   // In nla3d solution procedure there are 3 distinguish types of unknowns. First one "c" -
@@ -470,7 +1119,19 @@ void FEStorage::initSolutionData () {
   //  | Rc | =-| Fc | + | Kcc | * | Uc | + |KcsMPCc| * |    |
   //  |    |   |    |   |     |   |    |   |       |   | Ul |
 
-  matK = new BlockSparseSymMatrix<2>({nConstrainedDofs(), nUnknownDofs() + nMpc()});
+  matK = new BlockSparseSymMatrix<2>({nConstrainedDofs(), nUnknownDofs() + nMpc()}, 0);
+  // groupFirst[eq] is true if equation eq opens a group of block storage
+  std::vector<bool> groupFirst(nDofs() + nMpc() + 1, true);
+  std::vector<uint32> groups;
+  if (getEquationGroups(groups)) {
+    matK->setBlockPartition(groups);
+    std::fill(groupFirst.begin(), groupFirst.end(), false);
+    for (auto eq : groups) {
+      if (eq < groupFirst.size()) groupFirst[eq] = true;
+    }
+    LOG(INFO) << "Global matrices use block storage (" << groups.size() - 1 << " groups of "
+      << nDofs() + nMpc() << " equations)";
+  }
 
   if (transient) {
     // share sparsity info with K matrices
@@ -498,47 +1159,22 @@ void FEStorage::initSolutionData () {
   // As far as we know from topology which elements are neighbors to each other we can estimate
   // quantity and positions of non-zero coef. in Sparse Matrix matK. Other matrices matC, matK will
   // have the same sparsity as stiffness matrix matK.
-
-  for (uint32 nn = 1; nn <= nNodes(); nn++) {
-    auto nn_dofs = nodeDofs.getEntityDofs(nn);
-
-    for (auto& en : topology[nn-1]) {
-      // register element dofs to node nn
-      auto en_dofs = elementDofs.getEntityDofs(en);
-      for (auto d1 = en_dofs.first; d1 != en_dofs.second; d1++)
-        for (auto d2 = nn_dofs.first; d2 != nn_dofs.second; d2++)
-          addEntryK(d1->eqNumber, d2->eqNumber);
-
-      // cycle over element en Nodes and register nn vs nn2 nodes dofs
-      for (uint16 enn = 0; enn < getElement(en).getNNodes(); enn++) {
-        uint32 nn2 = getElement(en).getNodeNumber(enn);
-        if (nn2 < nn) continue;
-        // register node nn2 dofs to node nn dofs
-        auto nn2_dofs = nodeDofs.getEntityDofs(nn2);
-        for (auto d1 = nn2_dofs.first; d1 != nn2_dofs.second; d1++)
-          for (auto d2 = nn_dofs.first; d2 != nn_dofs.second; d2++)
-            addEntryK(d1->eqNumber, d2->eqNumber);
-      }
-    }
-  }
-
-  // register element dofs vs element dofs
-  for (uint32 en = 1; en <= nElements(); en++) {
-    auto en_dofs = elementDofs.getEntityDofs(en);
-    for (auto d1 = en_dofs.first; d1 != en_dofs.second; d1++)
-      for (auto d2 = en_dofs.first; d2 != en_dofs.second; d2++)
-        addEntryK(d1->eqNumber, d2->eqNumber);
-  }
-
-  // register MPC coefficients
-  for (auto& mpc : mpcs) {
-    assert(mpc->eq.size());
-    uint32 eq_num = mpc->eqNum;
-    for (auto& term : mpc->eq) {
-    uint32 eq_j = getNodeDofEqNumber(term.node, term.node_dof);
-      addEntryMPC(mpc->eqNum, eq_j);
-    }
-  }
+  // The sparsity is built in two passes: at first number of entries in every row are counted, then
+  // exactly needed storage is allocated and filled.
+  // In block storage any entry registers the whole block, so only the first equations of the
+  // groups are passed. MPC terms are passed as is: they can refer to any DoF of a node.
+  auto passed = [this, &groupFirst] (uint32 eqi, uint32 eqj) {
+    return (groupFirst[eqi] && groupFirst[eqj]) || eqi > nDofs() || eqj > nDofs();
+  };
+  forEachMatrixEntry([this, &passed] (uint32 eqi, uint32 eqj) {
+    if (passed(eqi, eqj))
+      matK->countEntry(eqi, eqj);
+  });
+  matK->startFilling();
+  forEachMatrixEntry([this, &passed] (uint32 eqi, uint32 eqj) {
+    if (passed(eqi, eqj))
+      matK->addEntry(eqi, eqj);
+  });
 
   // compress sparsity info. After that we can't add new position in sparse matrices
   matK->compress();
@@ -547,6 +1183,17 @@ void FEStorage::initSolutionData () {
     matC->compress();
     matM->compress();
   }
+  // scatter maps of elements depend on equation numbers and matrices sparsity. They will be
+  // rebuilt on the next assembly.
+  for (auto el : elements) {
+    el->clearScatter();
+  }
+  elementSlots.clear();
+  elementSlots.resize(nElements());
+  clearElementCache();
+
+  groupElementsByType();
+  colorElements();
 }
 
 
@@ -570,20 +1217,136 @@ void FEStorage::printDofInfo(std::ostream& out) {
 
 void FEStorage::updateResults() {
   TIMED_SCOPE(t, "updateSolutionResults");
-  // calculate element's update procedures (calculate stresses, strains, ..)
-  for (uint32 el = 0; el < nElements(); el++) {
-    elements[el]->update();
+  // calculate element's update procedures (calculate stresses, strains, ..) type by type
+  for (auto& bucket : elementBuckets) {
+    BucketUpdater updater{this, bucket.ind};
+    dispatchBucket(bucket, updater);
+  }
+}
+
+
+void FEStorage::saveElementStates() {
+  intPointArena.save(IP_S);
+  savedElementStates.clear();
+  for (auto el : elements) {
+    el->saveState(savedElementStates);
+  }
+}
+
+
+void FEStorage::restoreElementStates() {
+  intPointArena.restore();
+  const double* state = savedElementStates.data();
+  for (auto el : elements) {
+    state = el->restoreState(state);
+  }
+  assert(state == savedElementStates.data() + savedElementStates.size());
+}
+
+
+template <class ET>
+void FEStorage::updateElements(const std::vector<uint32>& ind) {
+  for (auto i : ind) {
+    ElementCalls<ET>::update(elements[i]);
   }
 }
 
 
+namespace {
+// checks that the element is exactly of class ET
+struct ExactClassCheck {
+  Element* el;
+  bool exact;
+
+  template <class ET>
+  void apply() {
+    exact = (typeid(*el) == typeid(ET));
+  }
+};
+} // namespace
+
+
+void FEStorage::groupElementsByType() {
+  elementBuckets.clear();
+  elementBucket.assign(nElements(), 0);
+  for (uint32 i = 0; i < nElements(); i++) {
+    ExactClassCheck check{elements[i], false};
+    dispatchElementType(elements[i]->getType(), check);
+    size_t b = 0;
+    while (b < elementBuckets.size() && (elementBuckets[b].type != elements[i]->getType() ||
+                                         elementBuckets[b].exact != check.exact)) {
+      b++;
+    }
+    if (b == elementBuckets.size()) {
+      elementBuckets.push_back(ElementBucket{elements[i]->getType(), check.exact,
+                                             std::vector<uint32>()});
+    }
+    elementBuckets[b].ind.push_back(i);
+    elementBucket[i] = static_cast<uint16> (b);
+  }
+}
+
+
+void FEStorage::colorElements() {
+  // greedy coloring: an element gets the first color which isn't used by its neighbours (elements
+  // sharing a node with it)
+  const uint32 noColor = 0xFFFFFFFF;
+  std::vector<uint32> color(nElements(), noColor);
+  // colorMark[c] == en means that color c is used by a neighbour of element en
+  std::vector<uint32> colorMark;
+  elementColors.clear();
+  for (uint32 en = 1; en <= nElements(); en++) {
+    for (uint16 nn = 0; nn < getElement(en).getNNodes(); nn++) {
+      uint32 noden = getElement(en).getNodeNumber(nn);
+      for (auto en2 : topology[noden - 1]) {
+        if (color[en2 - 1] != noColor) {
+          colorMark[color[en2 - 1]] = en;
+        }
+      }
+    }
+    uint32 c = 0;
+    while (c < colorMark.size() && colorMark[c] == en) c++;
+    if (c == colorMark.size()) {
+      colorMark.push_back(0);
+      elementColors.push_back(std::vector<uint32>());
+    }
+    color[en - 1] = c;
+    elementColors[c].push_back(en - 1);
+  }
+
+  // Elements of the same bucket inside of a color are grouped into batches of up to BATCH_LANES
+  // elements for batched element kernels (see Element::computeKBatch()). colorBatches[c] keeps
+  // positions in elementColors[c] where batches start (and the size of the color at the end).
+  colorBatches.assign(elementColors.size(), std::vector<uint32>());
+  for (size_t c = 0; c < elementColors.size(); c++) {
+    std::vector<uint32>& els = elementColors[c];
+    std::stable_sort(els.begin(), els.end(), [this](uint32 a, uint32 b) {
+        return elementBucket[a] < elementBucket[b];
+    });
+    for (uint32 i = 0; i < els.size(); i++) {
+      if (i == 0 || i - colorBatches[c].back() == BATCH_LANES ||
+          elementBucket[els[i]] != elementBucket[els[i - 1]]) {
+        colorBatches[c].push_back(i);
+      }
+    }
+    colorBatches[c].push_back(static_cast<uint32> (els.size()));
+  }
+
+  uint16 nThreads = 1;
+#ifdef _OPENMP
+  nThreads = static_cast<uint16> (omp_get_max_threads());
+#endif
+  LOG(INFO) << "Elements are divided into " << elementColors.size() << " colors for assembly ("
+    << nThreads << " threads)";
+}
+
+
 void FEStorage::learnTopology() {
   topology.clear();
   topology.assign(nNodes(), std::set<uint32>());
   for (uint32 en = 1; en <= nElements(); en++) {
-    for (uint16 nn = 0; nn < getElement(en).getNNodes(); nn++) {
-      uint32 noden = getElement(en).getNodeNumber(nn);
-      topology[noden-1].insert(getElement(en).getElNum());
+    for (uint32 i = elementNodesPtr[en - 1]; i < elementNodesPtr[en]; i++) {
+      topology[elementNodes[i] - 1].insert(en);
     }
   }
 }
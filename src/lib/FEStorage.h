@@ -10,11 +10,13 @@
 #include "math/BlockSparseMatrix.h"
 #include "FEComponent.h"
 #include "Mpc.h"
+#include "IntPointArena.h"
+#include "Node.h"
  
 namespace nla3d {
 
 class Element;
-class Node;
+struct ElementMatrices;
 class Dof;
 class ElementFactory;
 
@@ -67,6 +69,26 @@ public:
   void addValueM(uint32 nodei, Dof::dofType dofi, uint32 nodej, Dof::dofType dofj, double value);
   void addValueM(uint32 eqi, uint32 eqj, double value);
 
+  // The fast way to add values to the same entries of K, C, M matrices over and over again.
+  // getMatrixSlot(eqi, eqj) finds once the position of the entry (eqi, eqj) in global matrices (the
+  // same for K, C and M as they share sparsity info), then addValue[K/C/M]BySlot(..) adds a value
+  // without any search.
+  // NOTE: slots are valid until initSolutionData() is called again
+  uint32 getMatrixSlot(uint32 eqi, uint32 eqj);
+  void addValueKBySlot(uint32 slot, double value);
+  void addValueCBySlot(uint32 slot, double value);
+  void addValueMBySlot(uint32 slot, double value);
+
+  // Add local matrices of element `el` into global ones. `n` - number of element's local DoFs, `eq`
+  // - their global equation numbers, `Ke` (`Ce`, `Me`) - upper triangle of the local matrix in
+  // MatSym order (n * (n + 1) / 2 values), `Fe` - local rhs (n values).
+  // Slots of local entries in global matrices (the element's scatter map) are found on the first
+  // call and reused later on. NOTE: `eq` should be the same from call to call for the element.
+  void scatterElementK(uint32 el, uint16 n, const uint32* eq, const double* Ke);
+  void scatterElementC(uint32 el, uint16 n, const uint32* eq, const double* Ce);
+  void scatterElementM(uint32 el, uint16 n, const uint32* eq, const double* Me);
+  void scatterElementF(uint32 el, uint16 n, const uint32* eq, const double* Fe);
+
   // Add value to a matrix of MPC coefficients for DoFs.
   // NOTE: MPC equations can work only with vecU values, excluding derivatives values
   // vecDU, vecDDU.
@@ -112,7 +134,17 @@ public:
 
   // Procedure of filling global equations system matrices and RHS vectors with actual values.
   // if isTransient() == bool then matC, matM are also assembled.
+  // NOTE: when nla3d is compiled with OpenMP (nla3d_multithreaded) elements are assembled in
+  // parallel (see elementColors), Element::build[K/C/M]() should be thread safe.
   void assembleGlobalEqMatrices();
+  // Assemble only vecF (internal element loads and rhs of Mpc equations) for current DoF values.
+  // Global matrices are left untouched, so the solver can keep using the matrix factorized
+  // earlier (see NonlinearFESolver::iterationMethod). Element loads are computed by
+  // Element::computeF(), so elements which provide it skip the stiffness computations.
+  void assembleResidual();
+  // number of assembleGlobalEqMatrices() and assembleResidual() calls
+  uint32 getNumberOfAssemblies();
+  uint32 getNumberOfResidualAssemblies();
 
   // getters to get numbers of different entities stored in FEStorage
 	uint32 nNodes();
@@ -121,12 +153,43 @@ public:
 	uint32 nUnknownDofs();
 	uint32 nConstrainedDofs();
 	uint32 nMpc();
+	uint32 nMpcCollections();
 
   // if isTransient() == bool then FEStorage initialize matC, matM, vecDU, vecDDU along with matK,
   // vecU. 
   void setTransient(bool _transient);
   bool isTransient();
 
+  // Ordering of the equations applied by assignEquationNumbers(). The ordering is computed for the
+  // graph of nodes (two nodes are adjacent if they share an element) and reduces fill-in for
+  // direct equation solvers (AMD, NESTED_DISSECTION) or bandwidth and profile (RCM). The natural
+  // ordering (element DoFs first, then node DoFs) is used by default.
+  enum EquationOrdering {
+    NATURAL_ORDERING,
+    RCM_ORDERING,
+    AMD_ORDERING,
+    NESTED_DISSECTION_ORDERING
+  };
+  void setEquationOrdering(EquationOrdering _ordering);
+  EquationOrdering getEquationOrdering();
+
+  // Global matrices could be kept in block storage (see math::SparsityInfo::setBlockPartition())
+  // where constrained and unknown DoFs of every node and element form groups of up to 3 equations,
+  // every MPC equation is a group of its own. Block storage is off by default: it doesn't provide
+  // scalar CSR arrays (BaseSparseMatrix::getColumnsArray(), getIofeirArray()), and equation solvers
+  // which need them (SparseLDLTEquationSolver, PARDISO, SSOR, IC(0) and AMG preconditioners of
+  // PCGEquationSolver) build a temporary scalar copy of the index arrays (math::CsrIndexArrays).
+  // If it's switched on here, initSolutionData() uses it when the groups are big enough.
+  void setBlockStorage(bool _useBlockStorage);
+
+  // Local stiffness matrices and rhs of linear elements (see Element::isLinear()) are computed on
+  // the first assembly after initSolutionData() and kept in FEStorage. Next assemblies add the
+  // cached values into global matrices without calling the element. The cache takes as much memory
+  // as the local matrices themselves, it could be switched off here. clearElementCache() should be
+  // called if properties of linear elements were changed between assemblies.
+  void setElementCache(bool _useElementCache);
+  void clearElementCache();
+
   // Operations with DoFs
   //
   // Registation of DoFs is a key moment in nla3d. Every element (and other entities like MPC
@@ -134,6 +197,9 @@ public:
   // For example: addNodeDof(32, Dof::UX) means that DoF UX for node 32 will be used in a global system of
   // equations. Unregistered DoFs will not participate in global equations system. This mechanism
   // leads to ability to have different DoFs in different nodes. 
+  // NOTE: DoFs should be registered in Element::pre() and MpcCollection::pre() (called by
+  // initDofs()). Dof objects are created at once after all of them are registered, new DoFs can't
+  // be added after initDofs().
   // NOTE: `node` > 0
   void addNodeDof(uint32 node, std::initializer_list<Dof::dofType> _dofs);
   // NOTE: `element` > 0
@@ -174,6 +240,8 @@ public:
 	Node& getNode(uint32 _nn);
   // function fills node_ptr with pointers to Node classes for element el.
   // Calling side should reserve a space for an array of pointers node_ptr.
+  // NOTE: the pointers (as well as references returned by getNode()) are valid until new nodes are
+  // added into FEStorage
   // size of node_ptr should be at least Element::getNNodes()
   // NOTE: `el` > 0
 	void getElementNodes(uint32 el, Node** node_ptr);
@@ -182,10 +250,19 @@ public:
   // A calling side should take care about memory allocation for ptr. Size of ptr should be at least
   // 3 as the function always return 3-dimensional coordinates.
 	void getNodePosition(uint32 n, double* ptr, bool deformed = false);
+  // The function fills six rigid body modes (3 translations and 3 rotations) for the unknown
+  // equations (nConstrainedDofs() < eq <= nConstrainedDofs() + nUnknownDofs() + nMpc()) built from
+  // initial node positions and UX, UY, UZ (ROTX, ROTY, ROTZ) DoFs. `modes` are stored mode by mode.
+  // `eqNodes` gets node number for every equation (0 for element DoFs and Mpc equations). This is
+  // near null space for algebraic multigrid solvers (see EquationSolver::setNearNullSpace).
+  void getRigidBodyModes(std::vector<double>& modes, std::vector<uint32>& eqNodes);
   // NOTE: `_en` > 0
 	Element& getElement(uint32 _en);
   template<typename ET>
   ET& getElement(uint32 _en);
+  // Integration point data of elements (NiXj, det, S, ..) are kept in the arena, elements refer to
+  // it by IntPointArray views. The arena is freed along with elements.
+  IntPointArena& getIntPointArena();
   // get a FEComponent instance by registration number
   // NOTE: `i` > -1
   FEComponent* getFEComponent(size_t i);
@@ -200,20 +277,19 @@ public:
 	void addMpcCollection(MpcCollection* mpcCol);
   // Add `comp` to `feComponents` array. FEStorage will delete FEComponent instances by itslef.
   void addFEComponent(FEComponent* comp);
-  // The function add a node to the nodes table.
-  // TODO: this is inefficient functions because we can't ensure memory localization for all nodes
-  // instanses in `nodes` array
+  // The function add a node to the nodes table. The node is copied into `nodes` array and `node`
+  // instance is deleted.
   void addNode(Node* node);
-  // The function creates an vector `nodes` with dynamically allocated Node instances inside.
-  // Numbers of newly created elements pass back to the caller.  
+  // The function adds `nn` nodes at the end of `nodes` array.
+  // Numbers of newly created nodes pass back to the caller.  
   // NOTE: nodes will be created with default Node() constructor (node coordinates 0, 0, 0). 
   // NOTE: new nodes are concantenated to old nodes which already were in FEStorage 
 	std::vector<uint32> createNodes(uint32 nn); 
-  // add an element to the element array `elements`.
-  // TODO: this is inefficient functions because we can't ensure memory localization for all
-  // elements instances in `elements` array
+  // add an element to the element array `elements`. FEStorage takes ownership of the element, node
+  // numbers of the element are moved into the connectivity array `elementNodes`.
+  // NOTE: prefer createElements(..) which places elements in one contiguous block
   void addElement(Element* el);
-  // The function creates a vector with dynamically allocated Element instances inside.  Particular
+  // The function creates `en` elements in one contiguous block (see ElementBlock). Particular
   // realization of abstract Element class is chosen from elType variable by mean of ElementFactory
   // class (see elements/ElemenetFactory.h). Numbers of newly created elements pass back to the
   // caller. 
@@ -231,11 +307,10 @@ public:
   // delete all FE model things: elements, nodes, MPCs, MPC Collections, FE components, topology
   // info.
 	void deleteMesh();
-  // delete nodes table: delete all dynamically allocated Node instances,
-  // and clear vector of pointers `nodes`.
+  // delete nodes table: clear `nodes` array.
   void deleteNodes();
-  // delete elements table: delete all dynamically allocated Element instances,
-  // and clear vector of pointers `elements`.
+  // delete elements table: delete all element blocks, clear vector of pointers `elements` and
+  // the connectivity array.
   void deleteElements();
   // delete MPC list: delete all dynamically allocated Mpc instances,
   // and clear vector of pointers `mpcs`.
@@ -261,7 +336,8 @@ public:
   // DoFs to be constrained (fixed).
   // 3. Assign number for globals system equations by calling assignEquationNumbers();
   void assignEquationNumbers();
-  // 4. Allocate all solution data structures: matK/C/M, vecU/DU/DDU/F/R
+  // 4. Allocate all solution data structures: matK/C/M, vecU/DU/DDU/F/R, color elements for
+  // parallel assembly
 	void initSolutionData();
 
   // After global equations system is solved and vecU/DU/DDU/R is updated with appropriate values
@@ -269,15 +345,86 @@ public:
   // NOTE: actually Element::update() is called
 	void updateResults();
 
+  // Save solution state of elements (stresses, strains and other values of integration points kept
+  // in IntPointArena which depend on DoF values, and the state saved by Element::saveState()) in
+  // order to roll it back by restoreElementStates() if the solution of the next step fails.
+  void saveElementStates();
+  void restoreElementStates();
+
 private:
+  // extend `elementNodes` by node numbers of elements [firstEl; nElements()) (indexes in `elements`)
+  // and point Element::nodes into it. Node numbers already set in elements which own them are
+  // moved into the array.
+  void bindElementNodes(uint32 firstEl);
   // fill `topology` data based on the current mesh (Element::nodes numbers)
   void learnTopology();
-
-  // these functions are used to train sparsity info for matK/C/M
-  // provide info that entry (eqi, eqj) are not zero
-  // should be called before matK->compressed()
-  void addEntryK(uint32 eqi, uint32 eqj);
-  void addEntryMPC(uint32 eq_num, uint32 eqj);
+  // numbers of nodes in the order defined by `ordering`
+  void getNodesOrder(std::vector<uint32>& order);
+  // assign equation numbers to DoFs of `entity` in `dofs` collection
+  void assignEntityEquationNumbers(DofCollection& dofs, uint32 entity, uint32& nextConstrained,
+                                   uint32& nextUnknown);
+  // bandwidth and profile of unknown DoFs equations (MPC equations are not considered)
+  void getEquationsProfile(uint32& bandwidth, uint64& profile);
+
+  // Elements of one type. If `exact` is true all elements of the bucket are exactly of the class
+  // created by ElementFactory for `type`, otherwise (user classes derived from element classes)
+  // element methods are called virtually.
+  struct ElementBucket {
+    ElementType type;
+    bool exact;
+    // indexes in `elements` array in ascending order
+    std::vector<uint32> ind;
+  };
+
+  // split elements into `elementBuckets` (see initSolutionData())
+  void groupElementsByType();
+  // call `f.template apply<ET>()` where ET is the exact class of elements of `bucket` or Element if
+  // the class isn't known (see ElementCalls)
+  template <class Func>
+  void dispatchBucket(const ElementBucket& bucket, Func& f);
+  // split elements into `elementColors` (see initSolutionData())
+  void colorElements();
+  // compute local matrices of element elements[ind] of class ET by Element::computeK() and scatter
+  // them into global ones. `em` is a working buffer. If the element doesn't provide the kernel,
+  // Element::buildK() is called.
+  template <class ET>
+  void assembleElementK(uint32 ind, ElementMatrices& em);
+  // assemble elements elements[ind[0]] .. elements[ind[n-1]] of class ET by the batched element
+  // kernel (see Element::computeKBatch()) or one by one if the kernel isn't provided. `em` -
+  // working buffers (at least n).
+  template <class ET>
+  void assembleElementBatch(const uint32* ind, uint16 n, ElementMatrices* em);
+  // the same as assembleElementK() and assembleElementBatch() but only local rhs are computed by
+  // Element::computeF() (Element::computeFBatch()) and scattered into vecF (see
+  // assembleResidual())
+  template <class ET>
+  void assembleElementF(uint32 ind, ElementMatrices& em);
+  template <class ET>
+  void assembleElementFBatch(const uint32* ind, uint16 n, ElementMatrices* em);
+  // call Element::update() for elements of class ET
+  template <class ET>
+  void updateElements(const std::vector<uint32>& ind);
+  // functors for dispatchBucket() (see FEStorage.cpp)
+  struct BatchAssembler;
+  struct ResidualAssembler;
+  struct BucketUpdater;
+  // scatter local matrices of element `el` computed by an element kernel into global ones
+  void scatterElementMatrices(uint32 el, ElementMatrices& em);
+  // get the scatter map of element `el` (build it if needed), see scatterElementK()
+  const std::vector<uint32>& getElementSlots(uint32 el, uint16 n, const uint32* eq);
+  // add cached local matrices of element elements[ind] into global ones (see setElementCache())
+  void replayElementK(uint32 ind);
+  void replayElementF(uint32 ind);
+
+  // first equation of every group of the block storage followed by nDofs() + nMpc() + 1. Returns
+  // false if block storage isn't used (see setBlockStorage())
+  bool getEquationGroups(std::vector<uint32>& groups);
+
+  // call `entry(eqi, eqj)` for every non-zero entry of matK/C/M based on mesh topology, registered
+  // Dofs and MPCs. Every pair of connected nodes is visited once, the function is used twice for
+  // exact two-pass sparsity construction (see BlockSparseSymMatrix::countEntry)
+  template <typename Func>
+  void forEachMatrixEntry(Func entry);
 
   // Total number of DoFs (registered by FEStorage::add[Node/Element]Dof(..))
 	uint32 _nDofs = 0;
@@ -292,10 +439,20 @@ private:
   // in [1; nElements()].
   // NOTE: Elements are deleted by deleteElements() function.
 	std::vector<Element*> elements;
+  // Owners of elements: every createElements(..) call adds a block with all created elements placed
+  // one after another, addElement(..) adds a block of one element.
+  std::vector<std::unique_ptr<ElementBlock> > elementBlocks;
+  // Connectivity of elements in CSR-like layout: node numbers of element elements[i] are
+  // elementNodes[elementNodesPtr[i]] .. elementNodes[elementNodesPtr[i+1] - 1]. Element::nodes
+  // points into the array (see bindElementNodes()).
+  std::vector<uint32> elementNodes;
+  std::vector<uint32> elementNodesPtr;
 
   // Array of nodes. Nodes are created by FEStorage::createNodes(..). Nodes are created with default
   // coordinates (0,0,0). Nodes have consecutive numbering. They have numbers in [1; nNodes()]. 
-	std::vector<Node*> nodes;
+  // Node instances are stored by value, so node coordinates are kept in one packed x, y, z array
+  // and geometry computations of elements don't chase a pointer per node.
+	std::vector<Node> nodes;
 
   // List of MPC equations. List is populated by FEStorage::addMpc(..). An instance of Mpc class is
   // created outside of FEStorage class. But after addMpc(..) function FEStorage takes control on
@@ -372,9 +529,57 @@ private:
   // topology[n-1] = [el1, el2, el3..]
   std::vector<std::set<uint32> > topology;
 
+  // Elements grouped by types: loops over a bucket call element methods without virtual dispatch
+  // (see dispatchBucket()). Buckets are built in initSolutionData(), element numbers aren't
+  // changed.
+  std::vector<ElementBucket> elementBuckets;
+  // elementBucket[i] - index in `elementBuckets` of elements[i]
+  std::vector<uint16> elementBucket;
+
+  // Elements grouped by colors: elements of the same color don't share any node, so they can be
+  // assembled in parallel. elementColors[c] stores indexes in `elements` array. Colors are built in
+  // initSolutionData().
+  std::vector<std::vector<uint32> > elementColors;
+  // Batches of elements of the same bucket inside of colors, see colorElements()
+  std::vector<std::vector<uint32> > colorBatches;
+
+  // Scatter maps of elements: elementSlots[el-1] keeps slots (see getMatrixSlot()) of upper
+  // triangle entries of the element's local matrix. Maps are built on the first assembly after
+  // initSolutionData().
+  std::vector<std::vector<uint32> > elementSlots;
+
+  // Cached local matrices of a linear element (see setElementCache()). Ke is in MatSym order as
+  // the element's scatter map, Fe values are added to equations eqF. `recording` is true while the
+  // element is assembled for the first time, the cache is used when `ready` is true.
+  struct ElementCache {
+    bool recording = false;
+    bool ready = false;
+    std::vector<double> Ke;
+    std::vector<uint32> eqF;
+    std::vector<double> Fe;
+  };
+  // elementCache[el-1] - cache of element `el`, empty for nonlinear elements
+  std::vector<ElementCache> elementCache;
+
   // if transient is true that means that assembleGlobalEqMatrices() should assemble M and C
   // matrices too
   bool transient = false;
+
+  EquationOrdering ordering = NATURAL_ORDERING;
+
+  bool useBlockStorage = false;
+
+  bool useElementCache = true;
+
+  // true while assembleResidual() is running, scatterElementK() does nothing then (for elements
+  // which have only Element::buildK())
+  bool assemblingResidual = false;
+  uint32 numberOfAssemblies = 0;
+  uint32 numberOfResidualAssemblies = 0;
+
+  IntPointArena intPointArena;
+  // element states saved by saveElementStates() outside of intPointArena, in the order of elements
+  std::vector<double> savedElementStates;
 };
 
 
@@ -420,6 +625,27 @@ inline void FEStorage::addValueM(uint32 eqi, uint32 eqj, double value) {
 }
 
 
+inline uint32 FEStorage::getMatrixSlot(uint32 eqi, uint32 eqj) {
+  assert(matK);
+  return matK->getSlot(eqi, eqj);
+}
+
+
+inline void FEStorage::addValueKBySlot(uint32 slot, double value) {
+  matK->addValueBySlot(slot, value);
+}
+
+
+inline void FEStorage::addValueCBySlot(uint32 slot, double value) {
+  matC->addValueBySlot(slot, value);
+}
+
+
+inline void FEStorage::addValueMBySlot(uint32 slot, double value) {
+  matM->addValueBySlot(slot, value);
+}
+
+
 inline void FEStorage::addValueMPC(uint32 eq_num, uint32 nodej, Dof::dofType dofj, double coef) {
 	uint32 colEq = getNodeDofEqNumber(nodej, dofj);
   addValueMPC(eq_num, colEq, coef);
@@ -548,6 +774,19 @@ inline uint32 FEStorage::nMpc() {
 }
 
 
+inline uint32 FEStorage::nMpcCollections() {
+  return static_cast<uint32> (mpcCollections.size());
+}
+
+
+inline uint32 FEStorage::getNumberOfAssemblies() {
+  return numberOfAssemblies;
+}
+
+inline uint32 FEStorage::getNumberOfResidualAssemblies() {
+  return numberOfResidualAssemblies;
+}
+
 inline uint32 FEStorage::nNodes () {
   return static_cast<uint32> (nodes.size());
 }
@@ -566,6 +805,27 @@ inline bool FEStorage::isTransient() {
   return transient;
 }
 
+
+inline void FEStorage::setEquationOrdering(EquationOrdering _ordering) {
+  ordering = _ordering;
+}
+
+
+inline FEStorage::EquationOrdering FEStorage::getEquationOrdering() {
+  return ordering;
+}
+
+
+inline void FEStorage::setBlockStorage(bool _useBlockStorage) {
+  useBlockStorage = _useBlockStorage;
+}
+
+
+inline void FEStorage::setElementCache(bool _useElementCache) {
+  useElementCache = _useElementCache;
+  clearElementCache();
+}
+
 inline void FEStorage::addNodeDof(uint32 node, std::initializer_list<Dof::dofType> _dofs) {
   assert(nodeDofs.getNumberOfEntities() > 0);
   nodeDofs.addDof(node, _dofs);
@@ -634,7 +894,7 @@ inline double FEStorage::getElementDofSolution (uint32 el, Dof::dofType dof) {
 
 inline Node& FEStorage::getNode(uint32 _nn) {
 	assert(_nn> 0 && _nn <= nNodes());
-	return *nodes[_nn-1];
+	return nodes[_nn-1];
 }
 
 
@@ -650,19 +910,8 @@ inline ET& FEStorage::getElement(uint32 _en) {
 }
 
 
-inline void FEStorage::addEntryK(uint32 eqi, uint32 eqj) {
-  // eqi - row equation 
-  // eqj - column equation
-  matK->addEntry(eqi, eqj);
-}
-
-
-inline void FEStorage::addEntryMPC(uint32 eq_num, uint32 eqj) {
-	assert(matK);
-	assert(eq_num > nConstrainedDofs() + nUnknownDofs());
-  assert(eq_num <= nConstrainedDofs() + nUnknownDofs() + nMpc());
-  assert(eqj > 0 && eqj <= nConstrainedDofs() + nUnknownDofs());
-  matK->addEntry(eq_num, eqj);
+inline IntPointArena& FEStorage::getIntPointArena() {
+  return intPointArena;
 }
 
 
@@ -678,20 +927,19 @@ std::vector<uint32> FEStorage::createElements(uint32 _en, T example) {
   std::vector<uint32> newIndexes;
   newIndexes.reserve(_en);
   uint32 nextNumber = elements.size() + 1;
-
-  elements.reserve(elements.size() + _en);
-
-  for (uint32 i = 0; i < _en; i++) {
-    T* els = new T;
-    elements.push_back(els);
+  if (_en == 0) {
+    return newIndexes;
   }
 
+  elementBlocks.emplace_back(new ElementArray<T>(_en, elements));
+
   for (uint32 i = nextNumber; i <= elements.size(); i++) {
     //access elNum protected values as friend
     elements[i - 1]->elNum = i;
     elements[i - 1]->storage = this;
     newIndexes.push_back(i);
   }
+  bindElementNodes(nextNumber - 1);
   return newIndexes;
 }
 
@@ -0,0 +1,79 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "IntPointArena.h"
+#include <cstring>
+
+namespace nla3d {
+
+void* IntPointArena::allocateBytes(uint16 elType, uint16 field, size_t bytes) {
+  // keep every array aligned by 16 bytes (blocks are allocated by new double[] which is aligned at
+  // least by 16 bytes)
+  bytes = (bytes + 15) / 16 * 16;
+  Pool& pool = pools[(static_cast<uint32> (elType) << 16) | field];
+  if (pool.blocks.empty() || pool.used.back() + bytes > pool.blockBytes) {
+    size_t blockBytes = std::max(bytes, static_cast<size_t> (BLOCK_BYTES));
+    pool.blocks.emplace_back(new double[blockBytes / sizeof(double)]);
+    pool.used.push_back(0);
+    pool.blockBytes = blockBytes;
+    memory += blockBytes;
+  }
+  void* p = reinterpret_cast<char*> (pool.blocks.back().get()) + pool.used.back();
+  pool.used.back() += bytes;
+  return p;
+}
+
+
+void IntPointArena::clear() {
+  pools.clear();
+  memory = 0;
+}
+
+
+void IntPointArena::save(uint16 firstField) {
+  for (auto& v : pools) {
+    Pool& pool = v.second;
+    if ((v.first & 0xFFFF) < firstField) {
+      continue;
+    }
+    size_t total = 0;
+    for (size_t b = 0; b < pool.blocks.size(); b++) {
+      total += pool.used[b];
+    }
+    pool.saved.resize(total / sizeof(double));
+    char* dest = reinterpret_cast<char*> (pool.saved.data());
+    for (size_t b = 0; b < pool.blocks.size(); b++) {
+      std::memcpy(dest, pool.blocks[b].get(), pool.used[b]);
+      dest += pool.used[b];
+    }
+  }
+}
+
+
+void IntPointArena::restore() {
+  for (auto& v : pools) {
+    Pool& pool = v.second;
+    if (pool.saved.empty()) {
+      continue;
+    }
+    size_t total = 0;
+    for (size_t b = 0; b < pool.blocks.size(); b++) {
+      total += pool.used[b];
+    }
+    CHECK(total == pool.saved.size() * sizeof(double))
+      << "IntPointArena: the pool " << v.first << " was changed after save()";
+    const char* src = reinterpret_cast<const char*> (pool.saved.data());
+    for (size_t b = 0; b < pool.blocks.size(); b++) {
+      std::memcpy(pool.blocks[b].get(), src, pool.used[b]);
+      src += pool.used[b];
+    }
+  }
+}
+
+
+size_t IntPointArena::getMemory() const {
+  return memory;
+}
+
+} // namespace nla3d
@@ -0,0 +1,128 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include <map>
+#include <memory>
+#include <new>
+
+namespace nla3d {
+
+// Fields of integration point data of elements. A field together with an element type defines a
+// pool of IntPointArena.
+enum IntPointField : uint16 {
+  IP_NIXJ = 0,  // derivatives of form functions vs. global coordinates
+  IP_DET,       // Jacobian determinants
+  IP_S,         // stresses (fields from here on are solution state of elements, see save())
+  IP_C,         // strain measures
+  IP_O          // displacement gradients
+};
+
+
+// Storage for integration point data of elements (see IntPointArray). Every pool (a field of
+// elements of one type, for example stresses of SOLID81 elements) takes memory from its own large
+// blocks. Arrays of elements prepared one after another are adjacent in memory, and the whole model
+// needs a few allocations per pool instead of one per element and field.
+// NOTE: allocate() isn't thread safe, it's expected to be called from Element::pre().
+class IntPointArena {
+  public:
+    // memory for `n` values of type T in the pool of `field` of elements of type `elType`. The
+    // memory isn't initialized, it's aligned by 16 bytes and lives until clear() is called.
+    // NOTE: destructors of T aren't called, T should be a plain data type (math::Vec, math::Mat, ..)
+    template <class T>
+    T* allocate(uint16 elType, uint16 field, uint32 n);
+
+    // free memory of all pools
+    void clear();
+
+    // copy values of pools of fields >= `firstField` to restore them later by restore(). It's used
+    // to roll back solution state of elements (stresses, strains, ..) to the last converged step.
+    // The pools shouldn't get new arrays between save() and restore().
+    void save(uint16 firstField);
+    void restore();
+
+    // memory taken by all pools in bytes
+    size_t getMemory() const;
+
+  private:
+    struct Pool {
+      std::vector<std::unique_ptr<double[]> > blocks;
+      // number of used bytes in every block and size of the last block
+      std::vector<size_t> used;
+      size_t blockBytes = 0;
+      // copy of used bytes of all blocks made by save()
+      std::vector<double> saved;
+    };
+
+    void* allocateBytes(uint16 elType, uint16 field, size_t bytes);
+
+    // pools by (elType << 16 | field)
+    std::map<uint32, Pool> pools;
+    size_t memory = 0;
+
+    static const size_t BLOCK_BYTES = 1 << 18;
+};
+
+
+// View of integration point values of one element kept in IntPointArena. The view is as cheap as a
+// pointer, copies of the view refer to the same memory.
+template <class T>
+class IntPointArray {
+  public:
+    T& operator[] (uint16 np);
+    const T& operator[] (uint16 np) const;
+
+    uint16 size() const {
+      return n;
+    }
+
+    T* data() {
+      return ptr;
+    }
+
+    // take memory for `num` values from the pool (`elType`, `field`) of `arena` and set all of them
+    // to `value`. The memory is reused if the view already has `num` values.
+    void assign(IntPointArena& arena, uint16 elType, uint16 field, uint16 num, const T& value);
+
+  private:
+    T* ptr = nullptr;
+    uint16 n = 0;
+};
+
+
+template <class T>
+T* IntPointArena::allocate(uint16 elType, uint16 field, uint32 n) {
+  static_assert(alignof(T) <= 16, "IntPointArena: alignment of the type is too big");
+  return static_cast<T*> (allocateBytes(elType, field, sizeof(T) * n));
+}
+
+
+template <class T>
+inline T& IntPointArray<T>::operator[] (uint16 np) {
+  assert(np < n);
+  return ptr[np];
+}
+
+
+template <class T>
+inline const T& IntPointArray<T>::operator[] (uint16 np) const {
+  assert(np < n);
+  return ptr[np];
+}
+
+
+template <class T>
+void IntPointArray<T>::assign(IntPointArena& arena, uint16 elType, uint16 field, uint16 num,
+                              const T& value) {
+  if (ptr == nullptr || n != num) {
+    ptr = arena.allocate<T>(elType, field, num);
+    n = num;
+  }
+  for (uint16 i = 0; i < n; i++) {
+    new (ptr + i) T(value);
+  }
+}
+
+} // namespace nla3d
@@ -118,8 +118,13 @@ void VtkProcessor::write_geometry(std::ofstream &file, bool def) {
 	file << "POINTS " << storage->nNodes() << " float" << std::endl;
 	for (uint32 i=1; i <= storage->nNodes(); i++)
 	{
-		storage->getNodePosition(i, xi.ptr(), def);
-		file << xi << std::endl;
+		if (def) {
+			storage->getNodePosition(i, xi.ptr(), def);
+			file << xi << std::endl;
+		} else {
+			// initial positions are written right from the nodes array
+			file << storage->getNode(i).pos << std::endl;
+		}
 	}
 	/*
 	CELLS en en*9
@@ -0,0 +1,132 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "elements/PLANE41.h"
+#include "elements/SOLID81.h"
+#include "elements/TRUSS3.h"
+#include "elements/TETRA0.h"
+#include "elements/TETRA1.h"
+#include "elements/QUADTH.h"
+#include "elements/TRIANGLE4.h"
+#include "elements/TRIANGLE_THERMO.h"
+#include "elements/INTER0.h"
+#include "elements/INTER3.h"
+
+namespace nla3d {
+
+// Call `f.template apply<T>()` where T is the element class which ElementFactory creates for `type`.
+// Returns false if there is no such class. This is the only place where element types are mapped to
+// classes, it's used to create elements and to write loops over elements of one type without
+// virtual calls (see ElementCalls).
+template <class Func>
+bool dispatchElementType(ElementType type, Func& f) {
+  switch (type) {
+    case ElementType::PLANE41:
+      f.template apply<ElementPLANE41>();
+      return true;
+    case ElementType::SOLID81:
+      f.template apply<ElementSOLID81>();
+      return true;
+    case ElementType::TRUSS3:
+      f.template apply<ElementTRUSS3>();
+      return true;
+    case ElementType::TRIANGLE4:
+      f.template apply<ElementTRIANGLE4>();
+      return true;
+    case ElementType::TETRA0:
+      f.template apply<ElementTETRA0>();
+      return true;
+    case ElementType::TETRA1:
+      f.template apply<ElementTETRA1>();
+      return true;
+    case ElementType::QUADTH:
+      f.template apply<ElementQUADTH>();
+      return true;
+    case ElementType::TRIANGLE_THERMO:
+      f.template apply<ElementTRIANGLE_THERMO>();
+      return true;
+    case ElementType::SurfaceLINETH:
+      f.template apply<SurfaceLINETH>();
+      return true;
+    case ElementType::INTER0:
+      f.template apply<ElementINTER0>();
+      return true;
+    case ElementType::INTER3:
+      f.template apply<ElementINTER3>();
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+// Calls of Element virtual methods for an element of class ET. ET should be the exact class of the
+// element, then the calls are direct and can be inlined into loops over elements of one type.
+// ElementCalls<Element> makes usual virtual calls for elements of unknown classes.
+template <class ET>
+struct ElementCalls {
+  static bool isLinear(Element* el) {
+    return static_cast<ET*> (el)->ET::isLinear();
+  }
+
+  static bool computeK(Element* el, ElementMatrices& em) {
+    return static_cast<ET*> (el)->ET::computeK(em);
+  }
+
+  static bool computeKBatch(Element** batch, uint16 n, ElementMatrices* em) {
+    return static_cast<ET*> (batch[0])->ET::computeKBatch(batch, n, em);
+  }
+
+  static bool computeF(Element* el, ElementMatrices& em) {
+    return static_cast<ET*> (el)->ET::computeF(em);
+  }
+
+  static bool computeFBatch(Element** batch, uint16 n, ElementMatrices* em) {
+    return static_cast<ET*> (batch[0])->ET::computeFBatch(batch, n, em);
+  }
+
+  static void buildK(Element* el) {
+    static_cast<ET*> (el)->ET::buildK();
+  }
+
+  static void update(Element* el) {
+    static_cast<ET*> (el)->ET::update();
+  }
+};
+
+
+template <>
+struct ElementCalls<Element> {
+  static bool isLinear(Element* el) {
+    return el->isLinear();
+  }
+
+  static bool computeK(Element* el, ElementMatrices& em) {
+    return el->computeK(em);
+  }
+
+  static bool computeKBatch(Element** batch, uint16 n, ElementMatrices* em) {
+    return batch[0]->computeKBatch(batch, n, em);
+  }
+
+  static bool computeF(Element* el, ElementMatrices& em) {
+    return el->computeF(em);
+  }
+
+  static bool computeFBatch(Element** batch, uint16 n, ElementMatrices* em) {
+    return batch[0]->computeFBatch(batch, n, em);
+  }
+
+  static void buildK(Element* el) {
+    el->buildK();
+  }
+
+  static void update(Element* el) {
+    el->update();
+  }
+};
+
+} // namespace nla3d
@@ -4,15 +4,54 @@
 
 #pragma once
 #include "sys.h"
+#include <memory>
 
 namespace nla3d {
 class Element;
 
+// Owner of elements of FEStorage. Elements created at once (see ElementFactory::createElements())
+// are placed in one contiguous array, so loops over consecutive elements walk memory linearly.
+class ElementBlock {
+  public:
+    virtual ~ElementBlock() { }
+};
+
+
+// `n` elements of type T in one array
+template <class T>
+class ElementArray : public ElementBlock {
+  public:
+    // create elements and add pointers to them at the end of `ptr`
+    ElementArray(uint32 n, std::vector<Element*>& ptr) : els(new T[n]) {
+      ptr.reserve(ptr.size() + n);
+      for (uint32 i = 0; i < n; i++) {
+        ptr.push_back(&els[i]);
+      }
+    }
+
+  private:
+    std::unique_ptr<T[]> els;
+};
+
+
+// an element allocated by user code (see FEStorage::addElement())
+class SingleElement : public ElementBlock {
+  public:
+    SingleElement(Element* el);
+    ~SingleElement();
+
+  private:
+    Element* el;
+};
+
+
 class ElementFactory {
   public:
 
     static ElementType elName2elType (std::string elName); 
-    static void createElements (ElementType elId, const uint32 n, std::vector<Element*>& ptr); 
+    // create `n` elements of type `elId` in one contiguous block and add pointers to them at the end
+    // of `ptr`. The caller takes ownership of the block.
+    static ElementBlock* createElements (ElementType elId, const uint32 n, std::vector<Element*>& ptr); 
 };
 
 } // namespace nla3d
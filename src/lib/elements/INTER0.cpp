@@ -53,6 +53,10 @@ void ElementINTER0::buildK() {
   assembleK(Ke, {Dof::UX, Dof::UY, Dof::UZ});
 }
 
+bool ElementINTER0::isLinear() {
+  return true;
+}
+
 void ElementINTER0::update () {
   Eigen::VectorXd U(6);
   for (uint16 i = 0; i < getNNodes(); i++) {
@@ -50,6 +50,10 @@ void ElementINTER3::buildK() {
   assembleK(Ke_glob, {Dof::UX, Dof::UY, Dof::UZ});
 }
 
+bool ElementINTER3::isLinear() {
+  return true;
+}
+
 void ElementINTER3::update () {
   //Перемещения в узлах верхнего и нижнего треугольника
   Eigen::VectorXd U1(9);
@@ -14,6 +14,7 @@ public:
   void pre();
 
   void buildK();
+  bool isLinear();
   void make_D(Eigen::MatrixXd& D);
   Eigen::MatrixXd make_B(uint16 np, uint16 npj);
   Eigen::MatrixXd make_subB(uint16 np, uint16 npj);
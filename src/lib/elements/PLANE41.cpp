@@ -17,9 +17,10 @@ void ElementPLANE41::pre() {
     makeJacob();
   }
 
-  S.assign(nOfIntPoints(), Vec<3>(0.0f, 0.0f, 0.0f));
-  C.assign(nOfIntPoints(), Vec<3>(1.0f, 1.0f, 0.0f));
-  O.assign(nOfIntPoints(), Vec<4>(0.0f, 0.0f, 0.0f, 0.0f));
+  IntPointArena& arena = storage->getIntPointArena();
+  S.assign(arena, (uint16) type, IP_S, nOfIntPoints(), Vec<3>(0.0f, 0.0f, 0.0f));
+  C.assign(arena, (uint16) type, IP_C, nOfIntPoints(), Vec<3>(1.0f, 1.0f, 0.0f));
+  O.assign(arena, (uint16) type, IP_O, nOfIntPoints(), Vec<4>(0.0f, 0.0f, 0.0f, 0.0f));
 
   // register element equations
   for (uint16 i = 0; i < getNNodes(); i++) {
@@ -28,9 +29,23 @@ void ElementPLANE41::pre() {
   storage->addElementDof(getElNum(), {Dof::HYDRO_PRESSURE});
 }
 
-void ElementPLANE41::buildK() {
+bool ElementPLANE41::computeK(ElementMatrices& em) {
+  computeKF<true>(em);
+  return true;
+}
+
+
+bool ElementPLANE41::computeF(ElementMatrices& em) {
+  computeKF<false>(em);
+  return true;
+}
+
+
+// The rhs needs only matB, so without `withK` the material tangent and stiffness blocks are skipped
+template <bool withK>
+void ElementPLANE41::computeKF(ElementMatrices& em) {
   Mat<8,8> Kuu;  // displacement stiff. matrix
-  Mat<8,1> Kup;
+  Vec<8> Kup;
   Mat<9,9> Ke;  // element stiff. matrix
   double Kpp = 0.0;
   double Fp = 0.0;
@@ -54,53 +69,91 @@ void ElementPLANE41::buildK() {
     CVec[M_XX] = C[np][0];
     CVec[M_YY] = C[np][1];
     CVec[M_XY] = C[np][2];
-    mat->getDdDp_UP(num_components, components, CVec.ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
-    //matD_d will be 3x3 symmetric matrix. We need to convert it onto 3x3 usual matrix
-    Mat<3,3> matE_c = matD_d.toMat();
-    Mat<3,1> matE_p;
-    matE_p[0][0] = vecD_p[0];
-    matE_p[1][0] = vecD_p[1];
-    matE_p[2][0] = vecD_p[2];
+    if (withK) {
+      mat->getDdDp_UP(num_components, components, CVec.ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
+    }
     double J = solidmech::J_C(CVec.ptr());
 
-    Mat<3,8> matB = make_B(np);
-    //матрица S для матричного умножения
-    Mat<4,4> matS = Mat<4,4>(S[np][0],S[np][2], 0.0, 0.0, 
-                S[np][2],S[np][1], 0.0, 0.0,
-                0.0, 0.0, S[np][0],S[np][2],
-                0.0, 0.0, S[np][2],S[np][1]);
-    //матрица Омега.используется для составления 
-    //матр. накопленных линейных деформаций к текущему шагу
-    Mat<3,4> matO = Mat<3,4>(O[np][0], 0.0, O[np][2], 0.0,
-                0.0, O[np][1], 0.0, O[np][3],
-                O[np][1], O[np][0], O[np][3], O[np][2]);
-
-    Mat<4,8> matBomega = make_Bomega(np);
-    Mat<3,8> matBl = matO * matBomega;
-    matB += matBl;
-    Kuu += (matB.transpose() * matE_c * matB * 2.0 + matBomega.transpose() * matS * matBomega)*dWt;
+    // Full strain-displacement matrix B = B_L + Omega * B_omega is built in closed form from the
+    // deformation gradient F[d][j] = delta_dj + O[2d+j]: for node `a` and displacement `d`
+    // B[XX] = F[d][0] n0, B[YY] = F[d][1] n1, B[XY] = F[d][0] n1 + F[d][1] n0, where n = dNa/dx
+    const double F[2][2] = {{1.0 + O[np][0], O[np][1]}, {O[np][2], 1.0 + O[np][3]}};
+    double matB[3][8];
+    for (uint16 a = 0; a < 4; a++) {
+      const double n0 = NiXj[np][a][0];
+      const double n1 = NiXj[np][a][1];
+      for (uint16 d = 0; d < 2; d++) {
+        matB[0][2*a+d] = F[d][0] * n0;
+        matB[1][2*a+d] = F[d][1] * n1;
+        matB[2][2*a+d] = F[d][0] * n1 + F[d][1] * n0;
+      }
+    }
+    for (uint16 i = 0; i < 8; i++) {
+      Qe[i] += (matB[0][i] * S[np][0] + matB[1][i] * S[np][1] + matB[2][i] * S[np][2]) * dWt;
+    }
     Fp += (J - 1 - p_e/k)*dWt;
-    Qe += (matB.transpose() * S[np] * dWt);
-    Kup+= matB.transpose()*matE_p *dWt;
+
+    // the rest is the stiffness matrix only
+    if (!withK) {
+      continue;
+    }
+
+    // E * B
+    Mat<3,3> matE_c = matD_d.toMat();
+    double EB[3][8];
+    for (uint16 i = 0; i < 3; i++) {
+      for (uint16 j = 0; j < 8; j++) {
+        EB[i][j] = matE_c[i][0] * matB[0][j] + matE_c[i][1] * matB[1][j] + matE_c[i][2] * matB[2][j];
+      }
+    }
+    // upper triangle of B^T * E * B * 2
+    for (uint16 i = 0; i < 8; i++) {
+      for (uint16 j = i; j < 8; j++) {
+        Kuu[i][j] += (matB[0][i] * EB[0][j] + matB[1][i] * EB[1][j] + matB[2][i] * EB[2][j]) * 2.0 * dWt;
+      }
+    }
+    // geometric part B_omega^T * S * B_omega is not zero only for the same displacement
+    // components of nodes `a` and `b`: (na^T * S * nb) * I
+    for (uint16 b = 0; b < 4; b++) {
+      const double Sn0 = S[np][0] * NiXj[np][b][0] + S[np][2] * NiXj[np][b][1];
+      const double Sn1 = S[np][2] * NiXj[np][b][0] + S[np][1] * NiXj[np][b][1];
+      for (uint16 a = 0; a <= b; a++) {
+        const double g = (NiXj[np][a][0] * Sn0 + NiXj[np][a][1] * Sn1) * dWt;
+        Kuu[2*a][2*b] += g;
+        Kuu[2*a+1][2*b+1] += g;
+      }
+    }
+    for (uint16 i = 0; i < 8; i++) {
+      Kup[i] += (matB[0][i] * vecD_p[0] + matB[1][i] * vecD_p[1] + matB[2][i] * vecD_p[2]) * dWt;
+    }
     Kpp -= 1.0/k*dWt;
 
   }// loop over intergration points
   
+  if (!withK) {
+    for (uint16 i=0; i < 8; i++)
+      Fe[i] = -Qe[i];
+    Fe[8] = -Fp;
+    assembleF(Fe, em);
+    return;
+  }
 
   //сборка в одну матрицу
   for (uint16 i=0; i < 8; i++)
-    for (uint16 j=0; j < 8; j++)
+    for (uint16 j=i; j < 8; j++) {
       Ke[i][j] = Kuu[i][j];
+      Ke[j][i] = Kuu[i][j];
+    }
   for (uint16 i=0; i<8; i++)
-    Ke[i][8] = Kup[i][0];
+    Ke[i][8] = Kup[i];
   for (uint16 i=0; i<8; i++)
-    Ke[8][i] = Kup[i][0];
+    Ke[8][i] = Kup[i];
   Ke[8][8] = Kpp;
   for (uint16 i=0; i < 8; i++)
     Fe[i] = -Qe[i];
   Fe[8] = -Fp;
   //загнать в глоб. матрицу жесткости и узловых сил
-  assembleK(Ke, Fe);
+  assembleK(Ke, Fe, em);
 }
 //
 inline Mat<3,8> ElementPLANE41::make_B(uint16 np) {
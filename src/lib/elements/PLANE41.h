@@ -24,7 +24,9 @@ class ElementPLANE41 : public ElementIsoParamQUAD {
 
     //solving procedures
     void pre();
-    void buildK();
+    bool computeK(ElementMatrices& em);
+    // rhs only version of computeK(), Fe is the same as computeK() gives
+    bool computeF(ElementMatrices& em);
     void update();
     math::Mat<3,8> make_B (uint16 nPoint);  //функция создает линейную матрицу [B]
     math::Mat<4,8> make_Bomega (uint16 nPoint); //функция создает линейную матрицу [Bomega]
@@ -36,63 +38,64 @@ class ElementPLANE41 : public ElementIsoParamQUAD {
 
     // internal element data
     // S[0] - Sx  S[1] - Sy S[2] - Sxy
-    std::vector<math::Vec<3> > S; //S[номер т. интегр.][номер напряжения] - напряжения Пиолы-Кирхгоффа
+    IntPointArray<math::Vec<3> > S; //S[номер т. интегр.][номер напряжения] - напряжения Пиолы-Кирхгоффа
     // C[0] - C11 C[1] - C22  C[2] - C12
-    std::vector<math::Vec<3> > C; //C[номер т. интегр.][номер деформ.] - компоненты матрицы меры деформации
+    IntPointArray<math::Vec<3> > C; //C[номер т. интегр.][номер деформ.] - компоненты матрицы меры деформации
     // O[0] - dU/dx O[1] - dU/dy  O[2] - dV/dx  O[3] - dV/dy
-    std::vector<math::Vec<4> > O; //S[номер т. интегр.][номер омеги]
+    IntPointArray<math::Vec<4> > O; //S[номер т. интегр.][номер омеги]
 
     // addition data
     static const solidmech::tensorComponents components[3];
     static const uint16 num_components;
 
 
+    // pack Ke, Qe into element matrices `em`
     template <uint16 el_dofs_num>
-    void assembleK(const math::Mat<el_dofs_num,el_dofs_num> &Ke, const math::Vec<el_dofs_num> &Qe);
+    void assembleK(const math::Mat<el_dofs_num,el_dofs_num> &Ke, const math::Vec<el_dofs_num> &Qe,
+                   ElementMatrices& em);
+    // pack Qe into element rhs of `em` (see computeF())
+    template <uint16 el_dofs_num>
+    void assembleF(const math::Vec<el_dofs_num> &Qe, ElementMatrices& em);
+
+  private:
+    // element kernel of computeK() (`withK` = true) and computeF() (`withK` = false)
+    template <bool withK>
+    void computeKF(ElementMatrices& em);
 };
 
 template <uint16 el_dofs_num>
-void ElementPLANE41::assembleK(const math::Mat<el_dofs_num,el_dofs_num> &Ke, const math::Vec<el_dofs_num> &Qe)
+void ElementPLANE41::assembleK(const math::Mat<el_dofs_num,el_dofs_num> &Ke, const math::Vec<el_dofs_num> &Qe,
+                               ElementMatrices& em)
 {
-  uint16 dim = 2;
-  uint16 eds = 8;
-  uint16 eldofs = 1;
-  Dof::dofType nodeDofVec[] = {Dof::UX, Dof::UY};
-  Dof::dofType elementDofVec[] = {Dof::HYDRO_PRESSURE};
-  assert(getNNodes() * dim + eldofs == el_dofs_num);
-  // upper diagonal process for nodal dofs
-  for (uint16 i=0; i < getNNodes(); i++)
-    for (uint16 j=i; j < getNNodes(); j++)
-      for (uint16 di=0; di < dim; di++)
-        for (uint16 dj=0; dj < dim; dj++)
-          if ((i==j) && (dj>di)) continue;
-          else
-            storage->addValueK(nodes[i], nodeDofVec[di],nodes[j],nodeDofVec[dj], Ke[i*dim+di][j*dim+dj]);
-
-  //upper diagonal process for nodes-el dofs
-  for (uint16 i=0; i < getNNodes(); i++)
-    for(uint16 di=0; di < dim; di++) {
-      uint32 noEq = storage->getNodeDofEqNumber(nodes[i], nodeDofVec[di]);
-      for (uint16 dj=0; dj < eldofs; dj++) {
-        uint32 elEq = storage->getElementDofEqNumber(getElNum(), elementDofVec[dj]);
-        storage->addValueK(noEq, elEq, Ke[i*dim+di][eds+dj]);
-      }
-    }
-  //upper diagonal process for el-el dofs
-  for (uint16 di=0; di < eldofs; di++)
-    for (uint16 dj=di; dj < eldofs; dj++) {
-      uint32 elEqi = storage->getElementDofEqNumber(getElNum(), elementDofVec[di]);
-      uint32 elEqj = storage->getElementDofEqNumber(getElNum(), elementDofVec[dj]);
-      storage->addValueK(elEqi, elEqj, Ke[eds+di][eds+dj]);
+  // local DoFs: UX, UY of every node followed by HYDRO_PRESSURE element DoF
+  prepareScatter({Dof::UX, Dof::UY}, {Dof::HYDRO_PRESSURE});
+  assert(scatterEq.size() == el_dofs_num);
+  em.resize(el_dofs_num);
+  std::copy(scatterEq.begin(), scatterEq.end(), em.eq.begin());
+  // upper triangle of Ke
+  double* Ke_p = em.Ke.data();
+  for (uint16 i = 0; i < el_dofs_num; i++) {
+    for (uint16 j = i; j < el_dofs_num; j++) {
+      *Ke_p = Ke[i][j];
+      Ke_p++;
     }
+  }
+
+  for (uint16 i = 0; i < el_dofs_num; i++) {
+    em.Fe[i] = Qe[i];
+  }
+}
 
-  for (uint16 i=0; i < getNNodes(); i++)
-    for (uint16 di=0; di < dim; di++)
-      storage->addValueF(nodes[i], nodeDofVec[di], Qe[i*dim+di]);
 
-  for (uint16 di=0; di < eldofs; di++) {
-    uint32 elEq = storage->getElementDofEqNumber(getElNum(), elementDofVec[di]);
-    storage->addValueF(elEq, Qe[eds+di]);
+template <uint16 el_dofs_num>
+void ElementPLANE41::assembleF(const math::Vec<el_dofs_num> &Qe, ElementMatrices& em)
+{
+  prepareScatter({Dof::UX, Dof::UY}, {Dof::HYDRO_PRESSURE});
+  assert(scatterEq.size() == el_dofs_num);
+  em.resizeF(el_dofs_num);
+  std::copy(scatterEq.begin(), scatterEq.end(), em.eq.begin());
+  for (uint16 i = 0; i < el_dofs_num; i++) {
+    em.Fe[i] = Qe[i];
   }
 }
 
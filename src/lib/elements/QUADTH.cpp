@@ -72,6 +72,10 @@ Mat<2,4> ElementQUADTH::make_B(uint16 np) {
 }
 
 
+bool ElementQUADTH::isLinear() {
+  return volFlux == 0.0;
+}
+
 void ElementQUADTH::update() {
 
 }
@@ -128,6 +132,10 @@ void SurfaceLINETH::buildK() {
   assembleK(Ke, Fe, {Dof::TEMP});
 }
 
+bool SurfaceLINETH::isLinear() {
+  return flux == 0.0 && (htc == 0.0 || (etemp[0] == 0.0 && etemp[1] == 0.0));
+}
+
 void SurfaceLINETH::update() {
 
 }
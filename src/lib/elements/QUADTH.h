@@ -21,6 +21,8 @@ class ElementQUADTH : public ElementIsoParamQUAD {
     //solving procedures
     void pre();
     void buildK();
+    // true without volume flux, the rhs of which is recomputed on every assembly
+    bool isLinear();
     void buildC();
     void buildM() { };
     void update();
@@ -45,6 +47,9 @@ class SurfaceLINETH : public ElementIsoParamLINE {
     //solving procedures
     void pre();
     void buildK();
+    // true without flux and convection loads (only htc could be set), the rhs of which is
+    // recomputed on every assembly
+    bool isLinear();
     void buildC() { };
     void buildM() { };
     void update();
@@ -3,6 +3,7 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "elements/SOLID81.h"
+#include "math/MatBatch.h"
 
 namespace nla3d {
 using namespace math;
@@ -14,9 +15,10 @@ void ElementSOLID81::pre() {
     makeJacob();
   }
 
-  S.assign(nOfIntPoints(), Vec<6>(0.0, 0.0, 0.0, 0.0, 0.0, 0.0));
-  C.assign(nOfIntPoints(), Vec<6>(1.0, 0.0, 0.0, 1.0, 0.0, 1.0));
-  O.assign(nOfIntPoints(), Vec<9>(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0));
+  IntPointArena& arena = storage->getIntPointArena();
+  S.assign(arena, (uint16) type, IP_S, nOfIntPoints(), Vec<6>(0.0, 0.0, 0.0, 0.0, 0.0, 0.0));
+  C.assign(arena, (uint16) type, IP_C, nOfIntPoints(), Vec<6>(1.0, 0.0, 0.0, 1.0, 0.0, 1.0));
+  O.assign(arena, (uint16) type, IP_O, nOfIntPoints(), Vec<9>(0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0));
 
   // register element equations
   for (uint16 i = 0; i < getNNodes(); i++) {
@@ -26,59 +28,305 @@ void ElementSOLID81::pre() {
 }
 
 
-void ElementSOLID81::buildK() {
+bool ElementSOLID81::computeK(ElementMatrices& em) {
+  ElementSOLID81* el = this;
+  computeKLanes<1, true>(&el, 1, &em);
+  return true;
+}
+
+
+bool ElementSOLID81::computeKBatch(Element** batch, uint16 n, ElementMatrices* em) {
+  ElementSOLID81* els[BATCH_LANES];
+  if (!prepareBatch(batch, n, els)) {
+    return false;
+  }
+  computeKLanes<BATCH_LANES, true>(els, n, em);
+  return true;
+}
+
+
+bool ElementSOLID81::computeF(ElementMatrices& em) {
+  ElementSOLID81* el = this;
+  computeKLanes<1, false>(&el, 1, &em);
+  return true;
+}
 
-  double Kpp = 0.0;
-  double Fp = 0.0;
 
-  Vec<24> Kup;
-  Vec<24> Fu; //вектор узловых сил элемента
-  Vec<24> F_ext; //вектор внешних сил (пока не подсчитывается)
+bool ElementSOLID81::computeFBatch(Element** batch, uint16 n, ElementMatrices* em) {
+  ElementSOLID81* els[BATCH_LANES];
+  if (!prepareBatch(batch, n, els)) {
+    return false;
+  }
+  computeKLanes<BATCH_LANES, false>(els, n, em);
+  return true;
+}
+
+
+bool ElementSOLID81::prepareBatch(Element** batch, uint16 n, ElementSOLID81** els) {
+  assert(n > 0 && n <= BATCH_LANES);
+  // unused lanes repeat the first element, their results are thrown away
+  for (uint16 l = 0; l < BATCH_LANES; l++) {
+    els[l] = static_cast<ElementSOLID81*> (batch[l < n ? l : 0]);
+    if (els[l]->nOfIntPoints() != nOfIntPoints()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// The kernel uses the structure of B matrices. For node a with shape function derivatives n = NiXj[a]
+// and deformation gradient F (F[d][j] = I[d][j] + O[d*3+j]) the 6x3 block of matB = B_L + 2*Omega*B_NL
+// is
+//   B[ij][d] = 2 * (F[d][i] * n[j] + F[d][j] * n[i]) for i != j,  B[ii][d] = 2 * F[d][i] * n[i],
+// and B_NL^T * matS * B_NL block for nodes (a, b) is (n_a^T * S * n_b) * I (3x3). Thus material
+// part of Kuu is built by 6x3 node blocks and geometric part is a scalar per node pair. The rhs
+// needs only matB, so without `withK` the material tangent and stiffness blocks are skipped.
+template <uint16 W, bool withK>
+void ElementSOLID81::computeKLanes(ElementSOLID81** els, uint16 n, ElementMatrices* em) {
+  ElementSOLID81& first = *els[0];
+  FEStorage* storage = first.storage;
   Mat_Hyper_Isotrop_General* mat = CHECK_NOTNULL( dynamic_cast<Mat_Hyper_Isotrop_General*> (storage->getMaterial()));
   double k = mat->getK();
-  MatSym<6> matD_d;
-  Vec<6> vecD_p;
-  Vec<6> vecC;
 
-  Mat<6,24> matB;
-  MatSym<9> matS;
-  Mat<6,9> matO;
-  Mat<9,24> matB_NL;
-  MatSym<24> Kuu; //матрица жесткости перед вектором перемещений
-  double p_e = storage->getElementDofSolution(getElNum(), Dof::HYDRO_PRESSURE);
-  double dWt; //множитель при суммировании квадратур Гаусса
-  Kuu.zero();
-  for (uint16 np = 0; np < nOfIntPoints(); np++) {
-    dWt = intWeight(np);
-
-    mat->getDdDp_UP(6, solidmech::defaultTensorComponents, C[np].ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
-    double J = solidmech::J_C(C[np].ptr());
-    matB.zero();
-    matS.zero();
-    matO.zero();
-    matB_NL.zero();
-
-    make_B_L(np, matB);
-    make_S(np, matS); //matrix 9x9 with 3x3 stress tenros blocks
-    make_Omega(np, matO);
-    make_B_NL(np, matB_NL);
-    // matB = matB + matO * matB_NL * 2
-    matABprod(matO, matB_NL, 2.0, matB);
-    // Kuu = Kuu + (matB^T * matD_d * matB) * 0.5*dWt
-    matBTDBprod(matB, matD_d, 0.5*dWt, Kuu);
-    // Kuu = Kuu + (matB_NL^T * matS * matB_NL) * dWt
-    matBTDBprod(matB_NL, matS, dWt, Kuu);
+  // MatSym<6> index of (p, q) entry
+  static const uint16 sym6[6][6] = {{0, 1, 2, 3, 4, 5}, {1, 6, 7, 8, 9, 10}, {2, 7, 11, 12, 13, 14},
+                                    {3, 8, 12, 15, 16, 17}, {4, 9, 13, 16, 18, 19}, {5, 10, 14, 17, 19, 20}};
+  // tensor indexes (i, j) of components M_XX, M_XY, M_XZ, M_YY, M_YZ, M_ZZ
+  static const uint16 compI[6] = {0, 0, 0, 1, 1, 2};
+  static const uint16 compJ[6] = {0, 1, 2, 1, 2, 2};
+  // component of (i, j) tensor entry
+  static const uint16 sym3[3][3] = {{0, 1, 2}, {1, 3, 4}, {2, 4, 5}};
+
+  // every array keeps the same matrix of all lanes, see math/MatBatch.h
+  alignas(64) double Kuu[300 * W];
+  alignas(64) double Kup[24 * W];
+  alignas(64) double Fu[24 * W];
+  alignas(64) double matD_d[21 * W];
+  alignas(64) double vecD_p[6 * W];
+  alignas(64) double vecS[6 * W];
+  alignas(64) double Ni[8 * 3 * W];
+  alignas(64) double F[9 * W];
+  // B[a][p][d] - 6x3 block of matB for node a
+  alignas(64) double B[8 * 6 * 3 * W];
+  // A[a][d][q] = 0.5*dWt * (B_a^T * matD_d)[d][q]
+  alignas(64) double A[8 * 3 * 6 * W];
+  // Sn[b][i] = (matS * n_b)[i]
+  alignas(64) double Sn[8 * 3 * W];
+  // G[a][b] - geometric stiffness of node pair (a, b)
+  alignas(64) double G[8 * 8 * W];
+  double Kpp[W], Fp[W], p_e[W], J[W], dWt[W];
+
+  if (withK) {
+    zeroBatch<W>(300, Kuu);
+    zeroBatch<W>(24, Kup);
+  }
+  zeroBatch<W>(24, Fu);
+  for (uint16 l = 0; l < W; l++) {
+    Kpp[l] = 0.0;
+    Fp[l] = 0.0;
+    p_e[l] = storage->getElementDofSolution(els[l]->getElNum(), Dof::HYDRO_PRESSURE);
+  }
 
-    // Fu = Fu +  matB^T * S[np] * (-0.5*dWt);
-    matBTVprod(matB,S[np], -0.5*dWt, Fu);
+  for (uint16 np = 0; np < first.nOfIntPoints(); np++) {
+    // material response and integration point data are gathered lane by lane
+    for (uint16 l = 0; l < W; l++) {
+      ElementSOLID81& el = *els[l];
+      if (withK) {
+        MatSym<6> D_l;
+        Vec<6> Dp_l;
+        mat->getDdDp_UP(6, solidmech::defaultTensorComponents, el.C[np].ptr(), p_e[l], D_l.ptr(), Dp_l.ptr());
+        for (uint16 i = 0; i < 21; i++) {
+          matD_d[i * W + l] = D_l.ptr()[i];
+        }
+        for (uint16 i = 0; i < 6; i++) {
+          vecD_p[i * W + l] = Dp_l[i];
+        }
+      }
+      J[l] = solidmech::J_C(el.C[np].ptr());
+      dWt[l] = el.intWeight(np);
+      for (uint16 i = 0; i < 6; i++) {
+        vecS[i * W + l] = el.S[np][i];
+      }
+      for (uint16 i = 0; i < 9; i++) {
+        F[i * W + l] = el.O[np][i] + (i % 4 == 0 ? 1.0 : 0.0);
+      }
+      for (uint16 a = 0; a < 8; a++) {
+        for (uint16 j = 0; j < 3; j++) {
+          Ni[(a * 3 + j) * W + l] = el.NiXj[np][a][j];
+        }
+      }
+    }
 
+    // node blocks of matB
+    for (uint16 a = 0; a < 8; a++) {
+      for (uint16 p = 0; p < 6; p++) {
+        const uint16 i = compI[p];
+        const uint16 j = compJ[p];
+        const double* ni = Ni + (a * 3 + i) * W;
+        const double* nj = Ni + (a * 3 + j) * W;
+        for (uint16 d = 0; d < 3; d++) {
+          double* Bp = B + ((a * 6 + p) * 3 + d) * W;
+          const double* Fi = F + (d * 3 + i) * W;
+          const double* Fj = F + (d * 3 + j) * W;
+          if (i == j) {
+            FOR_EACH_LANE(l, W) {
+              Bp[l] = 2.0 * Fi[l] * ni[l];
+            }
+          } else {
+            FOR_EACH_LANE(l, W) {
+              Bp[l] = 2.0 * (Fi[l] * nj[l] + Fj[l] * ni[l]);
+            }
+          }
+        }
+      }
+    }
+
+    // Fu = Fu +  matB^T * S[np] * (-0.5*dWt);
     // Kup = Kup +  matB^T * vecD_p * (dWt*0.5);
-    matBTVprod(matB,vecD_p, 0.5*dWt, Kup);
+    for (uint16 a = 0; a < 8; a++) {
+      for (uint16 d = 0; d < 3; d++) {
+        alignas(64) double sumS[W];
+        alignas(64) double sumD[W];
+        FOR_EACH_LANE(l, W) {
+          sumS[l] = 0.0;
+          sumD[l] = 0.0;
+        }
+        for (uint16 p = 0; p < 6; p++) {
+          const double* Bp = B + ((a * 6 + p) * 3 + d) * W;
+          const double* Sp = vecS + p * W;
+          const double* Dp = vecD_p + p * W;
+          FOR_EACH_LANE(l, W) {
+            sumS[l] += Bp[l] * Sp[l];
+            if (withK) {
+              sumD[l] += Bp[l] * Dp[l];
+            }
+          }
+        }
+        double* Fup = Fu + (a * 3 + d) * W;
+        double* Kupp = Kup + (a * 3 + d) * W;
+        FOR_EACH_LANE(l, W) {
+          Fup[l] += sumS[l] * (-0.5 * dWt[l]);
+          if (withK) {
+            Kupp[l] += sumD[l] * (0.5 * dWt[l]);
+          }
+        }
+      }
+    }
+
+    FOR_EACH_LANE(l, W) {
+      Fp[l] += -(J[l] - 1 - p_e[l]/k)*dWt[l];
+      Kpp[l] += -1.0/k*dWt[l];
+    }
+
+    // the rest is the stiffness matrix only
+    if (!withK) {
+      continue;
+    }
+
+    // A_a = 0.5*dWt * B_a^T * matD_d
+    for (uint16 a = 0; a < 8; a++) {
+      for (uint16 d = 0; d < 3; d++) {
+        for (uint16 q = 0; q < 6; q++) {
+          alignas(64) double sum[W];
+          FOR_EACH_LANE(l, W) {
+            sum[l] = 0.0;
+          }
+          for (uint16 p = 0; p < 6; p++) {
+            const double* Bp = B + ((a * 6 + p) * 3 + d) * W;
+            const double* Dp = matD_d + sym6[p][q] * W;
+            FOR_EACH_LANE(l, W) {
+              sum[l] += Bp[l] * Dp[l];
+            }
+          }
+          double* Ap = A + ((a * 3 + d) * 6 + q) * W;
+          FOR_EACH_LANE(l, W) {
+            Ap[l] = sum[l] * 0.5 * dWt[l];
+          }
+        }
+      }
+    }
+
+    // G[a][b] = dWt * n_a^T * matS * n_b, where matS * n_b is found from stress components vecS
+    for (uint16 b = 0; b < 8; b++) {
+      const double* nb = Ni + b * 3 * W;
+      for (uint16 i = 0; i < 3; i++) {
+        double* Snp = Sn + (b * 3 + i) * W;
+        const double* s0 = vecS + sym3[i][0] * W;
+        const double* s1 = vecS + sym3[i][1] * W;
+        const double* s2 = vecS + sym3[i][2] * W;
+        FOR_EACH_LANE(l, W) {
+          Snp[l] = s0[l] * nb[l] + s1[l] * nb[W + l] + s2[l] * nb[2 * W + l];
+        }
+      }
+    }
+    for (uint16 a = 0; a < 8; a++) {
+      const double* na = Ni + a * 3 * W;
+      for (uint16 b = a; b < 8; b++) {
+        const double* Snp = Sn + b * 3 * W;
+        double* Gp = G + (a * 8 + b) * W;
+        FOR_EACH_LANE(l, W) {
+          Gp[l] = (na[l] * Snp[l] + na[W + l] * Snp[W + l] + na[2 * W + l] * Snp[2 * W + l]) * dWt[l];
+        }
+      }
+    }
+
+    // Kuu = Kuu + (matB^T * matD_d * matB) * 0.5*dWt + (matB_NL^T * matS * matB_NL) * dWt
+    double* Kp = Kuu;
+    for (uint16 a = 0; a < 8; a++) {
+      for (uint16 d = 0; d < 3; d++) {
+        const double* Ap = A + (a * 3 + d) * 6 * W;
+        for (uint16 b = a; b < 8; b++) {
+          for (uint16 e = (b == a ? d : 0); e < 3; e++) {
+            const double* Bp = B + (b * 6 * 3 + e) * W;
+            alignas(64) double sum[W];
+            FOR_EACH_LANE(l, W) {
+              sum[l] = 0.0;
+            }
+            for (uint16 q = 0; q < 6; q++) {
+              FOR_EACH_LANE(l, W) {
+                sum[l] += Ap[q * W + l] * Bp[q * 3 * W + l];
+              }
+            }
+            if (e == d) {
+              const double* Gp = G + (a * 8 + b) * W;
+              FOR_EACH_LANE(l, W) {
+                sum[l] += Gp[l];
+              }
+            }
+            FOR_EACH_LANE(l, W) {
+              Kp[l] += sum[l];
+            }
+            Kp += W;
+          }
+        }
+      }
+    }
+  }
 
-    Fp += -(J - 1 - p_e/k)*dWt;
-    Kpp += -1.0/k*dWt;
-  }//прошлись по всем точкам интегрирования
-  assemble3(Kuu, Kup, Kpp, Fu,Fp);
+  if (!withK) {
+    for (uint16 l = 0; l < n; l++) {
+      Vec<24> Fu_l;
+      for (uint16 i = 0; i < 24; i++) {
+        Fu_l[i] = Fu[i * W + l];
+      }
+      els[l]->assembleF3(Fu_l, Fp[l], em[l]);
+    }
+    return;
+  }
+  for (uint16 l = 0; l < n; l++) {
+    MatSym<24> Kuu_l;
+    Vec<24> Kup_l;
+    Vec<24> Fu_l;
+    for (uint16 i = 0; i < 300; i++) {
+      Kuu_l.ptr()[i] = Kuu[i * W + l];
+    }
+    for (uint16 i = 0; i < 24; i++) {
+      Kup_l[i] = Kup[i * W + l];
+      Fu_l[i] = Fu[i * W + l];
+    }
+    els[l]->assemble3(Kuu_l, Kup_l, Kpp[l], Fu_l, Fp[l], em[l]);
+  }
 }
 
 
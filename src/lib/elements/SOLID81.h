@@ -23,7 +23,14 @@ class ElementSOLID81 : public ElementIsoParamHEXAHEDRON {
 
     //solving procedures
     void pre();
-    void buildK();
+    bool computeK(ElementMatrices& em);
+    // batched version of computeK(): integration point computations of several elements are done
+    // in SoA layout (see math/MatBatch.h)
+    bool computeKBatch(Element** batch, uint16 n, ElementMatrices* em);
+    // rhs only versions of computeK() and computeKBatch(): material tangent and stiffness matrix
+    // aren't computed, Fe is the same as computeK() gives
+    bool computeF(ElementMatrices& em);
+    bool computeFBatch(Element** batch, uint16 n, ElementMatrices* em);
     void update();
 
     void make_B_L (uint16 nPoint, math::Mat<6,24> &B);	//функция создает линейную матрицу [B]
@@ -38,59 +45,76 @@ class ElementSOLID81 : public ElementIsoParamHEXAHEDRON {
 
     // internal element data
     //S[M_XX], S[M_XY], S[M_XZ], S[M_YY], S[M_YZ], S[M_ZZ]
-    std::vector<math::Vec<6> > S; //S[номер т. интегр.][номер напряжения] - напряжения Пиолы-Кирхгоффа
+    IntPointArray<math::Vec<6> > S; //S[номер т. интегр.][номер напряжения] - напряжения Пиолы-Кирхгоффа
     //C[M_XX], C[M_XY], C[M_XZ], C[M_YY], C[M_YZ], C[M_ZZ]
-    std::vector<math::Vec<6> > C; //C[номер т. интегр.][номер деформ.] - компоненты тензора меры деформации
+    IntPointArray<math::Vec<6> > C; //C[номер т. интегр.][номер деформ.] - компоненты тензора меры деформации
     // O[0]-dU/dx	O[1]-dU/dy	O[2]-dU/dz	O[3]-dV/dx	O[4]-dV/dy	O[5]-dV/dz	O[6]-dW/dx	O[7]-dW/dy	O[8]-dW/dz
-    std::vector<math::Vec<9> > O; //S[номер т. интегр.][номер омеги]
+    IntPointArray<math::Vec<9> > O; //S[номер т. интегр.][номер омеги]
 
     template <uint16 dimM, uint16 dimN>
     void assemble2(math::MatSym<dimM> &Kuu, math::Mat<dimM,dimM> &Kup, math::Mat<dimN,dimN> &Kpp, math::Vec<dimM> &Fu, math::Vec<dimN> &Fp);
+    // pack Kuu, Kup, Kpp, Fu, Fp into element matrices `em`
     template <uint16 dimM>
-    void assemble3(math::MatSym<dimM> &Kuu, math::Vec<dimM> &Kup, double Kpp, math::Vec<dimM> &Fu, double Fp);
+    void assemble3(math::MatSym<dimM> &Kuu, math::Vec<dimM> &Kup, double Kpp, math::Vec<dimM> &Fu, double Fp,
+                   ElementMatrices& em);
+    // pack Fu, Fp into element rhs of `em` (see computeF())
+    template <uint16 dimM>
+    void assembleF3(math::Vec<dimM> &Fu, double Fp, ElementMatrices& em);
+
+  private:
+    // element kernel for elements els[0] .. els[n-1] computed in W lanes (see math/MatBatch.h),
+    // computeK() uses W = 1, computeKBatch() - W = BATCH_LANES. If `withK` is false only the rhs is
+    // computed (computeF(), computeFBatch())
+    template <uint16 W, bool withK>
+    static void computeKLanes(ElementSOLID81** els, uint16 n, ElementMatrices* em);
+    // take BATCH_LANES elements for a batched kernel, false if the batch can't be processed at once
+    bool prepareBatch(Element** batch, uint16 n, ElementSOLID81** els);
 };
 
 
 template <uint16 dimM>
-void ElementSOLID81::assemble3(math::MatSym<dimM> &Kuu, math::Vec<dimM> &Kup, double Kpp, math::Vec<dimM> &Fu, double Fp) {
-  const uint16 dim = 3;
-	assert (getNNodes() * dim == dimM);
-	double *Kuu_p = Kuu.ptr();
-	double *Kup_p = Kup.ptr();
-	double *Fu_p = Fu.ptr();
-  Dof::dofType dofVec[] = {Dof::UX, Dof::UY, Dof::UZ};
-	for (uint16 i=0; i < getNNodes(); i++)
-		for (uint16 di=0; di < dim; di++)
-		for (uint16 j=i; j < getNNodes(); j++)
-			
-				for (uint16 dj=0; dj < dim; dj++)
-				{
-					if ((i==j) && (dj<di)) continue;
-					else
-					{
-						storage->addValueK(nodes[i],dofVec[di],nodes[j], dofVec[dj], *Kuu_p);
-						Kuu_p++;
-					}
-				}
-	//upper diagonal process for nodes-el dofs
-  uint32 elEq = storage->getElementDofEqNumber(getElNum(), Dof::HYDRO_PRESSURE);
-	for (uint16 i=0; i < getNNodes(); i++) {
-		for(uint16 di=0; di < dim; di++) {
-      uint32 rowEq = storage->getNodeDofEqNumber(nodes[i], dofVec[di]);
-      storage->addValueK(rowEq, elEq, *Kup_p);
-      Kup_p++;
+void ElementSOLID81::assemble3(math::MatSym<dimM> &Kuu, math::Vec<dimM> &Kup, double Kpp, math::Vec<dimM> &Fu, double Fp,
+                               ElementMatrices& em) {
+  // local DoFs: UX, UY, UZ of every node followed by HYDRO_PRESSURE element DoF
+  prepareScatter({Dof::UX, Dof::UY, Dof::UZ}, {Dof::HYDRO_PRESSURE});
+  assert(scatterEq.size() == dimM + 1);
+  em.resize(dimM + 1);
+  std::copy(scatterEq.begin(), scatterEq.end(), em.eq.begin());
+  const double *Kuu_p = Kuu.ptr();
+  const double *Kup_p = Kup.ptr();
+  const double *Fu_p = Fu.ptr();
+  double* Ke_p = em.Ke.data();
+  // every row of the upper triangle: nodal DoFs vs nodal DoFs (Kuu), then the row's nodal DoF vs
+  // element DoF (Kup)
+  for (uint16 i = 0; i < dimM; i++) {
+    for (uint16 j = i; j < dimM; j++) {
+      *Ke_p = *Kuu_p;
+      Ke_p++;
+      Kuu_p++;
     }
+    *Ke_p = Kup_p[i];
+    Ke_p++;
   }
-	//upper diagonal process for el-el dofs
-  storage->addValueK(elEq, elEq,  Kpp);
+  // el-el dofs
+  *Ke_p = Kpp;
 
-	for (uint16 i=0; i < getNNodes(); i++) {
-		for (uint16 di=0; di < dim; di++) {
-			storage->addValueF(nodes[i], dofVec[di], *Fu_p);
-			Fu_p++;
-		}
+  for (uint16 i = 0; i < dimM; i++) {
+    em.Fe[i] = Fu_p[i];
+  }
+  em.Fe[dimM] = Fp;
+}
+
+
+template <uint16 dimM>
+void ElementSOLID81::assembleF3(math::Vec<dimM> &Fu, double Fp, ElementMatrices& em) {
+  prepareScatter({Dof::UX, Dof::UY, Dof::UZ}, {Dof::HYDRO_PRESSURE});
+  assert(scatterEq.size() == dimM + 1);
+  em.resizeF(dimM + 1);
+  std::copy(scatterEq.begin(), scatterEq.end(), em.eq.begin());
+  for (uint16 i = 0; i < dimM; i++) {
+    em.Fe[i] = Fu[i];
   }
-  storage->addValueF(elEq, Fp);
+  em.Fe[dimM] = Fp;
 }
 
 } // namespace nla3d
@@ -15,7 +15,18 @@ void ElementTETRA0::pre () {
 }
 
 // here stiffness matrix is built
-void ElementTETRA0::buildK() {
+bool ElementTETRA0::computeK(ElementMatrices& em) {
+  computeKF<true>(em);
+  return true;
+}
+
+bool ElementTETRA0::computeF(ElementMatrices& em) {
+  computeKF<false>(em);
+  return true;
+}
+
+template <bool withK>
+void ElementTETRA0::computeKF(ElementMatrices& em) {
   Eigen::MatrixXd matS(4,4);
   matS.setZero();
   matS<< 1. , storage->getNode(getNodeNumber(0)).pos[0] , storage->getNode(getNodeNumber(0)).pos[1] , storage->getNode(getNodeNumber(0)).pos[2] ,
@@ -41,9 +52,18 @@ void ElementTETRA0::buildK() {
   // fill here matB
   makeB(matB);  
 
-  math::matBTDBprod(matB, matC, vol, matKe);
+  prepareScatter({Dof::UX, Dof::UY, Dof::UZ});
+  bool withFe = !ElementTETRA0::isLinear();
+  if (withK) {
+    math::matBTDBprod(matB, matC, vol, matKe);
+    em.resize(12, withFe);
+    std::copy(matKe.ptr(), matKe.ptr() + em.Ke.size(), em.Ke.begin());
+  } else {
+    em.resizeF(12);
+  }
+  std::copy(scatterEq.begin(), scatterEq.end(), em.eq.begin());
 
-  if ((alpha != 0. && T != 0.) || strains.qlength() != 0. || stress.qlength() != 0.){
+  if (withFe) {
     //node forces calculations
     math::Vec<12> Fe;
     Fe.zero();
@@ -51,32 +71,34 @@ void ElementTETRA0::buildK() {
     math::Mat<12,6> matBTC;
     matBTC = matB.transpose()*matC.toMat();
 
+    //mechanical initial strains
+    math::Vec<6> loadStrains = initialStrains;
+
     //mechanical initial stress
-    if (stress.qlength() != 0.){
-      strains.zero();
+    if (initialStress.qlength() != 0.){
       math::Mat<6,6> matP;
       matP = matC.toMat().inv(matC.toMat().det());
-      strains = matP*stress;
+      loadStrains = loadStrains + matP*initialStress;
     }
     
     //termal initial strains
     if (alpha != 0. && T != 0.){
       //temp node forces
       math::Vec<6> tStrains = {alpha*T,alpha*T,alpha*T,0.,0.,0.};
-      strains = strains + tStrains;
+      loadStrains = loadStrains + tStrains;
     }
 
+    math::matBVprod(matBTC, loadStrains, -vol, Fe);
 
-    //mechanical initial strains
-    math::matBVprod(matBTC, strains, -vol, Fe);
-
-    assembleK(matKe, Fe, {Dof::UX, Dof::UY, Dof::UZ});
-  }
-  else{
-    assembleK(matKe, {Dof::UX, Dof::UY, Dof::UZ});
+    std::copy(Fe.ptr(), Fe.ptr() + 12, em.Fe.begin());
   }
 }
 
+bool ElementTETRA0::isLinear() {
+  return (alpha == 0. || T == 0.) && initialStrains.qlength() == 0. &&
+    initialStress.qlength() == 0.;
+}
+
 // after solution it's handy to calculate stresses, strains and other stuff in elements.
 void ElementTETRA0::update () {
   // matB is strain matrix
@@ -107,6 +129,17 @@ void ElementTETRA0::update () {
   math::matBVprod(matC, strains, 1.0, stress);
 }
 
+void ElementTETRA0::saveState(std::vector<double>& state) {
+  state.insert(state.end(), strains.ptr(), strains.ptr() + 6);
+  state.insert(state.end(), stress.ptr(), stress.ptr() + 6);
+}
+
+const double* ElementTETRA0::restoreState(const double* state) {
+  std::copy(state, state + 6, strains.ptr());
+  std::copy(state + 6, state + 12, stress.ptr());
+  return state + 12;
+}
+
 void ElementTETRA0::makeB(math::Mat<6,12> &B)
 {
     double *B_L = B.ptr();
@@ -21,19 +21,30 @@ public:
 // ElementTETRA::pre () registers Dof::UX, Dof::UY, Dof::UZ as DoFs in every node.
   void pre();
 
-// buildK() - a central point in element class. Here the element should build element stiffness
-// matrix (actually, tangential matrix, as soon as we make non-linear-ready elements). The element
-// also responsible for assembling its local stiffness matrix into global system of equations
-// matrix. Fro this purpose here is a special procedure in base class Element::assemble(..). Also,
-// the element should assemble right hand side (rhs) of equations related to this element
-// (especially used in non-linear analysis).
-  void buildK();
+// computeK() - a central point in element class. Here the element should build element stiffness
+// matrix (actually, tangential matrix, as soon as we make non-linear-ready elements) and right hand
+// side (rhs) of equations related to this element (especially used in non-linear analysis). The
+// matrices are written into `em` buffers, FEStorage is responsible for assembling them into global
+// system of equations.
+  bool computeK(ElementMatrices& em);
+
+// computeF() - the same as computeK() but only the rhs is computed. It's called when FEStorage needs
+// only element loads (see FEStorage::assembleResidual()).
+  bool computeF(ElementMatrices& em);
+
+// isLinear() - true only without thermal and initial strain (stress) loads, which could be changed
+// between assemblies.
+  bool isLinear();
 
 // update() - the function updates internal state of the element based on found solution of
 // global equation system. For example, here you can calculate stresses in the element which depends
 // on found DoFs solution.
   void update();
 
+// saveState(), restoreState() - `strains` and `stress` computed by update() are the element state.
+  void saveState(std::vector<double>& state);
+  const double* restoreState(const double* state);
+
   void makeB (math::Mat<6,12> &B);
   void makeC (math::MatSym<6> &C);
 
@@ -47,6 +58,11 @@ public:
   // temperature
   double T = 0.0;
 
+  // initial strains and stresses (loads of the element, the same components order as in `strains`
+  // and `stress`)
+  math::Vec<6> initialStrains;
+  math::Vec<6> initialStress;
+
   // stresses in the element (calculated after the solving of the global equation system in
   // update() function.
   //stress[M_XX], stress[M_YY], stress[M_ZZ], stress[M_XY], stress[M_YZ], stress[M_XZ]
@@ -60,6 +76,11 @@ public:
   //postproc procedures
   bool getScalar(double* scalar, scalarQuery code, uint16 gp, const double scale);
   bool getTensor(math::MatSym<3>* tensor, tensorQuery code, uint16 gp, const double scale);
+
+private:
+  // element kernel of computeK() (`withK` = true) and computeF() (`withK` = false)
+  template <bool withK>
+  void computeKF(ElementMatrices& em);
 };
 
 } //namespace nla3d
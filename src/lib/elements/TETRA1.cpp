@@ -35,6 +35,10 @@ void ElementTETRA1::buildK() {
   assembleK(matKe, {Dof::TEMP});
 }
 
+bool ElementTETRA1::isLinear() {
+  return true;
+}
+
 void ElementTETRA1::update () {
   math::Mat<3,4> matB;
   matB.zero();
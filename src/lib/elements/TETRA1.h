@@ -14,6 +14,7 @@ public:
   void pre();
 
   void buildK();
+  bool isLinear();
 
   void update();
 
@@ -57,6 +57,10 @@ void ElementTETRA10::makeB (uint16 np, Mat<6,30> &B)
   }
 }
 
+bool ElementTETRA10::isLinear() {
+  return true;
+}
+
 // after solution it's handy to calculate stresses, strains and other stuff in elements.
 void ElementTETRA10::update () {
   // matB is strain matrix
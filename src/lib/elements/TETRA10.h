@@ -18,6 +18,7 @@ class ElementTETRA10 : public ElementIsoParamTETRA10 {
   }
   void pre();
   void buildK();
+  bool isLinear();
   void update();
   void makeB (uint16 nPoint, math::Mat<6,30> &B);
   void makeC (math::MatSym<6> &C);
@@ -48,6 +48,10 @@ void ElementTRIANGLE4::buildK() {
   assembleK(matKe, {Dof::UX, Dof::UY});
 }
 
+bool ElementTRIANGLE4::isLinear() {
+  return true;
+}
+
 // after solution it's handy to calculate stresses, strains and other stuff in elements.
 void ElementTRIANGLE4::update () {
   // matB is strain matrix
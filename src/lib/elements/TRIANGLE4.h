@@ -34,6 +34,7 @@ public:
 // (especially used in non-linear analysis).
 //
   void buildK();
+  bool isLinear();
 // update() - the function updates internal state of the element based on found solution of
 // global equation system. For example, here you can calculate stresses in the element which depends
 // on found DoFs solution.
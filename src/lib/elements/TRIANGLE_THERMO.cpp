@@ -33,6 +33,10 @@ void ElementTRIANGLE_THERMO::buildK() {
   assembleK(matKe, {Dof::TEMP});
 }
 
+bool ElementTRIANGLE_THERMO::isLinear() {
+  return true;
+}
+
 void ElementTRIANGLE_THERMO::update () {
   math::Mat<2,3> matB;
   matB.zero();
@@ -59,6 +59,10 @@ void ElementTRUSS3::buildK() {
   assembleK(Ke, {Dof::UX, Dof::UY, Dof::UZ});
 }
 
+bool ElementTRUSS3::isLinear() {
+  return true;
+}
+
 // after solution it's handy to calculate stresses, strains and other stuff in elements. In this
 // case a truss stress will be restored
 void ElementTRUSS3::update() {
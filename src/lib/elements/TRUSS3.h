@@ -46,6 +46,9 @@ public:
 // (especially used in non-linear analysis).
 // see ElementTRUSS3::buildK() body for more comments on the particular realisation.
   void buildK();
+// isLinear() - small displacements truss without loads: the stiffness matrix depends only on E, A and
+// the node positions.
+  bool isLinear();
 // 4. update() - the function updates internal state of the element based on found solution of
 // global equation system. For example, here you can calculate stresses in the element which depends
 // on found DoFs solution.
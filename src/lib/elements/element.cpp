@@ -6,6 +6,23 @@
 
 namespace nla3d {
 
+void ElementMatrices::resize(uint16 n, bool withFe) {
+  eq.resize(n);
+  Ke.assign(n * (n + 1) / 2, 0.0);
+  if (withFe) {
+    Fe.assign(n, 0.0);
+  } else {
+    Fe.clear();
+  }
+}
+
+
+void ElementMatrices::resizeF(uint16 n) {
+  eq.resize(n);
+  Ke.clear();
+  Fe.assign(n, 0.0);
+}
+
 
 Element::Element () {
 
@@ -13,13 +30,21 @@ Element::Element () {
 
 
 Element::~Element() {
-  if (nodes) {
+  // node numbers of elements of FEStorage are owned by the storage
+  if (storage == nullptr && nodes) {
     delete[] nodes;
     nodes = nullptr;
   }
 }
 
 
+void Element::allocateNodes() {
+  assert(storage == nullptr);
+  nodes = new uint32[getNNodes()];
+  std::fill(nodes, nodes + getNNodes(), 0);
+}
+
+
 void Element::print (std::ostream& out) {
   out << "E " << getElNum() << ":";
   for (uint16 i = 0; i < getNNodes(); i++) {
@@ -29,7 +54,10 @@ void Element::print (std::ostream& out) {
 
 Element& Element::operator= (const Element& from)
 {
-  assert(nodes && from.nodes);
+  assert(from.nodes);
+  if (nodes == nullptr) {
+    allocateNodes();
+  }
   memcpy(nodes, from.nodes, sizeof(uint32)*getNNodes());
   return *this;
 }
@@ -39,24 +67,90 @@ void Element::assembleK(Eigen::Ref<Eigen::MatrixXd> Ke,
                        std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
   assert (Ke.rows() == Ke.cols());
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == Ke.rows());
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueK(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], 
-                Ke.selfadjointView<Eigen::Upper>()(i*dim+di, j*dim +dj));
-          }
-        }
-      }
+  prepareScatter(_nodeDofs);
+  assert (scatterEq.size() == (size_t) Ke.rows());
+
+  // upper triangle of Ke in MatSym order
+  uint16 n = static_cast<uint16> (Ke.rows());
+  std::vector<double> upperKe;
+  upperKe.reserve(n * (n + 1) / 2);
+  for (uint16 i = 0; i < n; i++) {
+    for (uint16 j = i; j < n; j++) {
+      upperKe.push_back(Ke(i, j));
+    }
+  }
+  storage->scatterElementK(getElNum(), n, scatterEq.data(), upperKe.data());
+}
+
+
+void Element::prepareScatter(std::initializer_list<Dof::dofType> _nodeDofs,
+                             std::initializer_list<Dof::dofType> _elementDofs) {
+  uint32 nEq = getNNodes() * _nodeDofs.size() + _elementDofs.size();
+  if (scatterEq.size() == nEq) return;
+
+  scatterEq.clear();
+  scatterEq.reserve(nEq);
+  for (uint16 i = 0; i < getNNodes(); i++) {
+    for (auto dof : _nodeDofs) {
+      scatterEq.push_back(storage->getNodeDofEqNumber(nodes[i], dof));
     }
   }
+  for (auto dof : _elementDofs) {
+    scatterEq.push_back(storage->getElementDofEqNumber(getElNum(), dof));
+  }
+}
+
+
+void Element::clearScatter() {
+  scatterEq.clear();
+  scatterEq.shrink_to_fit();
+}
+
+
+bool Element::computeK(ElementMatrices&) {
+  return false;
+}
+
+
+bool Element::computeKBatch(Element**, uint16, ElementMatrices*) {
+  return false;
+}
+
+
+bool Element::computeF(ElementMatrices& em) {
+  return computeK(em);
+}
+
+
+bool Element::computeFBatch(Element**, uint16, ElementMatrices*) {
+  return false;
+}
+
+
+void Element::buildK() {
+  ElementMatrices em;
+  if (!computeK(em)) {
+    LOG(FATAL) << "buildK is not implemented";
+  }
+  uint16 n = static_cast<uint16> (em.eq.size());
+  storage->scatterElementK(getElNum(), n, em.eq.data(), em.Ke.data());
+  if (em.Fe.size()) {
+    storage->scatterElementF(getElNum(), n, em.eq.data(), em.Fe.data());
+  }
+}
+
+
+bool Element::isLinear() {
+  return false;
+}
+
+
+void Element::saveState(std::vector<double>& /*state*/) {
+}
+
+
+const double* Element::restoreState(const double* state) {
+  return state;
 }
 
 
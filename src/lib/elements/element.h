@@ -78,6 +78,25 @@ static const uint16 _shape_nnodes[] = {
 };
 
 
+// Local matrices of an element filled by element kernel (see Element::computeK()). Local DoFs are
+// numbered as in Element::prepareScatter(): DoFs of every node (node by node) followed by element
+// DoFs.
+struct ElementMatrices {
+  // set number of local DoFs and fill matrices with zeros. `withFe` = false means that the element
+  // doesn't contribute to the rhs.
+  void resize(uint16 n, bool withFe = true);
+  // set number of local DoFs and fill Fe with zeros, Ke is left empty (see Element::computeF())
+  void resizeF(uint16 n);
+
+  // global equation numbers of local DoFs
+  std::vector<uint32> eq;
+  // upper triangle of the element stiffness matrix in MatSym order: (0,0), (0,1), .., (n-1,n-1)
+  std::vector<double> Ke;
+  // element rhs (internal loads), empty if the element doesn't contribute to the rhs
+  std::vector<double> Fe;
+};
+
+
 // Element base class
 // All FE should be derived from that class. The class provide interface for building stiffness,
 // damping and inertia matrices (methods buildK(), buildC(), buildM()), for get element results
@@ -110,10 +129,42 @@ class Element {
     // heart of the element class
     // TODO: comment massively here
     virtual void pre()=0;
-    virtual void buildK()=0;
+    // Element kernel: compute local stiffness matrix and rhs into `em` buffers without touching
+    // global matrices. The scatter of `em` into global equations system is done by FEStorage (see
+    // FEStorage::assembleGlobalEqMatrices()). Returns false if the element doesn't provide the
+    // kernel, in this case FEStorage calls buildK().
+    virtual bool computeK(ElementMatrices& em);
+    // Batched element kernel: compute local matrices of `n` (up to math::BATCH_LANES) elements
+    // batch[0] .. batch[n-1] of the same type as this one (`this` is batch[0]) into em[0] ..
+    // em[n-1]. The results should be the same as computeK() gives for every element. Returns false
+    // if the element doesn't provide the kernel, in this case FEStorage assembles the elements one
+    // by one.
+    virtual bool computeKBatch(Element** batch, uint16 n, ElementMatrices* em);
+    // Element kernel for the rhs only: fill em.eq and em.Fe as computeK() does, em.Ke may be left
+    // empty. It's used when only internal loads are needed (see FEStorage::assembleResidual()), so
+    // the element can skip computation of the stiffness matrix. Default implementation is a wrapper
+    // over computeK().
+    virtual bool computeF(ElementMatrices& em);
+    // Batched version of computeF() (see computeKBatch()). Returns false if the element doesn't
+    // provide the kernel.
+    virtual bool computeFBatch(Element** batch, uint16 n, ElementMatrices* em);
+    // Compute local stiffness matrix and rhs and add them into global equations system. Default
+    // implementation is a wrapper over computeK().
+    virtual void buildK();
+    // Returns true if local stiffness matrix and rhs of the element are constant: they don't depend
+    // on the solution, time or element state changed by update(). FEStorage computes them once and
+    // reuses for next assemblies (see FEStorage::setElementCache()). Nonlinear elements shouldn't
+    // override it.
+    virtual bool isLinear();
     virtual void buildC();
     virtual void buildM();
     virtual void update()=0;
+    // Save solution state of the element which isn't kept in IntPointArena (values written by
+    // update()) by appending it to `state`, restoreState() reads the same values starting from
+    // `state` and returns the pointer past them (see FEStorage::saveElementStates()). Default
+    // implementations do nothing.
+    virtual void saveState(std::vector<double>& state);
+    virtual const double* restoreState(const double* state);
 
     // The methods below are getters to receive solution information related to elements (like
     // stresses, strains, volume and so on). The first argument is a pointer on return value. Please
@@ -136,7 +187,7 @@ class Element {
     void print (std::ostream& out);
 
     // some general purpose assemble procedures. Particular element realization could have it own
-    // assembly procedure.
+    // assembly procedure (preferably based on FEStorage::scatterElement[K/C/M/F]()).
     template <uint16 dimM>
     void assembleK(math::MatSym<dimM> &Ke, std::initializer_list<Dof::dofType> _nodeDofs);
     template <uint16 dimM>
@@ -152,11 +203,24 @@ class Element {
 
     friend class FEStorage;
   protected:
+    // Fill `scatterEq` with global equation numbers of the element's local DoFs: `_nodeDofs` of
+    // every node (node by node) followed by `_elementDofs`. The numbers are found once (on the first
+    // call after FEStorage::initSolutionData()), next calls do nothing.
+    void prepareScatter(std::initializer_list<Dof::dofType> _nodeDofs,
+                        std::initializer_list<Dof::dofType> _elementDofs = {});
+    void clearScatter();
+    // allocate own array of node numbers for the element which doesn't belong to FEStorage yet
+    void allocateNodes();
+
+    // scatterEq[i] - equation number of i-th local DoF
+    std::vector<uint32> scatterEq;
 
     ElementType type = ElementType::UNDEFINED;
     ElementShape shape = ElementShape::UNDEFINED;
     uint16 intOrder = 0; // number of int points overall
     uint32 elNum = 0;
+    // node numbers of the element. For elements of FEStorage the pointer refers to the storage's
+    // connectivity array (see FEStorage::bindElementNodes()), otherwise the element owns the array.
     uint32 *nodes = nullptr;
     FEStorage* storage = nullptr;
 };
@@ -167,7 +231,6 @@ class ElementVERTEX : public Element {
   public:
     ElementVERTEX() {
       shape = ElementShape::VERTEX;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementVERTEX& operator= (const ElementVERTEX& from) {
@@ -180,7 +243,6 @@ class ElementTWIN_VERTEX : public Element {
   public:
     ElementTWIN_VERTEX() {
       shape = ElementShape::TWIN_VERTEX;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementTWIN_VERTEX& operator= (const ElementTWIN_VERTEX& from) {
@@ -193,7 +255,6 @@ class ElementLINE : public Element {
   public:
     ElementLINE() {
       shape = ElementShape::LINE;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementLINE& operator= (const ElementLINE& from) {
@@ -206,7 +267,6 @@ class ElementTRIANGLE : public Element {
   public:
     ElementTRIANGLE() {
       shape = ElementShape::TRIANGLE;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementTRIANGLE& operator= (const ElementTRIANGLE& from) {
@@ -220,7 +280,6 @@ class ElementQUAD : public Element {
   public:
     ElementQUAD () {
       shape = ElementShape::QUAD;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementQUAD& operator= (const ElementQUAD& from) {
@@ -234,7 +293,6 @@ class ElementTETRA : public Element {
   public:
     ElementTETRA() {
       shape = ElementShape::TETRA;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementTETRA& operator= (const ElementTETRA& from) {
@@ -247,7 +305,6 @@ class ElementQUADTETRA : public Element {
   public:
     ElementQUADTETRA() {
       shape = ElementShape::QUADRATIC_TETRA;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementQUADTETRA& operator= (const ElementQUADTETRA& from) {
@@ -261,7 +318,6 @@ class ElementHEXAHEDRON : public Element {
   public:
     ElementHEXAHEDRON() {
       shape = ElementShape::HEXAHEDRON;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementHEXAHEDRON& operator= (const ElementHEXAHEDRON& from) {
@@ -275,7 +331,6 @@ class ElementWEDGE : public Element {
   public:
     ElementWEDGE() {
       shape = ElementShape::WEDGE;
-      nodes = new uint32[getNNodes()];
     }
 
     ElementWEDGE& operator= (const ElementWEDGE& from) {
@@ -294,108 +349,37 @@ namespace nla3d {
 template <uint16 dimM>
 void Element::assembleK(math::MatSym<dimM> &Ke, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Ke_p = Ke.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueK(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Ke_p);
-            Ke_p++;
-          }
-        }
-      }
-    }
-  }
+  prepareScatter(_nodeDofs);
+  assert (scatterEq.size() == dimM);
+  storage->scatterElementK(getElNum(), dimM, scatterEq.data(), Ke.ptr());
 }
 
 
 template <uint16 dimM>
 void Element::assembleC(math::MatSym<dimM> &Ce, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Ce_p = Ce.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueC(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Ce_p);
-            Ce_p++;
-          }
-        }
-      }
-    }
-  }
+  prepareScatter(_nodeDofs);
+  assert (scatterEq.size() == dimM);
+  storage->scatterElementC(getElNum(), dimM, scatterEq.data(), Ce.ptr());
 }
 
 
 template <uint16 dimM>
 void Element::assembleM(math::MatSym<dimM> &Me, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Me_p = Me.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueC(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Me_p);
-            Me_p++;
-          }
-        }
-      }
-    }
-  }
+  prepareScatter(_nodeDofs);
+  assert (scatterEq.size() == dimM);
+  storage->scatterElementM(getElNum(), dimM, scatterEq.data(), Me.ptr());
 }
 
 
 template <uint16 dimM>
 void Element::assembleK(math::MatSym<dimM> &Ke, math::Vec<dimM> &Fe, std::initializer_list<Dof::dofType> _nodeDofs) {
   assert (nodes != NULL);
-  double* Ke_p = Ke.ptr();
-  std::vector<Dof::dofType> nodeDof(_nodeDofs);
-  uint16 dim = static_cast<uint16> (_nodeDofs.size());
-  assert (getNNodes() * dim == dimM);
-
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-      for (uint16 j=i; j < getNNodes(); j++) {
-        for (uint16 dj=0; dj < dim; dj++) {
-          if ((i==j) && (dj<di)) {
-            continue;
-          } else {
-            storage->addValueK(nodes[i], nodeDof[di], nodes[j], nodeDof[dj], *Ke_p);
-            Ke_p++;
-          }
-        }
-      }
-    }
-  }
-
-  double* Fe_p = Fe.ptr();
-  for (uint16 i=0; i < getNNodes(); i++) {
-    for (uint16 di=0; di < dim; di++) {
-            storage->addValueF(nodes[i], nodeDof[di], *Fe_p);
-            Fe_p++;
-    }
-  }
+  prepareScatter(_nodeDofs);
+  assert (scatterEq.size() == dimM);
+  storage->scatterElementK(getElNum(), dimM, scatterEq.data(), Ke.ptr());
+  storage->scatterElementF(getElNum(), dimM, scatterEq.data(), Fe.ptr());
 }
 
 
@@ -423,7 +407,9 @@ inline ElementType Element::getType() {
 // el->getNodeNumber(0) = 1234;
 inline uint32& Element::getNodeNumber(uint16 num) {
   assert(num < getNNodes());
-  assert(nodes);
+  if (nodes == nullptr) {
+    allocateNodes();
+  }
   return nodes[num];
 }
 
@@ -9,6 +9,69 @@
 
 namespace nla3d {
 
+namespace {
+
+// Form functions and their derivatives (vs. local coordinates) of the reference element in the
+// quadrature points of every integration order: N[i_int][np], dN[i_int][np]. They don't depend on
+// the element geometry, so they are computed once for all elements of the shape instead of in every
+// makeJacob() call.
+template <uint16 nodes_num, uint16 dim>
+struct RefShapeTable {
+  std::vector<math::Vec<nodes_num> > N[3];
+  std::vector<math::Mat<nodes_num, dim> > dN[3];
+};
+
+
+// tables are filled on the first call (initialization of a function-local static is thread safe)
+const RefShapeTable<4, 2>& quadTable() {
+  static const RefShapeTable<4, 2> table = [] {
+    RefShapeTable<4, 2> t;
+    for (uint16 i_int = 0; i_int < 3; i_int++) {
+      for (uint16 np = 0; np < _np_quad[i_int]; np++) {
+        const QuadPt2D& q = _table_quad[i_int][np];
+        t.N[i_int].push_back(ElementIsoParamQUAD::formFunc(q.r, q.s));
+        t.dN[i_int].push_back(ElementIsoParamQUAD::formFuncDeriv(q.r, q.s));
+      }
+    }
+    return t;
+  }();
+  return table;
+}
+
+
+const RefShapeTable<8, 3>& hexahedronTable() {
+  static const RefShapeTable<8, 3> table = [] {
+    RefShapeTable<8, 3> t;
+    for (uint16 i_int = 0; i_int < 3; i_int++) {
+      for (uint16 np = 0; np < _np_hexahedron[i_int]; np++) {
+        const QuadPt3D& q = _table_hexahedron[i_int][np];
+        t.N[i_int].push_back(ElementIsoParamHEXAHEDRON::formFunc(q.r, q.s, q.t));
+        t.dN[i_int].push_back(ElementIsoParamHEXAHEDRON::formFuncDeriv(q.r, q.s, q.t));
+      }
+    }
+    return t;
+  }();
+  return table;
+}
+
+
+const RefShapeTable<10, 4>& tetra10Table() {
+  static const RefShapeTable<10, 4> table = [] {
+    RefShapeTable<10, 4> t;
+    for (uint16 i_int = 0; i_int < 3; i_int++) {
+      for (uint16 np = 0; np < _np_tetra[i_int]; np++) {
+        const QuadVol3D& q = _table_tetra[i_int][np];
+        t.N[i_int].push_back(ElementIsoParamTETRA10::formFunc(q.l1, q.l2, q.l3, q.l4));
+        t.dN[i_int].push_back(ElementIsoParamTETRA10::formFuncDeriv(q.l1, q.l2, q.l3, q.l4));
+      }
+    }
+    return t;
+  }();
+  return table;
+}
+
+} // anonymous namespace
+
 
 void ElementIsoParamLINE::makeJacob() {
   const uint16 dim = 2;
@@ -65,29 +128,32 @@ void ElementIsoParamQUAD::makeJacob() {
 
   math::Mat<dim, dim> Jacob; //Jacob inv matrix
 
-  det.clear();
-  det.assign(_np_quad[i_int], 0.0);
-
-  NiXj.clear();
-  NiXj.resize(_np_quad[i_int]);
+  // integration point data are kept in the storage's arena
+  IntPointArena& arena = storage->getIntPointArena();
+  det.assign(arena, (uint16) type, IP_DET, _np_quad[i_int], 0.0);
+  NiXj.assign(arena, (uint16) type, IP_NIXJ, _np_quad[i_int], math::Mat<nodes_num, dim>());
 
   double inv_det;
 
-  math::Mat<nodes_num, dim> dN; // form function derivatives
   math::Mat<dim, dim> J;
 
+  const RefShapeTable<nodes_num, dim>& ref = quadTable();
+  math::Vec<3> pos[nodes_num];
+  for (uint16 nod = 0; nod < nodes_num; nod++) {
+    pos[nod] = storage->getNode(getNodeNumber(nod)).pos;
+  }
+
 
   for (uint16 np=0; np < _np_quad[i_int]; np++) {
-    QuadPt2D q = _table_quad[i_int][np];
-    dN = formFuncDeriv(q.r, q.s);
+    // form function derivatives
+    const math::Mat<nodes_num, dim>& dN = ref.dN[i_int][np];
 
     J.zero();
 
     for (uint16 nod = 0; nod < nodes_num; nod++) {
-      math::Vec<3> pos = storage->getNode(getNodeNumber(nod)).pos;
       for (uint16 i = 0; i < dim; i++)
         for (uint16 j = 0; j < dim; j++)
-          J[i][j] += dN[nod][i] * pos[j];
+          J[i][j] += dN[nod][i] * pos[nod][j];
     }
 
     det[np] = J.det(); // determinant of Jacob matrix
@@ -115,8 +181,7 @@ math::Vec<4> ElementIsoParamQUAD::formFunc(double r, double s) {
 
 
 math::Vec<4> ElementIsoParamQUAD::formFunc(uint16 np) {
-  QuadPt2D q = _table_quad[i_int][np];
-  return formFunc(q.r, q.s);
+  return quadTable().N[i_int][np];
 }
 
 
@@ -148,28 +213,31 @@ void ElementIsoParamHEXAHEDRON::makeJacob() {
 
   math::Mat<dim, dim> Jacob; //Jacob inv matrix
 
-  det.clear();
-  det.assign(_np_hexahedron[i_int], 0.0);
-
-  NiXj.clear();
-  NiXj.resize(_np_hexahedron[i_int]);
+  // integration point data are kept in the storage's arena
+  IntPointArena& arena = storage->getIntPointArena();
+  det.assign(arena, (uint16) type, IP_DET, _np_hexahedron[i_int], 0.0);
+  NiXj.assign(arena, (uint16) type, IP_NIXJ, _np_hexahedron[i_int], math::Mat<nodes_num, dim>());
 
   double inv_det;
 
-  math::Mat<nodes_num, dim> dN; // form function derivatives
   math::Mat<dim, dim> J;
 
+  const RefShapeTable<nodes_num, dim>& ref = hexahedronTable();
+  math::Vec<3> pos[nodes_num];
+  for (uint16 nod = 0; nod < nodes_num; nod++) {
+    pos[nod] = storage->getNode(getNodeNumber(nod)).pos;
+  }
+
   for (uint16 np=0; np < _np_hexahedron[i_int]; np++) {
-    QuadPt3D q = _table_hexahedron[i_int][np];
-    dN = formFuncDeriv(q.r, q.s, q.t);
+    // form function derivatives
+    const math::Mat<nodes_num, dim>& dN = ref.dN[i_int][np];
 
     J.zero();
 
     for (uint16 nod = 0; nod < nodes_num; nod++) {
-      math::Vec<3> pos = storage->getNode(getNodeNumber(nod)).pos;
       for (uint16 i = 0; i < dim; i++)
         for (uint16 j = 0; j < dim; j++)
-          J[i][j] += dN[nod][i] * pos[j];
+          J[i][j] += dN[nod][i] * pos[nod][j];
     }
 
     det[np] = J.det(); // determinant of Jacob matrix
@@ -203,8 +271,7 @@ math::Vec<8> ElementIsoParamHEXAHEDRON::formFunc(double r, double s, double t) {
 
 
 math::Vec<8> ElementIsoParamHEXAHEDRON::formFunc(uint16 np) {
-  QuadPt3D q = _table_hexahedron[i_int][np];
-  return formFunc(q.r, q.s, q.t);
+  return hexahedronTable().N[i_int][np];
 }
 
 
@@ -240,31 +307,34 @@ void ElementIsoParamTETRA10::makeJacob() {
 
   math::Mat<dim, dim> Jacob; //Jacob inv matrix
 
-  det.clear();
-  det.assign(_np_tetra[i_int], 0.0);
-
-  NiXj.clear();
-  NiXj.resize(_np_tetra[i_int]);
+  // integration point data are kept in the storage's arena
+  IntPointArena& arena = storage->getIntPointArena();
+  det.assign(arena, (uint16) type, IP_DET, _np_tetra[i_int], 0.0);
+  NiXj.assign(arena, (uint16) type, IP_NIXJ, _np_tetra[i_int], math::Mat<nodes_num, dim>());
 
   double inv_det;
 
-  math::Mat<nodes_num, dim> dN; // form function derivatives
   math::Mat<dim, dim> J;
 
+  const RefShapeTable<nodes_num, dim>& ref = tetra10Table();
+  math::Vec<3> pos[nodes_num];
+  for (uint16 nod = 0; nod < nodes_num; nod++) {
+    pos[nod] = storage->getNode(getNodeNumber(nod)).pos;
+  }
+
   for (uint16 np=0; np < _np_tetra[i_int]; np++) {
-    QuadVol3D q = _table_tetra[i_int][np];
-    dN = formFuncDeriv(q.l1, q.l2, q.l3, q.l4);
+    // form function derivatives
+    const math::Mat<nodes_num, dim>& dN = ref.dN[i_int][np];
 
     J.zero();
 
     for (uint16 nod = 0; nod < nodes_num; nod++) {
-      math::Vec<3> pos = storage->getNode(getNodeNumber(nod)).pos;
       for (uint16 j = 0; j < dim; j++) {
           J[0][j] += 1;
       }
       for (uint16 i = 1; i < dim; i++)
         for (uint16 j = 0; j < dim; j++)
-          J[i][j] += dN[nod][i] * pos[j];
+          J[i][j] += dN[nod][i] * pos[nod][j];
     }
 
     det[np] = J.det(); // determinant of Jacob matrix
@@ -299,8 +369,7 @@ math::Vec<10> ElementIsoParamTETRA10::formFunc(double l1, double l2, double l3,
 
 
 math::Vec<10> ElementIsoParamTETRA10::formFunc(uint16 np) {
-  QuadVol3D q = _table_tetra[i_int][np];
-  return formFunc(q.l1, q.l2, q.l3, q.l4);
+  return tetra10Table().N[i_int][np];
 }
 
 
@@ -4,6 +4,7 @@
 
 #pragma once
 #include "sys.h"
+#include "IntPointArena.h"
 
 // Formulations for isoparametric FE for different shapes. Isoparametic formulation means usage of the
 // same shape functions for geometry interpolation and for field (displacement, for instance)
@@ -264,8 +265,8 @@ class ElementIsoParamLINE : public ElementLINE {
 
 class ElementIsoParamQUAD : public ElementQUAD {
   public:
-    std::vector<math::Mat<4, 2> > NiXj; //derivates form function / local coordinates
-    std::vector<double> det;  //Jacobian
+    IntPointArray<math::Mat<4, 2> > NiXj; //derivates form function / local coordinates
+    IntPointArray<double> det;  //Jacobian
 
     double sideDet[4]; //Jacobian for side integration
 
@@ -277,10 +278,10 @@ class ElementIsoParamQUAD : public ElementQUAD {
     uint16 nOfIntPoints();
 
     // get form function values in local point (r, s)
-    math::Vec<4> formFunc(double r, double s);
+    static math::Vec<4> formFunc(double r, double s);
     // get form function values in integration point np
     math::Vec<4> formFunc(uint16 np);
-    math::Mat<4, 2> formFuncDeriv(double r, double s);
+    static math::Mat<4, 2> formFuncDeriv(double r, double s);
 
   protected:
     uint16 i_int = 0; // index of integration scheme
@@ -288,8 +289,8 @@ class ElementIsoParamQUAD : public ElementQUAD {
 
 class ElementIsoParamTETRA10 : public ElementQUADTETRA {
   public:
-    std::vector<math::Mat<10, 4> > NiXj; //derivates form function / local coordinates
-    std::vector<double> det;  //Jacobian
+    IntPointArray<math::Mat<10, 4> > NiXj; //derivates form function / local coordinates
+    IntPointArray<double> det;  //Jacobian
 
     // function to calculate all staff for isoparametric FE
     void makeJacob(); 
@@ -298,11 +299,11 @@ class ElementIsoParamTETRA10 : public ElementQUADTETRA {
     void np2rst(uint16 np, double *xi); //by number of gauss point find local coordinates
     uint16 nOfIntPoints();
     // get form function values in local point (l1, l2, l3, l4)
-    math::Vec<10> formFunc(double l1, double l2, double l3, double l4);
+    static math::Vec<10> formFunc(double l1, double l2, double l3, double l4);
     // get form function values in integration point np
     math::Vec<10> formFunc(uint16 np);
     // get form function derivatives (vs. r,s,t) in local point (l1,l2,l3,l4)
-    math::Mat<10, 4> formFuncDeriv(double l1, double l2, double l3, double l4);
+    static math::Mat<10, 4> formFuncDeriv(double l1, double l2, double l3, double l4);
 
   protected:
     uint16 i_int = 0; // index of integration scheme
@@ -310,8 +311,8 @@ class ElementIsoParamTETRA10 : public ElementQUADTETRA {
 
 class ElementIsoParamHEXAHEDRON : public ElementHEXAHEDRON {
   public:
-    std::vector<math::Mat<8, 3> > NiXj; //derivates form function / local coordinates
-    std::vector<double> det;  //Jacobian
+    IntPointArray<math::Mat<8, 3> > NiXj; //derivates form function / local coordinates
+    IntPointArray<double> det;  //Jacobian
 
     // function to calculate all staff for isoparametric FE
     void makeJacob(); 
@@ -320,11 +321,11 @@ class ElementIsoParamHEXAHEDRON : public ElementHEXAHEDRON {
     void np2rst(uint16 np, double *xi); //by number of gauss point find local coordinates
     uint16 nOfIntPoints();
     // get form function values in local point (r, s, t)
-    math::Vec<8> formFunc(double r, double s, double t);
+    static math::Vec<8> formFunc(double r, double s, double t);
     // get form function values in integration point np
     math::Vec<8> formFunc(uint16 np);
     // get form function derivatives (vs. r,s,t) in local point (r,s,t)
-    math::Mat<8, 3> formFuncDeriv(double r, double s, double t);
+    static math::Mat<8, 3> formFuncDeriv(double r, double s, double t);
 
   protected:
     uint16 i_int = 0; // index of integration scheme
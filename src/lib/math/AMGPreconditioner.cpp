@@ -0,0 +1,572 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/AMGPreconditioner.h"
+
+namespace nla3d {
+
+namespace math {
+
+void AMGPreconditioner::setNearNullSpace(uint16 nModes, const std::vector<double>& modes,
+                                         const std::vector<uint32>& nodes) {
+  CHECK(modes.size() == (size_t) nModes * nodes.size());
+  nullSpaceModes = nModes;
+  nullSpace = modes;
+  nullSpaceNodes = nodes;
+}
+
+
+void AMGPreconditioner::setStrengthThreshold(double _theta) {
+  CHECK(_theta >= 0.0);
+  theta = _theta;
+}
+
+
+void AMGPreconditioner::setCoarseSize(uint32 _coarseSize) {
+  coarseSize = _coarseSize;
+}
+
+
+void AMGPreconditioner::setMaxLevels(uint16 _maxLevels) {
+  CHECK(_maxLevels > 0);
+  maxLevels = _maxLevels;
+}
+
+
+uint16 AMGPreconditioner::nLevels() {
+  return static_cast<uint16>(levels.size());
+}
+
+
+double AMGPreconditioner::getOperatorComplexity() {
+  if (levels.size() == 0 || levels[0].A.values.size() == 0) return 0.0;
+  double nnz = 0.0;
+  for (auto& level : levels) {
+    nnz += level.A.values.size();
+  }
+  return nnz / levels[0].A.values.size();
+}
+
+
+void AMGPreconditioner::fromSymMatrix(SparseSymMatrix* matrix, CsrMatrix& A) {
+  uint32 n = matrix->nRows();
+  CsrIndexArrays csr(*matrix->getSparsityInfo());
+  const uint32* iofeir = csr.iofeir;
+  const uint32* columns = csr.columns;
+  const double* values = matrix->getValuesArray();
+
+  A.nRows = n;
+  A.nColumns = n;
+  A.iofeir.assign(n + 1, 0);
+  // NOTE: SparseSymMatrix arrays are 1-based
+  for (uint32 i = 0; i < n; i++) {
+    for (uint32 p = iofeir[i] - 1; p < iofeir[i + 1] - 1; p++) {
+      uint32 j = columns[p] - 1;
+      A.iofeir[i + 1]++;
+      if (j != i) A.iofeir[j + 1]++;
+    }
+  }
+  for (uint32 i = 0; i < n; i++) {
+    A.iofeir[i + 1] += A.iofeir[i];
+  }
+  A.columns.resize(A.iofeir[n]);
+  A.values.resize(A.iofeir[n]);
+  // rows are visited in increasing order, so columns in every row come out sorted
+  std::vector<uint32> next(A.iofeir.begin(), A.iofeir.end() - 1);
+  for (uint32 i = 0; i < n; i++) {
+    for (uint32 p = iofeir[i] - 1; p < iofeir[i + 1] - 1; p++) {
+      uint32 j = columns[p] - 1;
+      A.columns[next[i]] = j;
+      A.values[next[i]++] = values[p];
+      if (j != i) {
+        A.columns[next[j]] = i;
+        A.values[next[j]++] = values[p];
+      }
+    }
+  }
+}
+
+
+void AMGPreconditioner::transpose(const CsrMatrix& A, CsrMatrix& AT) {
+  AT.nRows = A.nColumns;
+  AT.nColumns = A.nRows;
+  AT.iofeir.assign(AT.nRows + 1, 0);
+  for (auto j : A.columns) {
+    AT.iofeir[j + 1]++;
+  }
+  for (uint32 i = 0; i < AT.nRows; i++) {
+    AT.iofeir[i + 1] += AT.iofeir[i];
+  }
+  AT.columns.resize(A.columns.size());
+  AT.values.resize(A.values.size());
+  std::vector<uint32> next(AT.iofeir.begin(), AT.iofeir.end() - 1);
+  for (uint32 i = 0; i < A.nRows; i++) {
+    for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+      uint32 q = next[A.columns[p]]++;
+      AT.columns[q] = i;
+      AT.values[q] = A.values[p];
+    }
+  }
+}
+
+
+void AMGPreconditioner::multiply(const CsrMatrix& A, const CsrMatrix& B, CsrMatrix& AB) {
+  CHECK(A.nColumns == B.nRows);
+  AB.nRows = A.nRows;
+  AB.nColumns = B.nColumns;
+  AB.iofeir.assign(AB.nRows + 1, 0);
+  AB.columns.clear();
+  AB.values.clear();
+
+  // Gustavson's algorithm with dense accumulator
+  std::vector<int64> marker(B.nColumns, -1);
+  for (uint32 i = 0; i < A.nRows; i++) {
+    uint32 rowStart = static_cast<uint32>(AB.columns.size());
+    for (uint32 pa = A.iofeir[i]; pa < A.iofeir[i + 1]; pa++) {
+      uint32 k = A.columns[pa];
+      double aik = A.values[pa];
+      for (uint32 pb = B.iofeir[k]; pb < B.iofeir[k + 1]; pb++) {
+        uint32 j = B.columns[pb];
+        if (marker[j] < rowStart) {
+          marker[j] = AB.columns.size();
+          AB.columns.push_back(j);
+          AB.values.push_back(aik * B.values[pb]);
+        } else {
+          AB.values[marker[j]] += aik * B.values[pb];
+        }
+      }
+    }
+    AB.iofeir[i + 1] = static_cast<uint32>(AB.columns.size());
+  }
+}
+
+
+void AMGPreconditioner::residual(const CsrMatrix& A, const double* x, const double* b,
+                                 double* r) {
+  for (uint32 i = 0; i < A.nRows; i++) {
+    double ri = b[i];
+    for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+      ri -= A.values[p] * x[A.columns[p]];
+    }
+    r[i] = ri;
+  }
+}
+
+
+uint32 AMGPreconditioner::aggregate(Level& level, std::vector<uint32>& blockAggregate) {
+  const CsrMatrix& A = level.A;
+  uint32 nBlocks = level.nBlocks;
+
+  // equations of every block
+  std::vector<uint32> blockStart(nBlocks + 1, 0);
+  std::vector<uint32> blockEqs(A.nRows);
+  for (auto b : level.blocks) {
+    blockStart[b + 1]++;
+  }
+  for (uint32 b = 0; b < nBlocks; b++) {
+    blockStart[b + 1] += blockStart[b];
+  }
+  std::vector<uint32> next(blockStart.begin(), blockStart.end() - 1);
+  for (uint32 i = 0; i < A.nRows; i++) {
+    blockEqs[next[level.blocks[i]]++] = i;
+  }
+
+  // squared Frobenius norms of diagonal blocks
+  std::vector<double> diagNorm(nBlocks, 0.0);
+  for (uint32 i = 0; i < A.nRows; i++) {
+    for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+      if (level.blocks[A.columns[p]] == level.blocks[i]) {
+        diagNorm[level.blocks[i]] += A.values[p] * A.values[p];
+      }
+    }
+  }
+
+  // strong connections between blocks
+  std::vector<uint32> strongStart(nBlocks + 1, 0);
+  std::vector<uint32> strong;
+  std::vector<double> acc(nBlocks, 0.0);
+  std::vector<uint32> touched;
+  for (uint32 bi = 0; bi < nBlocks; bi++) {
+    touched.clear();
+    for (uint32 q = blockStart[bi]; q < blockStart[bi + 1]; q++) {
+      uint32 i = blockEqs[q];
+      for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+        uint32 bj = level.blocks[A.columns[p]];
+        if (bj == bi) continue;
+        if (acc[bj] == 0.0) touched.push_back(bj);
+        acc[bj] += A.values[p] * A.values[p] + 1.0e-300;
+      }
+    }
+    for (auto bj : touched) {
+      if (acc[bj] > theta * theta * sqrt(diagNorm[bi] * diagNorm[bj])) {
+        strong.push_back(bj);
+      }
+      acc[bj] = 0.0;
+    }
+    strongStart[bi + 1] = static_cast<uint32>(strong.size());
+  }
+
+  const uint32 none = 0xFFFFFFFF;
+  blockAggregate.assign(nBlocks, none);
+  uint32 nAggregates = 0;
+
+  // pass 1: a block with all strong neighbours not aggregated yet forms a new aggregate together
+  // with its neighbours
+  for (uint32 bi = 0; bi < nBlocks; bi++) {
+    if (blockAggregate[bi] != none) continue;
+    bool free = true;
+    for (uint32 p = strongStart[bi]; p < strongStart[bi + 1] && free; p++) {
+      free = (blockAggregate[strong[p]] == none);
+    }
+    if (!free) continue;
+    blockAggregate[bi] = nAggregates;
+    for (uint32 p = strongStart[bi]; p < strongStart[bi + 1]; p++) {
+      blockAggregate[strong[p]] = nAggregates;
+    }
+    nAggregates++;
+  }
+
+  // pass 2: attach the rest blocks to a neighbouring aggregate from pass 1
+  std::vector<uint32> pass1 = blockAggregate;
+  for (uint32 bi = 0; bi < nBlocks; bi++) {
+    if (blockAggregate[bi] != none) continue;
+    for (uint32 p = strongStart[bi]; p < strongStart[bi + 1]; p++) {
+      if (pass1[strong[p]] != none) {
+        blockAggregate[bi] = pass1[strong[p]];
+        break;
+      }
+    }
+  }
+
+  // pass 3: the rest blocks (if any) form aggregates with not aggregated neighbours
+  for (uint32 bi = 0; bi < nBlocks; bi++) {
+    if (blockAggregate[bi] != none) continue;
+    blockAggregate[bi] = nAggregates;
+    for (uint32 p = strongStart[bi]; p < strongStart[bi + 1]; p++) {
+      if (blockAggregate[strong[p]] == none) {
+        blockAggregate[strong[p]] = nAggregates;
+      }
+    }
+    nAggregates++;
+  }
+  return nAggregates;
+}
+
+
+double AMGPreconditioner::estimateSpectralRadius(Level& level) {
+  // power iterations for D^-1 * A
+  const CsrMatrix& A = level.A;
+  uint32 n = A.nRows;
+  std::vector<double> x(n), y(n);
+  for (uint32 i = 0; i < n; i++) {
+    x[i] = 1.0 + (i % 7);
+  }
+  double rho = 0.0;
+  for (uint16 it = 0; it < 15; it++) {
+    double normX = 0.0;
+    double normY = 0.0;
+    for (uint32 i = 0; i < n; i++) {
+      double yi = 0.0;
+      for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+        yi += A.values[p] * x[A.columns[p]];
+      }
+      y[i] = yi / A.values[level.diagPos[i]];
+      normX += x[i] * x[i];
+      normY += y[i] * y[i];
+    }
+    if (normY == 0.0) break;
+    rho = sqrt(normY / normX);
+    double scale = 1.0 / sqrt(normY);
+    for (uint32 i = 0; i < n; i++) {
+      x[i] = y[i] * scale;
+    }
+  }
+  return rho;
+}
+
+
+void AMGPreconditioner::buildProlongator(Level& level, Level& coarse) {
+  const CsrMatrix& A = level.A;
+  uint32 n = A.nRows;
+  uint16 k = level.nModes;
+
+  std::vector<uint32> blockAggregate;
+  uint32 nAggregates = aggregate(level, blockAggregate);
+
+  // equations of every aggregate
+  std::vector<uint32> aggStart(nAggregates + 1, 0);
+  std::vector<uint32> aggEqs(n);
+  for (uint32 i = 0; i < n; i++) {
+    aggStart[blockAggregate[level.blocks[i]] + 1]++;
+  }
+  for (uint32 a = 0; a < nAggregates; a++) {
+    aggStart[a + 1] += aggStart[a];
+  }
+  std::vector<uint32> next(aggStart.begin(), aggStart.end() - 1);
+  for (uint32 i = 0; i < n; i++) {
+    aggEqs[next[blockAggregate[level.blocks[i]]]++] = i;
+  }
+
+  // tentative prolongator: orthonormal basis of near null space restricted to an aggregate
+  // (modified Gram-Schmidt with dropping of linearly dependent modes)
+  std::vector<std::vector<uint32> > tRows(n);
+  std::vector<std::vector<double> > tValues(n);
+  coarse.blocks.clear();
+  coarse.B.clear();
+  coarse.nModes = k;
+  coarse.nBlocks = nAggregates;
+  uint32 nc = 0;
+  std::vector<double> q;
+  std::vector<double> v;
+  for (uint32 a = 0; a < nAggregates; a++) {
+    uint32 m = aggStart[a + 1] - aggStart[a];
+    q.clear();
+    uint16 rank = 0;
+    for (uint16 c = 0; c < k; c++) {
+      v.resize(m);
+      double norm0 = 0.0;
+      for (uint32 r = 0; r < m; r++) {
+        v[r] = level.B[c * n + aggEqs[aggStart[a] + r]];
+        norm0 += v[r] * v[r];
+      }
+      if (norm0 == 0.0) continue;
+      for (uint16 d = 0; d < rank; d++) {
+        double dot = 0.0;
+        for (uint32 r = 0; r < m; r++) {
+          dot += q[d * m + r] * v[r];
+        }
+        for (uint32 r = 0; r < m; r++) {
+          v[r] -= dot * q[d * m + r];
+        }
+      }
+      double norm = 0.0;
+      for (uint32 r = 0; r < m; r++) {
+        norm += v[r] * v[r];
+      }
+      if (norm <= 1.0e-20 * norm0) continue;
+      norm = sqrt(norm);
+      for (uint32 r = 0; r < m; r++) {
+        q.push_back(v[r] / norm);
+      }
+      rank++;
+    }
+    // near null space for the coarse level: coefficients of the modes in the basis
+    for (uint16 d = 0; d < rank; d++) {
+      for (uint32 r = 0; r < m; r++) {
+        uint32 i = aggEqs[aggStart[a] + r];
+        tRows[i].push_back(nc + d);
+        tValues[i].push_back(q[d * m + r]);
+      }
+      coarse.blocks.push_back(a);
+    }
+    nc += rank;
+  }
+  coarse.B.assign((size_t) k * nc, 0.0);
+  for (uint32 i = 0; i < n; i++) {
+    for (size_t p = 0; p < tRows[i].size(); p++) {
+      for (uint16 c = 0; c < k; c++) {
+        coarse.B[c * nc + tRows[i][p]] += tValues[i][p] * level.B[c * n + i];
+      }
+    }
+  }
+
+  CsrMatrix T;
+  T.nRows = n;
+  T.nColumns = nc;
+  T.iofeir.assign(n + 1, 0);
+  for (uint32 i = 0; i < n; i++) {
+    T.iofeir[i + 1] = T.iofeir[i] + static_cast<uint32>(tRows[i].size());
+    T.columns.insert(T.columns.end(), tRows[i].begin(), tRows[i].end());
+    T.values.insert(T.values.end(), tValues[i].begin(), tValues[i].end());
+  }
+
+  // smoothed prolongator P = (I - omega * D^-1 * A) * T
+  double omega = 4.0 / 3.0 / estimateSpectralRadius(level);
+  CsrMatrix DA;
+  DA.nRows = n;
+  DA.nColumns = n;
+  DA.iofeir = A.iofeir;
+  DA.columns = A.columns;
+  DA.values.resize(A.values.size());
+  for (uint32 i = 0; i < n; i++) {
+    double scale = omega / A.values[level.diagPos[i]];
+    for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+      DA.values[p] = (A.columns[p] == i ? 1.0 : 0.0) - scale * A.values[p];
+    }
+  }
+  multiply(DA, T, level.P);
+  transpose(level.P, level.R);
+
+  // Galerkin coarse operator Ac = R * A * P
+  CsrMatrix AP;
+  multiply(A, level.P, AP);
+  multiply(level.R, AP, coarse.A);
+}
+
+
+void AMGPreconditioner::setup(SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "AMGPreconditioner::setup");
+  levels.clear();
+  levels.resize(1);
+  Level& fine = levels[0];
+  fromSymMatrix(matrix, fine.A);
+  uint32 n = fine.A.nRows;
+
+  // nodes -> blocks
+  fine.blocks.resize(n);
+  fine.nBlocks = 0;
+  bool useNodes = (nullSpaceNodes.size() == n);
+  std::vector<uint32> nodeBlock;
+  for (uint32 i = 0; i < n; i++) {
+    uint32 node = useNodes ? nullSpaceNodes[i] : 0;
+    if (node == 0) {
+      fine.blocks[i] = fine.nBlocks++;
+      continue;
+    }
+    if (node >= nodeBlock.size()) {
+      nodeBlock.resize(node + 1, 0xFFFFFFFF);
+    }
+    if (nodeBlock[node] == 0xFFFFFFFF) {
+      nodeBlock[node] = fine.nBlocks++;
+    }
+    fine.blocks[i] = nodeBlock[node];
+  }
+
+  // near null space, equations without any information get constant mode
+  uint16 k = useNodes ? nullSpaceModes : 0;
+  std::vector<bool> empty(n, true);
+  for (uint16 c = 0; c < k; c++) {
+    for (uint32 i = 0; i < n; i++) {
+      if (nullSpace[c * n + i] != 0.0) empty[i] = false;
+    }
+  }
+  bool addConstant = (std::find(empty.begin(), empty.end(), true) != empty.end());
+  fine.nModes = k + (addConstant ? 1 : 0);
+  fine.B.assign((size_t) fine.nModes * n, 0.0);
+  if (k > 0) {
+    std::copy(nullSpace.begin(), nullSpace.end(), fine.B.begin());
+  }
+  if (addConstant) {
+    for (uint32 i = 0; i < n; i++) {
+      if (empty[i]) fine.B[(size_t) k * n + i] = 1.0;
+    }
+  }
+
+  for (uint16 l = 0; ; l++) {
+    Level& level = levels[l];
+    uint32 nl = level.A.nRows;
+    level.diagPos.resize(nl);
+    for (uint32 i = 0; i < nl; i++) {
+      uint32 p = level.A.iofeir[i];
+      while (p < level.A.iofeir[i + 1] && level.A.columns[p] != i) p++;
+      CHECK(p < level.A.iofeir[i + 1] && level.A.values[p] > 0.0)
+        << "AMGPreconditioner: non-positive diagonal entry in equation " << i + 1 << " on level " << l;
+      level.diagPos[i] = p;
+    }
+    level.x.resize(nl);
+    level.b.resize(nl);
+    level.r.resize(nl);
+    if (nl <= coarseSize || l + 1 >= maxLevels) break;
+
+    Level coarse;
+    buildProlongator(level, coarse);
+    // stop if coarsening is not effective
+    if (coarse.A.nRows == 0 || coarse.A.nRows >= nl) {
+      level.P = CsrMatrix();
+      level.R = CsrMatrix();
+      break;
+    }
+    levels.push_back(std::move(coarse));
+  }
+
+  // direct solver for the coarsest level
+  CsrMatrix& Ac = levels.back().A;
+  uint32 maxInRow = 1;
+  for (uint32 i = 0; i < Ac.nRows; i++) {
+    maxInRow = std::max(maxInRow, Ac.iofeir[i + 1] - Ac.iofeir[i] + 1);
+  }
+  coarseMatrix = std::make_shared<SparseSymMatrix>(Ac.nRows, maxInRow);
+  for (uint32 i = 0; i < Ac.nRows; i++) {
+    for (uint32 p = Ac.iofeir[i]; p < Ac.iofeir[i + 1]; p++) {
+      if (Ac.columns[p] >= i) coarseMatrix->addEntry(i + 1, Ac.columns[p] + 1);
+    }
+  }
+  coarseMatrix->compress();
+  for (uint32 i = 0; i < Ac.nRows; i++) {
+    for (uint32 p = Ac.iofeir[i]; p < Ac.iofeir[i + 1]; p++) {
+      if (Ac.columns[p] >= i) coarseMatrix->addValue(i + 1, Ac.columns[p] + 1, Ac.values[p]);
+    }
+  }
+  coarseSolver.setPositive(false);
+  coarseSolver.factorizeEquations(coarseMatrix.get());
+
+  std::stringstream ss;
+  for (auto& level : levels) {
+    ss << " " << level.A.nRows;
+  }
+  LOG(INFO) << "AMG levels = " << levels.size() << ", equations on levels:" << ss.str()
+    << ", operator complexity = " << getOperatorComplexity();
+}
+
+
+void AMGPreconditioner::vcycle(size_t l) {
+  Level& level = levels[l];
+  const CsrMatrix& A = level.A;
+  uint32 n = A.nRows;
+  double* x = &level.x[0];
+  const double* b = &level.b[0];
+
+  if (l + 1 == levels.size()) {
+    coarseSolver.substituteEquations(coarseMatrix.get(), &level.b[0], x);
+    return;
+  }
+
+  // forward Gauss-Seidel from zero initial guess
+  for (uint32 i = 0; i < n; i++) {
+    double xi = b[i];
+    for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+      if (A.columns[p] < i) xi -= A.values[p] * x[A.columns[p]];
+    }
+    x[i] = xi / A.values[level.diagPos[i]];
+  }
+
+  // coarse grid correction
+  residual(A, x, b, &level.r[0]);
+  Level& coarse = levels[l + 1];
+  for (uint32 i = 0; i < coarse.A.nRows; i++) {
+    double bi = 0.0;
+    for (uint32 p = level.R.iofeir[i]; p < level.R.iofeir[i + 1]; p++) {
+      bi += level.R.values[p] * level.r[level.R.columns[p]];
+    }
+    coarse.b[i] = bi;
+  }
+  vcycle(l + 1);
+  for (uint32 i = 0; i < n; i++) {
+    for (uint32 p = level.P.iofeir[i]; p < level.P.iofeir[i + 1]; p++) {
+      x[i] += level.P.values[p] * coarse.x[level.P.columns[p]];
+    }
+  }
+
+  // backward Gauss-Seidel
+  for (uint32 i = n; i-- > 0; ) {
+    double xi = b[i];
+    for (uint32 p = A.iofeir[i]; p < A.iofeir[i + 1]; p++) {
+      if (A.columns[p] != i) xi -= A.values[p] * x[A.columns[p]];
+    }
+    x[i] = xi / A.values[level.diagPos[i]];
+  }
+}
+
+
+void AMGPreconditioner::apply(const double* r, double* z) {
+  CHECK(levels.size() > 0) << "AMGPreconditioner::setup should be called first";
+  Level& fine = levels[0];
+  std::copy(r, r + fine.A.nRows, fine.b.begin());
+  vcycle(0);
+  std::copy(fine.x.begin(), fine.x.end(), z);
+}
+
+} // namespace math
+
+} // namespace nla3d
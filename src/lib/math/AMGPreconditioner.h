@@ -0,0 +1,98 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+#include "math/SparseMatrix.h"
+#include "math/EquationSolver.h"
+
+namespace nla3d {
+
+namespace math {
+
+// AMGPreconditioner - smoothed aggregation algebraic multigrid (SA-AMG). One symmetric V-cycle
+// (forward Gauss-Seidel pre-smoothing, backward Gauss-Seidel post-smoothing) is used as a
+// preconditioner in PCGEquationSolver.
+// Equations are aggregated node by node: all equations of a node (`nodes` vector) stay in one
+// aggregate. The tentative prolongator interpolates near null space `modes` of the operator (rigid
+// body modes for solid mechanics, see FEStorage::getRigidBodyModes) exactly, therefore number of
+// iterations is almost independent from the mesh size. Equations without near null space
+// information get a constant mode.
+class AMGPreconditioner {
+public:
+  // `modes` are stored mode by mode (nModes * nEq values), nodes[i] - node number for i-th equation
+  // (0 for equations not related to any node)
+  void setNearNullSpace(uint16 nModes, const std::vector<double>& modes,
+                        const std::vector<uint32>& nodes);
+  // threshold for strength of connection between nodes: |A_IJ| > theta * sqrt(|A_II| * |A_JJ|)
+  void setStrengthThreshold(double _theta);
+  // coarsening stops when number of equations is less than `_coarseSize`. The coarsest level is
+  // solved by SparseLDLTEquationSolver.
+  void setCoarseSize(uint32 _coarseSize);
+  void setMaxLevels(uint16 _maxLevels);
+
+  // build the hierarchy for the matrix (should be called every time the values are changed)
+  void setup(SparseSymMatrix* matrix);
+  // z = M^-1 * r
+  void apply(const double* r, double* z);
+
+  uint16 nLevels();
+  // sum of non-zeros in all levels divided by non-zeros in the finest one
+  double getOperatorComplexity();
+
+protected:
+  // general CSR matrix with 0-based indexes and full (not only upper triangle) storage
+  struct CsrMatrix {
+    uint32 nRows = 0;
+    uint32 nColumns = 0;
+    std::vector<uint32> iofeir;
+    std::vector<uint32> columns;
+    std::vector<double> values;
+  };
+
+  struct Level {
+    CsrMatrix A;
+    std::vector<uint32> diagPos;
+    // prolongator to the next level and restrictor (transposed prolongator)
+    CsrMatrix P;
+    CsrMatrix R;
+    // node (block) for every equation and near null space of this level
+    std::vector<uint32> blocks;
+    uint32 nBlocks = 0;
+    std::vector<double> B;
+    uint16 nModes = 0;
+    // work vectors for V-cycle
+    std::vector<double> x;
+    std::vector<double> b;
+    std::vector<double> r;
+  };
+
+  static void fromSymMatrix(SparseSymMatrix* matrix, CsrMatrix& A);
+  static void transpose(const CsrMatrix& A, CsrMatrix& AT);
+  static void multiply(const CsrMatrix& A, const CsrMatrix& B, CsrMatrix& AB);
+  static void residual(const CsrMatrix& A, const double* x, const double* b, double* r);
+
+  // split equations of level `l` into aggregates, return number of aggregates
+  uint32 aggregate(Level& level, std::vector<uint32>& blockAggregate);
+  // build prolongator and near null space for the next level
+  void buildProlongator(Level& level, Level& coarse);
+  double estimateSpectralRadius(Level& level);
+  void vcycle(size_t l);
+
+  std::vector<double> nullSpace;
+  std::vector<uint32> nullSpaceNodes;
+  uint16 nullSpaceModes = 0;
+
+  double theta = 0.08;
+  uint32 coarseSize = 500;
+  uint16 maxLevels = 10;
+
+  std::vector<Level> levels;
+  std::shared_ptr<SparseSymMatrix> coarseMatrix;
+  SparseLDLTEquationSolver coarseSolver;
+};
+
+} // namespace math
+
+} // namespace nla3d
@@ -36,6 +36,11 @@ namespace math {
 // Methods addEntry(), addValue() works with global indices (in our example it's from 1 to `n`).
 // Under the hood these methods decide in which block translate your request, then modify indices to
 // local and call block's method.
+//
+// For repeated additions to the same entries (like in FE assembly) the position of the entry can be
+// found once by getSlot(). The slot packs the number of the block and the index in the block's
+// values array, so addValueBySlot() doesn't perform any search. Slots remain valid for all matrices
+// sharing the same sparsity info (see BlockSparseSymMatrix(BlockSparseSymMatrix* ex)).
 template <uint16 nb>
 class BlockSparseSymMatrix {
   public:
@@ -45,9 +50,24 @@ class BlockSparseSymMatrix {
     // add non-zero entry to sparse matrix. This should be called before compress(). 
     void addEntry(uint32 _i, uint32 _j);
 
+    // Exact two-pass sparsity construction for the matrix created with max_in_row = 0: all
+    // entries are counted by countEntry(), then startFilling() allocates the exact storage and the
+    // same entries are added by addEntry()
+    void countEntry(uint32 _i, uint32 _j);
+    void startFilling();
+    // use block storage for all blocks (see SparsityInfo::setBlockPartition()). `_groups` holds the
+    // first row (global, 1-based) of every group of rows followed by nRows() + 1, the groups
+    // shouldn't cross the borders of the blocks. Should be called before countEntry().
+    void setBlockPartition(const std::vector<uint32>& _groups);
+
     // add value to the _i, _j entry. This should be called after compress().
     void addValue(uint32 _i, uint32 _j, double value);
 
+    // get the slot of the _i, _j entry. This should be called after compress().
+    uint32 getSlot(uint32 _i, uint32 _j);
+    // add value to the entry with the slot obtained by getSlot()
+    void addValueBySlot(uint32 slot, double value);
+
     SparseSymMatrix* block(uint16 _i);
     SparseMatrix* block(uint16 _i, uint16 _j);
 
@@ -59,10 +79,19 @@ class BlockSparseSymMatrix {
 
   private:
     void getBlockAndPosition(uint32 _i, uint16* block, uint32* pos);
+    // cache values arrays of the blocks for addValueBySlot()
+    void updateSlotValues();
 
     SparseSymMatrix diag[nb];
     SparseMatrix upper[nb * (nb + 1) / 2 - nb];
 
+    // values arrays of diag[0], .., diag[nb-1], upper[0], ..
+    double* slotValues[nb * (nb + 1) / 2];
+    // the upper bits of a slot keep the block number, the lower ones - index in the values array
+    static const uint16 slotShift = 28;
+    static const uint32 slotMask = (1u << slotShift) - 1;
+    static_assert(nb * (nb + 1) / 2 <= (1u << (32 - slotShift)), "Too many blocks for slot packing");
+
     std::vector<uint32> rows_in_block;
     uint32 total_rows = 0;
     bool compressed = false;
@@ -101,6 +130,10 @@ BlockSparseSymMatrix<nb>::BlockSparseSymMatrix(BlockSparseSymMatrix<nb>* ex) {
     }
     total_rows += rows_in_block[i];
   }
+
+  if (compressed) {
+    updateSlotValues();
+  }
 }
 
 
@@ -136,6 +169,64 @@ inline void BlockSparseSymMatrix<nb>::getBlockAndPosition(uint32 _i, uint16* blo
 }
 
 
+template<uint16 nb>
+void BlockSparseSymMatrix<nb>::countEntry(uint32 _i, uint32 _j) {
+  uint16 block_i, block_j;
+  uint32 pos_i, pos_j;
+  if (_i > _j) std::swap(_i, _j);
+  getBlockAndPosition(_i, &block_i, &pos_i);
+  getBlockAndPosition(_j, &block_j, &pos_j);
+
+  if (block_i == block_j) {
+    block(block_i)->countEntry(pos_i, pos_j);
+  } else {
+    block(block_i, block_j)->countEntry(pos_i, pos_j);
+  }
+}
+
+
+template<uint16 nb>
+void BlockSparseSymMatrix<nb>::setBlockPartition(const std::vector<uint32>& _groups) {
+  CHECK(_groups.size() && _groups.front() == 1 && _groups.back() == total_rows + 1);
+  // split the groups between the blocks, local groups are 0-based
+  std::vector<std::vector<uint32> > local(nb);
+  uint32 blockStart = 0;
+  uint16 b = 0;
+  for (auto g : _groups) {
+    uint32 row = g - 1;
+    while (b < nb && row >= blockStart + rows_in_block[b]) {
+      local[b].push_back(rows_in_block[b]);
+      blockStart += rows_in_block[b];
+      b++;
+    }
+    if (b < nb) {
+      local[b].push_back(row - blockStart);
+    }
+  }
+  for (uint16 i = 0; i < nb; i++) {
+    CHECK(local[i].front() == 0) << "Groups of rows cross the border of the block " << i + 1;
+  }
+
+  for (uint16 i = 0; i < nb; i++) {
+    block(i+1)->setBlockPartition(local[i]);
+    for (uint16 j = i+1; j < nb; j++) {
+      block(i+1, j+1)->setBlockPartition(local[i], local[j]);
+    }
+  }
+}
+
+
+template<uint16 nb>
+void BlockSparseSymMatrix<nb>::startFilling() {
+  for (uint16 i = 0; i < nb; i++) {
+    block(i+1)->startFilling();
+    for (uint16 j = i+1; j < nb; j++) {
+      block(i+1, j+1)->startFilling();
+    }
+  }
+}
+
+
 template<uint16 nb>
 void BlockSparseSymMatrix<nb>::addEntry(uint32 _i, uint32 _j) {
   uint16 block_i, block_j;
@@ -167,6 +258,51 @@ void BlockSparseSymMatrix<nb>::addValue(uint32 _i, uint32 _j, double value) {
   }
 }
 
+template<uint16 nb>
+uint32 BlockSparseSymMatrix<nb>::getSlot(uint32 _i, uint32 _j) {
+  assert(compressed);
+  uint16 block_i, block_j;
+  uint32 pos_i, pos_j;
+  if (_i > _j) std::swap(_i, _j);
+  getBlockAndPosition(_i, &block_i, &pos_i);
+  getBlockAndPosition(_j, &block_j, &pos_j);
+
+  BaseSparseMatrix* mat;
+  uint32 b;
+  if (block_i == block_j) {
+    mat = block(block_i);
+    b = block_i - 1;
+  } else {
+    SparseMatrix* up = block(block_i, block_j);
+    mat = up;
+    b = nb + static_cast<uint32> (up - upper);
+  }
+  uint32 index = mat->getSparsityInfo()->getIndex(pos_i, pos_j);
+  if (index >= mat->nValues()) {
+    LOG(FATAL) << "The position(" << _i << ", " << _j << ") is absent in the matrix";
+  }
+  CHECK(index <= slotMask);
+  return (b << slotShift) | index;
+}
+
+
+template<uint16 nb>
+inline void BlockSparseSymMatrix<nb>::addValueBySlot(uint32 slot, double value) {
+  slotValues[slot >> slotShift][slot & slotMask] += value;
+}
+
+
+template<uint16 nb>
+void BlockSparseSymMatrix<nb>::updateSlotValues() {
+  for (uint16 i = 0; i < nb; i++) {
+    slotValues[i] = diag[i].nValues() ? diag[i].getValuesArray() : nullptr;
+  }
+  for (uint16 i = 0; i < nb * (nb + 1) / 2 - nb; i++) {
+    slotValues[nb + i] = upper[i].nValues() ? upper[i].getValuesArray() : nullptr;
+  }
+}
+
+
 template<uint16 nb>
 void BlockSparseSymMatrix<nb>::zero() {
   for (uint16 i = 0; i < nb; i++) {
@@ -192,6 +328,7 @@ void BlockSparseSymMatrix<nb>::compress() {
   }
 
   compressed = true;
+  updateSlotValues();
 }
 
 template<uint16 nb>
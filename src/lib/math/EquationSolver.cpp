@@ -3,6 +3,7 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "math/EquationSolver.h"
+#include "math/AMGPreconditioner.h"
 
 #ifdef NLA3D_USE_MKL
 #include <mkl.h>
@@ -12,7 +13,7 @@ namespace nla3d {
 
 namespace math {
 
-EquationSolver* defaultEquationSolver = new GaussDenseEquationSolver;
+EquationSolver* defaultEquationSolver = new SparseLDLTEquationSolver;
 
 void EquationSolver::setSymmetric (bool symmetric) {
   isSymmetric = symmetric;
@@ -133,6 +134,545 @@ bool GaussDenseEquationSolver::_solve(double* X, double* A,
 }
 
 
+void SparseLDLTEquationSolver::solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "solveEquations");
+  factorizeEquations(matrix);
+  substituteEquations(matrix, rhs, unknowns);
+}
+
+
+void SparseLDLTEquationSolver::makePermutation(math::SparseSymMatrix* matrix,
+                                               const CsrIndexArrays& csr) {
+  const uint32* iofeir = csr.iofeir;
+  const uint32* columns = csr.columns;
+  const double* values = matrix->getValuesArray();
+
+  // NOTE: columns in a row are sorted, therefore diagonal entry (if exists) is the first one. Blocks
+  // of BlockSparseSymMatrix may have no diagonal entries for MPC equations.
+  std::vector<bool> placed(nEq, false);
+  std::vector<std::vector<uint32> > zeroDiagNeighbours(nEq);
+  perm.clear();
+  perm.reserve(nEq);
+  for (uint32 i = 0; i < nEq; i++) {
+    uint32 p = iofeir[i] - 1;
+    if (p < iofeir[i + 1] - 1 && columns[p] == i + 1 && values[p] != 0.0) {
+      perm.push_back(i);
+      placed[i] = true;
+    }
+  }
+  if (perm.size() < nEq) {
+    for (uint32 i = 0; i < nEq; i++) {
+      for (uint32 p = iofeir[i] - 1; p < iofeir[i + 1] - 1; p++) {
+        uint32 j = columns[p] - 1;
+        if (j == i) continue;
+        if (!placed[i]) zeroDiagNeighbours[i].push_back(j);
+        if (!placed[j]) zeroDiagNeighbours[j].push_back(i);
+      }
+    }
+    // place zero diagonal equations wave by wave: an equation goes after the ones it's coupled
+    // with, therefore its pivot gets non-zero contribution during elimination
+    std::vector<uint32> wave;
+    while (perm.size() < nEq) {
+      wave.clear();
+      for (uint32 i = 0; i < nEq; i++) {
+        if (placed[i]) continue;
+        for (auto j : zeroDiagNeighbours[i]) {
+          if (placed[j]) {
+            wave.push_back(i);
+            break;
+          }
+        }
+      }
+      if (wave.size() == 0) {
+        // the rest equations are not coupled with anything. Zero pivot will be caught later.
+        for (uint32 i = 0; i < nEq; i++) {
+          if (!placed[i]) wave.push_back(i);
+        }
+      }
+      for (auto i : wave) {
+        perm.push_back(i);
+        placed[i] = true;
+      }
+    }
+  }
+  pinv.resize(nEq);
+  for (uint32 k = 0; k < nEq; k++) {
+    pinv[perm[k]] = k;
+  }
+}
+
+
+void SparseLDLTEquationSolver::symbolicFactorization(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "symbolicFactorization");
+  LOG_IF(!isSymmetric, FATAL) << "SparseLDLTEquationSolver supports only symmetric matrices";
+
+  nEq = matrix->nRows();
+  uint32 nnz = matrix->nValues();
+  // scalar arrays are needed only here, numerical factorization goes through Apos
+  CsrIndexArrays csr(*matrix->getSparsityInfo());
+  const uint32* iofeir = csr.iofeir;
+  const uint32* columns = csr.columns;
+
+  makePermutation(matrix, csr);
+
+  // upper triangle of P*A*P^T in column-oriented form (column k holds rows i <= k). Entry (i, j)
+  // of the CSR goes to column max(pinv[i], pinv[j]).
+  Ap.assign(nEq + 1, 0);
+  Ai.resize(nnz);
+  Apos.resize(nnz);
+  for (uint32 i = 0; i < nEq; i++) {
+    // NOTE: SparseSymMatrix arrays are 1-based
+    for (uint32 p = iofeir[i] - 1; p < iofeir[i + 1] - 1; p++) {
+      Ap[std::max(pinv[i], pinv[columns[p] - 1]) + 1]++;
+    }
+  }
+  for (uint32 k = 0; k < nEq; k++) {
+    Ap[k + 1] += Ap[k];
+  }
+  std::vector<uint32> next(Ap.begin(), Ap.end() - 1);
+  for (uint32 i = 0; i < nEq; i++) {
+    for (uint32 p = iofeir[i] - 1; p < iofeir[i + 1] - 1; p++) {
+      uint32 a = pinv[i];
+      uint32 b = pinv[columns[p] - 1];
+      uint32 q = next[std::max(a, b)]++;
+      Ai[q] = std::min(a, b);
+      Apos[q] = p;
+    }
+  }
+
+  // elimination tree and number of entries in every column of L
+  parent.assign(nEq, -1);
+  flag.assign(nEq, -1);
+  Lnz.assign(nEq, 0);
+  for (uint32 k = 0; k < nEq; k++) {
+    flag[k] = k;
+    for (uint32 p = Ap[k]; p < Ap[k + 1]; p++) {
+      int32 i = Ai[p];
+      // follow path from i to the root of the etree, stop at flagged node
+      for ( ; i < (int32) k && flag[i] != (int32) k; i = parent[i]) {
+        if (parent[i] == -1) {
+          parent[i] = k;
+        }
+        Lnz[i]++;
+        flag[i] = k;
+      }
+    }
+  }
+
+  Lp.assign(nEq + 1, 0);
+  for (uint32 k = 0; k < nEq; k++) {
+    Lp[k + 1] = Lp[k] + Lnz[k];
+  }
+  Li.resize(Lp[nEq]);
+  Lx.resize(Lp[nEq]);
+  D.resize(nEq);
+  Y.assign(nEq, 0.0);
+  X.resize(nEq);
+  pattern.resize(nEq);
+
+  analysedSparsity = matrix->getSparsityInfo();
+  analysedNValues = nnz;
+  factorized = false;
+  LOG(INFO) << "Number of nonzeros in factors = " << Lp[nEq] + nEq;
+}
+
+
+void SparseLDLTEquationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  if (analysedSparsity != matrix->getSparsityInfo() || nEq != matrix->nRows() ||
+      analysedNValues != matrix->nValues()) {
+    symbolicFactorization(matrix);
+  }
+
+  const double* values = matrix->getValuesArray();
+  factorized = false;
+
+  // up-looking factorization: k-th row of L is found by sparse triangular solve
+  // L(0:k-1, 0:k-1) * D * l_k = A(0:k-1, k)
+  for (uint32 k = 0; k < nEq; k++) {
+    Y[k] = 0.0;
+    uint32 top = nEq;
+    flag[k] = k;
+    Lnz[k] = 0;
+    for (uint32 p = Ap[k]; p < Ap[k + 1]; p++) {
+      int32 i = Ai[p];
+      Y[i] += values[Apos[p]];
+      uint32 len = 0;
+      for ( ; flag[i] != (int32) k; i = parent[i]) {
+        pattern[len++] = i;
+        flag[i] = k;
+      }
+      while (len > 0) {
+        pattern[--top] = pattern[--len];
+      }
+    }
+    D[k] = Y[k];
+    Y[k] = 0.0;
+    for ( ; top < nEq; top++) {
+      uint32 i = pattern[top];
+      double yi = Y[i];
+      Y[i] = 0.0;
+      uint32 p2 = Lp[i] + Lnz[i];
+      for (uint32 p = Lp[i]; p < p2; p++) {
+        Y[Li[p]] -= Lx[p] * yi;
+      }
+      double l_ki = yi / D[i];
+      D[k] -= l_ki * yi;
+      Li[p2] = k;
+      Lx[p2] = l_ki;
+      Lnz[i]++;
+    }
+    CHECK(D[k] != 0.0) << "Zero pivot in equation " << perm[k] + 1 << " during LDL^T factorization";
+    LOG_IF(isPositive && D[k] < 0.0, FATAL) << "Negative pivot in equation " << perm[k] + 1
+      << ": matrix is not positive definite";
+  }
+  factorized = true;
+}
+
+
+void SparseLDLTEquationSolver::substituteEquations(math::SparseSymMatrix* matrix,
+                                                   double* rhs, double* unknowns) {
+  CHECK(nrhs == 1) << "SparseLDLTEquationSolver support only 1 set of rhs values";
+  CHECK(factorized) << "factorizeEquations should be called before substituteEquations";
+  CHECK(nEq == matrix->nRows());
+
+  for (uint32 i = 0; i < nEq; i++) {
+    X[pinv[i]] = rhs[i];
+  }
+
+  // L * y = P * b
+  for (uint32 j = 0; j < nEq; j++) {
+    double xj = X[j];
+    for (uint32 p = Lp[j]; p < Lp[j + 1]; p++) {
+      X[Li[p]] -= Lx[p] * xj;
+    }
+  }
+  // D * z = y
+  for (uint32 j = 0; j < nEq; j++) {
+    X[j] /= D[j];
+  }
+  // L^T * (P * x) = z
+  for (uint32 j = nEq; j-- > 0; ) {
+    double xj = X[j];
+    for (uint32 p = Lp[j]; p < Lp[j + 1]; p++) {
+      xj -= Lx[p] * X[Li[p]];
+    }
+    X[j] = xj;
+  }
+
+  for (uint32 i = 0; i < nEq; i++) {
+    unknowns[i] = X[pinv[i]];
+  }
+}
+
+
+void PCGEquationSolver::setPreconditioner(Preconditioner _prec) {
+  prec = _prec;
+}
+
+
+bool PCGEquationSolver::isNearNullSpaceNeeded() {
+  return prec == AMG;
+}
+
+
+void PCGEquationSolver::setNearNullSpace(uint16 nModes, const std::vector<double>& modes,
+                                         const std::vector<uint32>& nodes) {
+  if (!amg) {
+    amg = std::make_shared<AMGPreconditioner>();
+  }
+  amg->setNearNullSpace(nModes, modes, nodes);
+}
+
+
+void PCGEquationSolver::setTolerance(double _tolerance) {
+  CHECK(_tolerance > 0.0);
+  tolerance = _tolerance;
+}
+
+
+void PCGEquationSolver::setMaxIterations(uint32 _maxIterations) {
+  maxIterations = _maxIterations;
+}
+
+
+void PCGEquationSolver::setOmega(double _omega) {
+  CHECK(_omega > 0.0 && _omega < 2.0) << "SSOR relaxation parameter should be in (0, 2)";
+  omega = _omega;
+}
+
+
+void PCGEquationSolver::setWarmStart(bool _warmStart) {
+  warmStart = _warmStart;
+}
+
+
+uint32 PCGEquationSolver::getLastIterations() {
+  return lastIterations;
+}
+
+
+double PCGEquationSolver::getLastResidual() {
+  return lastResidual;
+}
+
+
+void PCGEquationSolver::solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "solveEquations");
+  factorizeEquations(matrix);
+  substituteEquations(matrix, rhs, unknowns);
+}
+
+
+void PCGEquationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
+  TIMED_SCOPE(t, "factorizeEquations");
+  LOG_IF(!isSymmetric, FATAL) << "PCGEquationSolver supports only symmetric matrices";
+
+  const double* values = matrix->getValuesArray();
+
+  if (analysedSparsity != matrix->getSparsityInfo() || nEq != matrix->nRows()) {
+    nEq = matrix->nRows();
+    diagPos.resize(nEq);
+    for (uint32 i = 0; i < nEq; i++) {
+      // NOTE: diagonal entry is the first one in a row (columns in a row are sorted)
+      uint32 pos = matrix->getSparsityInfo()->getIndex(i + 1, i + 1);
+      CHECK(pos < matrix->nValues())
+        << "PCGEquationSolver: no diagonal entry in equation " << i + 1;
+      diagPos[i] = pos;
+    }
+    r.resize(nEq);
+    z.resize(nEq);
+    p.resize(nEq);
+    q.resize(nEq);
+    csr.reset();
+    analysedSparsity = matrix->getSparsityInfo();
+  }
+  if ((prec == SSOR || prec == IC0) && !csr) {
+    csr.reset(new CsrIndexArrays(*matrix->getSparsityInfo()));
+  }
+
+  if (prec == IC0) {
+    buildIC0(matrix);
+  } else if (prec == AMG) {
+    if (!amg) {
+      amg = std::make_shared<AMGPreconditioner>();
+    }
+    amg->setup(matrix);
+  } else {
+    invDiag.resize(nEq);
+    for (uint32 i = 0; i < nEq; i++) {
+      double d = values[diagPos[i]];
+      CHECK(d > 0.0) << "PCGEquationSolver: non-positive diagonal entry in equation " << i + 1;
+      invDiag[i] = 1.0 / d;
+    }
+  }
+}
+
+
+void PCGEquationSolver::buildIC0(math::SparseSymMatrix* matrix) {
+  const uint32* iofeir = csr->iofeir;
+  const uint32* columns = csr->columns;
+  const double* values = matrix->getValuesArray();
+  uint32 nnz = matrix->nValues();
+
+  // maps column of a row to its position in values array (-1 if no such entry)
+  std::vector<int64> rowMap(nEq, -1);
+  double shift = 0.0;
+  bool success = false;
+  while (!success) {
+    icValues.assign(values, values + nnz);
+    for (uint32 i = 0; i < nEq; i++) {
+      icValues[diagPos[i]] *= 1.0 + shift;
+    }
+    success = true;
+    // right-looking row oriented factorization restricted to the sparsity of A
+    for (uint32 i = 0; i < nEq && success; i++) {
+      double d = icValues[diagPos[i]];
+      if (d <= 0.0) {
+        success = false;
+        break;
+      }
+      d = sqrt(d);
+      icValues[diagPos[i]] = d;
+      uint32 rowEnd = iofeir[i + 1] - 1;
+      for (uint32 pj = diagPos[i] + 1; pj < rowEnd; pj++) {
+        icValues[pj] /= d;
+      }
+      for (uint32 pj = diagPos[i] + 1; pj < rowEnd; pj++) {
+        uint32 j = columns[pj] - 1;
+        for (uint32 pl = iofeir[j] - 1; pl < iofeir[j + 1] - 1; pl++) {
+          rowMap[columns[pl] - 1] = pl;
+        }
+        for (uint32 pl = pj; pl < rowEnd; pl++) {
+          int64 pos = rowMap[columns[pl] - 1];
+          if (pos >= 0) {
+            icValues[pos] -= icValues[pj] * icValues[pl];
+          }
+        }
+        for (uint32 pl = iofeir[j] - 1; pl < iofeir[j + 1] - 1; pl++) {
+          rowMap[columns[pl] - 1] = -1;
+        }
+      }
+    }
+    if (!success) {
+      shift = (shift == 0.0) ? 1.0e-3 : shift * 2.0;
+      LOG(WARNING) << "IC(0) breakdown, restart with diagonal shift = " << shift;
+      CHECK(shift < 1.0) << "PCGEquationSolver: failed to build IC(0) preconditioner";
+    }
+  }
+}
+
+
+void PCGEquationSolver::matVecProd(math::SparseSymMatrix* matrix, const double* x, double* y) {
+  std::fill_n(y, nEq, 0.0);
+  matBVprod(*matrix, x, 1.0, y);
+}
+
+
+void PCGEquationSolver::applyPreconditioner(math::SparseSymMatrix* matrix, const double* r,
+                                            double* z) {
+  switch (prec) {
+    case JACOBI:
+      for (uint32 i = 0; i < nEq; i++) {
+        z[i] = r[i] * invDiag[i];
+      }
+      break;
+
+    case SSOR: {
+      // M = w/(2-w) * (D/w + L) * (D/w)^-1 * (D/w + U), where L = U^T
+      const uint32* iofeir = csr->iofeir;
+      const uint32* columns = csr->columns;
+      const double* values = matrix->getValuesArray();
+      // (D/w + L) * y = r. L is accessed by rows of U, so the sums are accumulated in z.
+      std::fill_n(z, nEq, 0.0);
+      for (uint32 i = 0; i < nEq; i++) {
+        double yi = (r[i] - z[i]) * omega * invDiag[i];
+        z[i] = yi;
+        for (uint32 pj = diagPos[i] + 1; pj < iofeir[i + 1] - 1; pj++) {
+          z[columns[pj] - 1] += values[pj] * yi;
+        }
+      }
+      // z = D/w * y, then (D/w + U) * z = y_scaled
+      for (uint32 i = nEq; i-- > 0; ) {
+        double zi = z[i] / (omega * invDiag[i]);
+        for (uint32 pj = diagPos[i] + 1; pj < iofeir[i + 1] - 1; pj++) {
+          zi -= values[pj] * z[columns[pj] - 1];
+        }
+        z[i] = zi * omega * invDiag[i];
+      }
+      for (uint32 i = 0; i < nEq; i++) {
+        z[i] *= (2.0 - omega) / omega;
+      }
+      break;
+    }
+
+    case IC0: {
+      const uint32* iofeir = csr->iofeir;
+      const uint32* columns = csr->columns;
+      // U^T * y = r
+      std::copy(r, r + nEq, z);
+      for (uint32 i = 0; i < nEq; i++) {
+        z[i] /= icValues[diagPos[i]];
+        for (uint32 pj = diagPos[i] + 1; pj < iofeir[i + 1] - 1; pj++) {
+          z[columns[pj] - 1] -= icValues[pj] * z[i];
+        }
+      }
+      // U * z = y
+      for (uint32 i = nEq; i-- > 0; ) {
+        double zi = z[i];
+        for (uint32 pj = diagPos[i] + 1; pj < iofeir[i + 1] - 1; pj++) {
+          zi -= icValues[pj] * z[columns[pj] - 1];
+        }
+        z[i] = zi / icValues[diagPos[i]];
+      }
+      break;
+    }
+
+    case AMG:
+      amg->apply(r, z);
+      break;
+  }
+}
+
+
+void PCGEquationSolver::substituteEquations(math::SparseSymMatrix* matrix,
+                                            double* rhs, double* unknowns) {
+  TIMED_SCOPE(t, "substituteEquations");
+  CHECK(nrhs == 1) << "PCGEquationSolver support only 1 set of rhs values";
+  CHECK(nEq == matrix->nRows());
+  CHECK(nEq == diagPos.size()) << "factorizeEquations should be called before substituteEquations";
+
+  double* x = unknowns;
+  double normB = 0.0;
+  for (uint32 i = 0; i < nEq; i++) {
+    normB += rhs[i] * rhs[i];
+  }
+  normB = sqrt(normB);
+  lastIterations = 0;
+  lastResidual = 0.0;
+  if (normB == 0.0) {
+    std::fill_n(x, nEq, 0.0);
+    return;
+  }
+
+  // r = b - A * x
+  if (warmStart) {
+    matVecProd(matrix, x, &r[0]);
+    for (uint32 i = 0; i < nEq; i++) {
+      r[i] = rhs[i] - r[i];
+    }
+  } else {
+    std::fill_n(x, nEq, 0.0);
+    std::copy(rhs, rhs + nEq, r.begin());
+  }
+
+  uint32 maxIter = (maxIterations > 0) ? maxIterations : std::max(nEq, (uint32) 1);
+  double rz = 0.0;
+  for (uint32 iter = 0; ; iter++) {
+    double normR = 0.0;
+    for (uint32 i = 0; i < nEq; i++) {
+      normR += r[i] * r[i];
+    }
+    lastResidual = sqrt(normR) / normB;
+    lastIterations = iter;
+    if (lastResidual < tolerance || iter == maxIter) {
+      break;
+    }
+
+    applyPreconditioner(matrix, &r[0], &z[0]);
+    double rzNew = 0.0;
+    for (uint32 i = 0; i < nEq; i++) {
+      rzNew += r[i] * z[i];
+    }
+    if (iter == 0) {
+      std::copy(z.begin(), z.end(), p.begin());
+    } else {
+      double beta = rzNew / rz;
+      for (uint32 i = 0; i < nEq; i++) {
+        p[i] = z[i] + beta * p[i];
+      }
+    }
+    rz = rzNew;
+
+    matVecProd(matrix, &p[0], &q[0]);
+    double pq = 0.0;
+    for (uint32 i = 0; i < nEq; i++) {
+      pq += p[i] * q[i];
+    }
+    CHECK(pq > 0.0) << "PCGEquationSolver: matrix is not positive definite";
+    double alpha = rz / pq;
+    for (uint32 i = 0; i < nEq; i++) {
+      x[i] += alpha * p[i];
+      r[i] -= alpha * q[i];
+    }
+  }
+
+  LOG_IF(lastResidual >= tolerance, WARNING) << "PCGEquationSolver didn't converge in "
+    << lastIterations << " iterations, relative residual = " << lastResidual;
+  LOG(INFO) << "PCG iterations = " << lastIterations << ", relative residual = " << lastResidual;
+}
+
+
 #ifdef NLA3D_USE_MKL
 PARDISO_equationSolver::~PARDISO_equationSolver () {
   releasePARDISO();
@@ -156,8 +696,8 @@ void PARDISO_equationSolver::substituteEquations(math::SparseSymMatrix* matrix,
 	int phase = 33;
   int n = static_cast<int> (nEq);
 	PARDISO(pt, &maxfct, &mnum, &mtype, &phase,	&n, matrix->getValuesArray(),
-      (int*) matrix->getIofeirArray(),
-      (int*) matrix->getColumnsArray(),
+      (int*) csr->iofeir,
+      (int*) csr->columns,
 			NULL, &nrhs, iparm, &msglvl, rhs, unknowns, &error);
 
 	CHECK(error == 0) << "ERROR during solution. Error code = " << error;
@@ -183,8 +723,8 @@ void PARDISO_equationSolver::factorizeEquations(math::SparseSymMatrix* matrix) {
   int n = static_cast<int> (nEq);
 
 	PARDISO(pt, &maxfct, &mnum, &mtype, &phase, &n, matrix->getValuesArray(), 
-      (int*) matrix->getIofeirArray(),
-      (int*) matrix->getColumnsArray(),
+      (int*) csr->iofeir,
+      (int*) csr->columns,
 			NULL, &nrhs, iparm, &msglvl, NULL, NULL, &error);
   CHECK(error == 0) << "ERROR during numerical factorization. Error code = " << error;
 
@@ -225,6 +765,7 @@ void PARDISO_equationSolver::initializePARDISO (math::SparseSymMatrix* matrix) {
 
   nEq = matrix->nRows();
   int n = static_cast<int> (nEq);
+  csr.reset(new CsrIndexArrays(*matrix->getSparsityInfo()));
 
   // initialize error code
 	int error = 0; 
@@ -232,8 +773,8 @@ void PARDISO_equationSolver::initializePARDISO (math::SparseSymMatrix* matrix) {
   int phase = 11;
 
   PARDISO(pt, &maxfct, &mnum, &mtype,&phase, &n, matrix->getValuesArray(),
-     (int*) matrix->getIofeirArray(), 
-     (int*) matrix->getColumnsArray(), 
+     (int*) csr->iofeir,
+     (int*) csr->columns,
 			NULL, &nrhs, iparm, &msglvl, NULL, NULL, &error);
   CHECK(error == 0) << "ERROR during symbolic factorization. Error code = " << error;
   LOG(INFO) << "Number of nonzeros in factors = " << iparm[17] << ", number of factorization MFLOPS = " << iparm[18];
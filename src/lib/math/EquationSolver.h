@@ -12,6 +12,7 @@ namespace nla3d {
 namespace math {
 
 class SparseSymMatrix;
+class AMGPreconditioner;
 
 // EquationSolver - abstract class for solving a system of linear equations.
 // This class primarly used in FESolver class.
@@ -24,6 +25,13 @@ public:
   virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns) = 0;
   void setSymmetric (bool symmetric = true);
   void setPositive (bool positive = true);
+  // Some solvers can take advantage of near null space of the matrix (rigid body modes in solid
+  // mechanics). If isNearNullSpaceNeeded() returns true FESolver calls setNearNullSpace() after
+  // equation numbers are assigned. `modes` are stored mode by mode, nodes[i] - node number of i-th
+  // equation (0 if the equation is not related to a node).
+  virtual bool isNearNullSpaceNeeded() { return false; };
+  virtual void setNearNullSpace(uint16, const std::vector<double>&,
+                                const std::vector<uint32>&) { };
 protected:
   uint32 nEq = 0;
 
@@ -45,6 +53,132 @@ protected:
   dMat matA = dMat(1, 1);
 };
 
+// SparseLDLTEquationSolver - sparse direct solver which doesn't depend on any external library. The
+// matrix is factorized as A = L * D * L^T (L - unit lower triangular, D - diagonal) by up-looking
+// algorithm working directly on upper triangle CSR arrays of SparseSymMatrix. Symbolic analysis
+// (elimination tree and structure of L) is performed once and reused by subsequent
+// factorizeEquations calls while the sparsity of the matrix stays the same.
+// No numerical pivoting is performed. To deal with indefinite systems produced by MPC (Lagrange
+// multipliers and master dofs have zero diagonal entries) the equations with zero diagonal are
+// moved to the end of elimination order, just after the equations they are coupled with.
+// If isPositive == true, then all pivots are checked to be positive (Cholesky-like behaviour).
+class SparseLDLTEquationSolver : public EquationSolver {
+public:
+  virtual ~SparseLDLTEquationSolver() { };
+  virtual void solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void factorizeEquations(math::SparseSymMatrix* matrix);
+  virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+protected:
+  void symbolicFactorization(math::SparseSymMatrix* matrix);
+
+  // sparsity of the matrix for which symbolic factorization was done
+  std::shared_ptr<SparsityInfo> analysedSparsity;
+  uint32 analysedNValues = 0;
+
+  void makePermutation(math::SparseSymMatrix* matrix, const CsrIndexArrays& csr);
+
+  // elimination order: perm[new] = old, pinv[old] = new
+  std::vector<uint32> perm;
+  std::vector<uint32> pinv;
+
+  // upper triangle of P*A*P^T stored by columns: Ap - column starts, Ai - row indexes (0-based), Apos -
+  // positions of the entries in matrix->getValuesArray()
+  std::vector<uint32> Ap;
+  std::vector<uint32> Ai;
+  std::vector<uint32> Apos;
+
+  // elimination tree (-1 for roots)
+  std::vector<int32> parent;
+
+  // L factor stored by columns (without unit diagonal) and D
+  std::vector<uint32> Lp;
+  std::vector<uint32> Lnz;
+  std::vector<uint32> Li;
+  std::vector<double> Lx;
+  std::vector<double> D;
+
+  // work arrays
+  std::vector<double> Y;
+  std::vector<double> X;
+  std::vector<uint32> pattern;
+  std::vector<int32> flag;
+
+  bool factorized = false;
+};
+
+// PCGEquationSolver - preconditioned conjugate gradient method for symmetric positive definite
+// matrices. The solver works directly on upper triangle storage of SparseSymMatrix without copying
+// it (scalar CSR arrays of block storage are built only for SSOR and IC(0) preconditioners),
+// therefore it's suitable for large models where fill-in of direct solvers doesn't fit into memory.
+// factorizeEquations builds the preconditioner, substituteEquations performs CG iterations. The
+// initial guess is taken from `unknowns` buffer (if warm start is on).
+// NOTE: CG doesn't work for indefinite matrices (MPC equations).
+class PCGEquationSolver : public EquationSolver {
+public:
+  enum Preconditioner {
+    JACOBI,
+    SSOR,
+    // incomplete Cholesky factorization with zero fill-in
+    IC0,
+    // smoothed aggregation algebraic multigrid (see AMGPreconditioner)
+    AMG
+  };
+
+  virtual ~PCGEquationSolver() { };
+  virtual void solveEquations (math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual void factorizeEquations(math::SparseSymMatrix* matrix);
+  virtual void substituteEquations(math::SparseSymMatrix* matrix, double* rhs, double* unknowns);
+  virtual bool isNearNullSpaceNeeded();
+  virtual void setNearNullSpace(uint16 nModes, const std::vector<double>& modes,
+                                const std::vector<uint32>& nodes);
+
+  void setPreconditioner(Preconditioner _prec);
+  // relative residual norm |b - A*x| / |b| to stop iterations
+  void setTolerance(double _tolerance);
+  // 0 means maximum number of iterations equal to number of equations
+  void setMaxIterations(uint32 _maxIterations);
+  // relaxation parameter for SSOR preconditioner, 0 < omega < 2
+  void setOmega(double _omega);
+  // use `unknowns` as initial guess or start from zero vector
+  void setWarmStart(bool _warmStart = true);
+  uint32 getLastIterations();
+  double getLastResidual();
+
+protected:
+  // y = A * x
+  void matVecProd(math::SparseSymMatrix* matrix, const double* x, double* y);
+  // z = M^-1 * r
+  void applyPreconditioner(math::SparseSymMatrix* matrix, const double* r, double* z);
+  void buildIC0(math::SparseSymMatrix* matrix);
+
+  Preconditioner prec = JACOBI;
+  double tolerance = 1.0e-8;
+  uint32 maxIterations = 0;
+  double omega = 1.0;
+  bool warmStart = true;
+
+  uint32 lastIterations = 0;
+  double lastResidual = 0.0;
+
+  // positions of diagonal entries in matrix->getValuesArray()
+  std::vector<uint32> diagPos;
+  std::shared_ptr<SparsityInfo> analysedSparsity;
+  // rows of the matrix for SSOR and IC(0) sweeps
+  std::unique_ptr<CsrIndexArrays> csr;
+
+  // inverse diagonal (JACOBI, SSOR)
+  std::vector<double> invDiag;
+  // U factor of IC(0) (A ~ U^T * U) with the same sparsity as the matrix
+  std::vector<double> icValues;
+  std::shared_ptr<AMGPreconditioner> amg;
+
+  // work arrays
+  std::vector<double> r;
+  std::vector<double> z;
+  std::vector<double> p;
+  std::vector<double> q;
+};
+
 #ifdef NLA3D_USE_MKL
 class PARDISO_equationSolver : public EquationSolver {
 public:
@@ -70,6 +204,8 @@ protected:
 	int msglvl = 0; 
   
   bool firstRun = true;
+  // CSR arrays of the matrix passed to PARDISO
+  std::unique_ptr<CsrIndexArrays> csr;
   // real symmetric undifinite defined matrix
 	int mtype = -2; 
 };
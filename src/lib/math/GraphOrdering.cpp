@@ -0,0 +1,378 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#include "math/GraphOrdering.h"
+#include <queue>
+#include <functional>
+
+namespace nla3d {
+
+namespace math {
+
+// Breadth first search from `root` over vertices with region[v] == regionId. The vertices are
+// stored in `order`, levelStart[l] points to the first vertex of level l in `order`.
+// `level` should be filled with -1 for the region vertices, after the call it's restored.
+static void levelStructure(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                           uint32 root, const std::vector<uint32>& region, uint32 regionId,
+                           std::vector<int32>& level, std::vector<uint32>& order,
+                           std::vector<uint32>& levelStart) {
+  order.clear();
+  levelStart.clear();
+  order.push_back(root);
+  level[root] = 0;
+  levelStart.push_back(0);
+  int32 current = 0;
+  for (uint32 q = 0; q < order.size(); q++) {
+    uint32 v = order[q];
+    if (level[v] != current) {
+      current = level[v];
+      levelStart.push_back(q);
+    }
+    for (uint32 p = xadj[v]; p < xadj[v + 1]; p++) {
+      uint32 u = adj[p];
+      if (region[u] == regionId && level[u] < 0) {
+        level[u] = level[v] + 1;
+        order.push_back(u);
+      }
+    }
+  }
+  levelStart.push_back(static_cast<uint32>(order.size()));
+  for (auto v : order) {
+    level[v] = -1;
+  }
+}
+
+
+// find pseudo-peripheral vertex of the connected component containing `root` (George-Liu)
+static uint32 pseudoPeripheral(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                               uint32 root, const std::vector<uint32>& region, uint32 regionId,
+                               std::vector<int32>& level, std::vector<uint32>& order,
+                               std::vector<uint32>& levelStart) {
+  levelStructure(xadj, adj, root, region, regionId, level, order, levelStart);
+  size_t eccentricity = levelStart.size() - 2;
+  while (true) {
+    // vertex of minimal degree in the last level
+    uint32 last = levelStart[levelStart.size() - 2];
+    uint32 candidate = order[last];
+    for (uint32 q = last + 1; q < order.size(); q++) {
+      uint32 v = order[q];
+      if (xadj[v + 1] - xadj[v] < xadj[candidate + 1] - xadj[candidate]) {
+        candidate = v;
+      }
+    }
+    levelStructure(xadj, adj, candidate, region, regionId, level, order, levelStart);
+    if (levelStart.size() - 2 <= eccentricity) {
+      // restore level structure of the found root
+      levelStructure(xadj, adj, root, region, regionId, level, order, levelStart);
+      return root;
+    }
+    root = candidate;
+    eccentricity = levelStart.size() - 2;
+  }
+}
+
+
+void reverseCuthillMcKee(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                         std::vector<uint32>& perm) {
+  uint32 n = static_cast<uint32>(xadj.size()) - 1;
+  perm.clear();
+  perm.reserve(n);
+  // region 0 - not numbered vertices, region 1 - numbered ones
+  std::vector<uint32> region(n, 0);
+  std::vector<int32> level(n, -1);
+  std::vector<uint32> order;
+  std::vector<uint32> levelStart;
+  std::vector<uint32> neighbours;
+
+  for (uint32 s = 0; s < n; s++) {
+    if (region[s] != 0) continue;
+    uint32 root = pseudoPeripheral(xadj, adj, s, region, 0, level, order, levelStart);
+    size_t first = perm.size();
+    perm.push_back(root);
+    region[root] = 1;
+    for (size_t q = first; q < perm.size(); q++) {
+      uint32 v = perm[q];
+      neighbours.clear();
+      for (uint32 p = xadj[v]; p < xadj[v + 1]; p++) {
+        if (region[adj[p]] == 0) {
+          neighbours.push_back(adj[p]);
+          region[adj[p]] = 1;
+        }
+      }
+      // neighbours are numbered in increasing degree order
+      std::stable_sort(neighbours.begin(), neighbours.end(), [&xadj] (uint32 a, uint32 b) {
+          return xadj[a + 1] - xadj[a] < xadj[b + 1] - xadj[b];
+        });
+      perm.insert(perm.end(), neighbours.begin(), neighbours.end());
+    }
+  }
+  std::reverse(perm.begin(), perm.end());
+}
+
+
+void approximateMinimumDegree(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                              std::vector<uint32>& perm) {
+  uint32 n = static_cast<uint32>(xadj.size()) - 1;
+  perm.clear();
+  perm.reserve(n);
+
+  // quotient graph: variables are adjacent to variables (A) and elements (E). Element e is an
+  // eliminated variable, L[e] - variables in its clique.
+  enum Status : uint8 {VARIABLE, ELEMENT, ABSORBED};
+  std::vector<std::vector<uint32> > A(n);
+  std::vector<std::vector<uint32> > E(n);
+  std::vector<std::vector<uint32> > L(n);
+  std::vector<uint8> status(n, VARIABLE);
+  std::vector<uint32> degree(n);
+  std::vector<uint32> mark(n, 0);
+  std::vector<int64> w(n, -1);
+  uint32 stamp = 0;
+
+  typedef std::pair<uint32, uint32> DegreeVertex;
+  std::priority_queue<DegreeVertex, std::vector<DegreeVertex>, std::greater<DegreeVertex> > queue;
+  for (uint32 i = 0; i < n; i++) {
+    A[i].assign(adj.begin() + xadj[i], adj.begin() + xadj[i + 1]);
+    degree[i] = static_cast<uint32>(A[i].size());
+    queue.push(DegreeVertex(degree[i], i));
+  }
+
+  std::vector<uint32> Lp;
+  std::vector<uint32> touched;
+  std::vector<uint32> buffer;
+  for (uint32 k = 0; k < n; k++) {
+    // pick the variable with minimal degree (skip outdated queue entries)
+    uint32 p;
+    while (true) {
+      DegreeVertex top = queue.top();
+      queue.pop();
+      p = top.second;
+      if (status[p] == VARIABLE && degree[p] == top.first) break;
+    }
+    perm.push_back(p);
+    status[p] = ELEMENT;
+
+    // Lp = (A[p] U L[e] for e in E[p]) \ p, the elements adjacent to p are absorbed
+    stamp++;
+    mark[p] = stamp;
+    Lp.clear();
+    for (auto i : A[p]) {
+      if (status[i] == VARIABLE && mark[i] != stamp) {
+        mark[i] = stamp;
+        Lp.push_back(i);
+      }
+    }
+    for (auto e : E[p]) {
+      if (status[e] != ELEMENT) continue;
+      for (auto i : L[e]) {
+        if (status[i] == VARIABLE && mark[i] != stamp) {
+          mark[i] = stamp;
+          Lp.push_back(i);
+        }
+      }
+      status[e] = ABSORBED;
+      std::vector<uint32>().swap(L[e]);
+    }
+    std::vector<uint32>().swap(A[p]);
+    std::vector<uint32>().swap(E[p]);
+    L[p] = Lp;
+
+    // w[e] = |L[e] \ Lp| for elements adjacent to Lp variables
+    touched.clear();
+    for (auto i : Lp) {
+      for (auto e : E[i]) {
+        if (status[e] != ELEMENT) continue;
+        if (w[e] < 0) {
+          w[e] = static_cast<int64>(L[e].size());
+          touched.push_back(e);
+        }
+        w[e]--;
+      }
+    }
+
+    uint32 lpDegree = static_cast<uint32>(Lp.size()) - 1;
+    for (auto i : Lp) {
+      // elements: drop absorbed ones and ones fully covered by Lp (aggressive absorption), add p
+      buffer.clear();
+      uint64 elementDegree = 0;
+      for (auto e : E[i]) {
+        if (status[e] != ELEMENT) continue;
+        if (w[e] == 0) {
+          status[e] = ABSORBED;
+          std::vector<uint32>().swap(L[e]);
+          continue;
+        }
+        buffer.push_back(e);
+        elementDegree += w[e];
+      }
+      buffer.push_back(p);
+      E[i].swap(buffer);
+
+      // variables: covered by element p now
+      buffer.clear();
+      for (auto j : A[i]) {
+        if (status[j] == VARIABLE && mark[j] != stamp) {
+          buffer.push_back(j);
+        }
+      }
+      A[i].swap(buffer);
+
+      uint64 d = A[i].size() + lpDegree + elementDegree;
+      d = std::min(d, (uint64) degree[i] + lpDegree);
+      d = std::min(d, (uint64) (n - k - 1));
+      degree[i] = static_cast<uint32>(d);
+      queue.push(DegreeVertex(degree[i], i));
+    }
+    for (auto e : touched) {
+      w[e] = -1;
+    }
+  }
+}
+
+
+// order vertices with region[v] == regionId by approximate minimum degree of induced subgraph
+static void orderLeaf(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                      const std::vector<uint32>& verts, const std::vector<uint32>& region,
+                      uint32 regionId, std::vector<int32>& local, std::vector<uint32>& perm) {
+  uint32 n = static_cast<uint32>(verts.size());
+  for (uint32 i = 0; i < n; i++) {
+    local[verts[i]] = i;
+  }
+  std::vector<uint32> lxadj(n + 1, 0);
+  std::vector<uint32> ladj;
+  for (uint32 i = 0; i < n; i++) {
+    uint32 v = verts[i];
+    for (uint32 p = xadj[v]; p < xadj[v + 1]; p++) {
+      if (region[adj[p]] == regionId) {
+        ladj.push_back(local[adj[p]]);
+      }
+    }
+    lxadj[i + 1] = static_cast<uint32>(ladj.size());
+  }
+  for (auto v : verts) {
+    local[v] = -1;
+  }
+  std::vector<uint32> lperm;
+  approximateMinimumDegree(lxadj, ladj, lperm);
+  for (auto i : lperm) {
+    perm.push_back(verts[i]);
+  }
+}
+
+
+struct NestedDissectionData {
+  NestedDissectionData(const std::vector<uint32>& _xadj, const std::vector<uint32>& _adj,
+                       std::vector<uint32>& _perm, uint32 _leafSize) :
+    xadj(_xadj), adj(_adj), perm(_perm), leafSize(_leafSize) { };
+  const std::vector<uint32>& xadj;
+  const std::vector<uint32>& adj;
+  std::vector<uint32>& perm;
+  uint32 leafSize;
+  std::vector<uint32> region;
+  std::vector<int32> level;
+  std::vector<int32> local;
+  uint32 nextRegion = 1;
+};
+
+
+static void dissect(NestedDissectionData& nd, std::vector<uint32>& verts) {
+  uint32 regionId = nd.nextRegion++;
+  for (auto v : verts) {
+    nd.region[v] = regionId;
+  }
+  if (verts.size() <= nd.leafSize) {
+    orderLeaf(nd.xadj, nd.adj, verts, nd.region, regionId, nd.local, nd.perm);
+    return;
+  }
+
+  std::vector<uint32> order;
+  std::vector<uint32> levelStart;
+  // only the level structure (`order`, `levelStart`) rooted at the pseudo-peripheral vertex is used
+  pseudoPeripheral(nd.xadj, nd.adj, verts[0], nd.region, regionId, nd.level, order, levelStart);
+  if (order.size() < verts.size()) {
+    // the region is not connected: process the connected components separately
+    std::vector<std::vector<uint32> > components;
+    uint32 componentsRegion = nd.nextRegion++;
+    for (auto s : verts) {
+      if (nd.region[s] != regionId) continue;
+      levelStructure(nd.xadj, nd.adj, s, nd.region, regionId, nd.level, order, levelStart);
+      for (auto v : order) {
+        nd.region[v] = componentsRegion;
+      }
+      components.push_back(order);
+    }
+    for (auto& component : components) {
+      dissect(nd, component);
+    }
+    return;
+  }
+
+  uint32 nLevels = static_cast<uint32>(levelStart.size()) - 1;
+  if (nLevels < 3) {
+    orderLeaf(nd.xadj, nd.adj, verts, nd.region, regionId, nd.local, nd.perm);
+    return;
+  }
+  // middle level which splits the vertices into two halves
+  uint32 mid = 1;
+  while (mid + 2 < nLevels && levelStart[mid + 1] < order.size() / 2) {
+    mid++;
+  }
+  for (uint32 l = 0; l < nLevels; l++) {
+    for (uint32 q = levelStart[l]; q < levelStart[l + 1]; q++) {
+      nd.level[order[q]] = l;
+    }
+  }
+  std::vector<uint32> partA(order.begin(), order.begin() + levelStart[mid]);
+  std::vector<uint32> partB(order.begin() + levelStart[mid + 1], order.end());
+  std::vector<uint32> separator;
+  // vertices of the middle level not connected to the next level aren't needed in the separator
+  for (uint32 q = levelStart[mid]; q < levelStart[mid + 1]; q++) {
+    uint32 v = order[q];
+    bool needed = false;
+    for (uint32 p = nd.xadj[v]; p < nd.xadj[v + 1] && !needed; p++) {
+      uint32 u = nd.adj[p];
+      needed = (nd.region[u] == regionId && nd.level[u] == (int32) mid + 1);
+    }
+    if (needed) {
+      separator.push_back(v);
+    } else {
+      partA.push_back(v);
+    }
+  }
+  for (auto v : order) {
+    nd.level[v] = -1;
+  }
+
+  dissect(nd, partA);
+  dissect(nd, partB);
+  // separator goes last
+  uint32 separatorRegion = nd.nextRegion++;
+  for (auto v : separator) {
+    nd.region[v] = separatorRegion;
+  }
+  orderLeaf(nd.xadj, nd.adj, separator, nd.region, separatorRegion, nd.local, nd.perm);
+}
+
+
+void nestedDissection(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                      std::vector<uint32>& perm, uint32 leafSize) {
+  uint32 n = static_cast<uint32>(xadj.size()) - 1;
+  perm.clear();
+  perm.reserve(n);
+  NestedDissectionData nd(xadj, adj, perm, std::max(leafSize, (uint32) 1));
+  nd.region.assign(n, 0);
+  nd.level.assign(n, -1);
+  nd.local.assign(n, -1);
+  std::vector<uint32> verts(n);
+  for (uint32 i = 0; i < n; i++) {
+    verts[i] = i;
+  }
+  if (n > 0) {
+    dissect(nd, verts);
+  }
+  CHECK(perm.size() == n);
+}
+
+} // namespace math
+
+} // namespace nla3d
@@ -0,0 +1,32 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+
+namespace nla3d {
+
+namespace math {
+
+// Fill-reducing orderings of an undirected graph. The graph is given in CSR-like format (0-based):
+// neighbours of vertex i are adj[xadj[i]] .. adj[xadj[i+1] - 1]. The graph should be symmetric and
+// shouldn't contain self loops. All functions return a permutation `perm` where perm[k] is the
+// vertex which should be numbered k-th.
+
+// reverse Cuthill-McKee ordering (minimizes bandwidth and profile)
+void reverseCuthillMcKee(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                         std::vector<uint32>& perm);
+
+// approximate minimum degree ordering (quotient graph with Amestoy-Davis-Duff degree bounds)
+void approximateMinimumDegree(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                              std::vector<uint32>& perm);
+
+// nested dissection ordering: recursive bisection by level structure separators, the parts
+// smaller than `leafSize` are ordered by approximate minimum degree
+void nestedDissection(const std::vector<uint32>& xadj, const std::vector<uint32>& adj,
+                      std::vector<uint32>& perm, uint32 leafSize = 128);
+
+} // namespace math
+
+} // namespace nla3d
@@ -54,6 +54,7 @@ public:
 	Mat<dimM-1,dimN-1> cross_cut (uint16 cuti, uint16 cutj);
     std::string toString ();
 	double* ptr ();
+	const double* ptr () const;
 	bool compare (const Mat<dimM,dimN> &B, double eps = 1.0e-5);
 	void simple_read (std::istream &st);
 	//friend функции
@@ -74,7 +75,9 @@ public:
       return dimN;
     }
 
-	Vec<dimN> data[dimM];
+	// rows are stored contiguously (Vec<dimN> is a plain array of doubles), the matrix is aligned
+	// for SSE2 loads in the product kernels below
+	alignas(16) Vec<dimN> data[dimM];
 private:
     //data was moved from here to public
 };
@@ -196,33 +199,11 @@ Mat<dimM,1>& Mat<dimM,dimN>::operator= (const Vec<dimM> &op)
 }
 //----------operator*(Mat)---------------------------------------------------------
 template<uint16 dimM1, uint16 dimN1, uint16 dimM2, uint16 dimN2> Mat<dimM1,dimN2> operator*(const Mat<dimM1,dimN1> &op1, const Mat<dimM2,dimN2> &op2) {
-	assert(dimN1 == dimM2);
+	static_assert(dimN1 == dimM2, "Mat: inconsistent dimensions of the product");
 	Mat<dimM1, dimN2> p;
-	double element;
-	double *ptr1 = (double*) op1.data;
-	double *ptr2 = (double*) op2.data;
-	for (uint16 i=0; i < dimM1; i++)
-		for (uint16 j=0; j < dimN2; j++)
-		{
-			element=0.0f;
-			for (uint16 l=0; l < dimN1; l++) element+=ptr1[i*dimN1+l]*ptr2[l*dimN2+j];
-				//(op1.data[i])[l]*(op2.data[l])[j];
-			p[i][j]=element;
-		}
+	p.zero();
+	matABprod(op1, op2, 1.0, p);
 	return p;
-
-
-	//assert(dimN == dimM2);
-	//Mat<dimM, dimN2> p;
-	//double element;
-	//for (uint16 i=0; i < dimM; i++)
-	//	for (uint16 j=0; j < dimN2; j++)
-	//	{
-	//		element=0.0f;
-	//		for (uint16 l=0; l < dimN; l++) element+=(op1.data[i])[l]*(op2.data[l])[j];
-	//		p[i][j]=element;
-	//	}
-	//return p;
 }
 //-----------operator*(Vec)---------------------------------------------------------
 template <uint16 dimM1, uint16 dimN1, uint16 dimM2> Vec<dimM1> operator* (const Mat<dimM1,dimN1> &op1, const Vec<dimM2> &op2) {
@@ -379,6 +360,12 @@ double* Mat<dimM,dimN>::ptr ()
 	return data[0].ptr();
 }
 
+template<uint16 dimM, uint16 dimN>
+const double* Mat<dimM,dimN>::ptr () const
+{
+	return data[0].ptr();
+}
+
 
 template<uint16 dimM, uint16 dimN>
 bool Mat<dimM,dimN>::compare (const Mat<dimM,dimN> &B, double eps) {
@@ -607,7 +594,7 @@ public:
 	uint16 getLength () {
 		return dimM*(dimM+1)/2;
 	}
-  Mat<dimM, dimM> toMat();
+  Mat<dimM, dimM> toMat() const;
 	void simple_read (std::istream &st);
 	bool compare (MatSym<dimM> &B, double eps = 1.0e-5);
 	MatSym& operator+= (const MatSym &op);
@@ -618,7 +605,7 @@ public:
       return dimM;
     }
 
-	double data[dimM*(dimM+1)/2];
+	alignas(16) double data[dimM*(dimM+1)/2];
 };
 
 template<uint16 dimM>
@@ -651,7 +638,7 @@ bool MatSym<dimM>::compare (MatSym<dimM> &B, double eps)
 }
 
 template<uint16 dimM>
-Mat<dimM, dimM> MatSym<dimM>::toMat() {
+Mat<dimM, dimM> MatSym<dimM>::toMat() const {
   uint16 ind = 0;
   Mat<dimM,dimM> mat;
   for (uint16 i = 0; i < dimM; i++) {
@@ -678,146 +665,145 @@ MatSym<dimM>& MatSym<dimM>::operator+= (const MatSym<dimM> &op) {
 	return *this;
 }
 
-// [R] = coef * [B]^T*[D]*[B]
+// Calls f(0), f(1), .., f(N-1). The sequence is expanded at compile time, so a reduction over a
+// fixed number of terms written with Unroll<N> becomes straight-line code.
+template <uint16 N>
+struct Unroll {
+  template <class F>
+  static inline void run(const F& f) {
+    Unroll<N-1>::run(f);
+    f(N-1);
+  }
+};
+
+template <>
+struct Unroll<0> {
+  template <class F>
+  static inline void run(const F&) { }
+};
+
+
+// Product kernels for small dense matrices. All of them add the result to [R]. Dimensions are
+// template parameters, so every size used by elements (6x24, 9x24, 3x8, 4x8, 6x12, 24x24, ..) gets
+// its own instantiation. Every entry of the result is a dot product whose terms are expanded by
+// Unroll<> and summed in a register; the loop over the entries of a result row is then vectorized
+// by the compiler (loads from the rows of the right operand are contiguous).
+
+// [R] += coef * [B]^T*[D]*[B]
 // coef - double scalar
 // [B] - common matrix (dimM x dimN)
 // [D] - symmetric matrix (dimM x dimM)
 // [R] - symmetrix matrix (dimN x dimN)
 template<uint16 dimM,uint16 dimN>
-void matBTDBprod (Mat<dimM,dimN> &B, MatSym<dimM> &D, double coef, MatSym<dimN> &R) 
+void matBTDBprod (const Mat<dimM,dimN> &B, const MatSym<dimM> &D, double coef, MatSym<dimN> &R)
 {
-	Mat<dimN,dimM> A;
-	A.zero();
-	double *Ap = A.ptr();
-	double *Bp = B.ptr();
-	double *Dp = D.ptr();
-	double *Rp = R.ptr();
-	uint16 i,j,k;
-
-	//A = BT*D
-		// BT*Du + BT*Dd
-	for (k=0;k<dimM;k++)
-	{
-		j = k; // include diag elem
-		while (j < dimM)
-		{
-			for (i=0;i<dimN;i++)
-			{
-				Ap[i*dimM+j] += Bp[k*dimN+i]*(*Dp);
-			}
-			Dp++;
-			j++;
-		}
-	}
-		// BT*DuT
-		Dp = D.ptr();
-	for (j=0;j<dimM;j++)
-	{
-		k = j + 1; Dp++; //leave the diagonal
-		while (k < dimM)
-		{
-			for (i=0;i<dimN;i++)
-			{
-				Ap[i*dimM+j] += Bp[k*dimN+i]*(*Dp);
-			}
-			Dp++;
-			k++;
-		}
-	}
-
-	//R = A*B
-	for (i=0;i<dimN;i++)
-	{
-		for (j=i;j<dimN;j++)
-		{
-			for (k=0;k<dimM;k++)
-			{
-				*Rp += Ap[i*dimM+k]*Bp[k*dimN+j]*coef;
-			}
-			Rp++;
-		}
-	}
+  const Mat<dimM,dimM> matD = D.toMat();
+  const double* Bp = B.ptr();
+  const double* Dp = matD.ptr();
+  double* Rp = R.ptr();
+
+  // DB = D*B
+  alignas(16) double DB[dimM][dimN];
+  for (uint16 k = 0; k < dimM; k++) {
+    for (uint16 j = 0; j < dimN; j++) {
+      double el = 0.0;
+      Unroll<dimM>::run([&](uint16 l) { el += Dp[k*dimM+l] * Bp[l*dimN+j]; });
+      DB[k][j] = el;
+    }
+  }
 
+  // R = coef * B^T*DB, row `i` of the upper triangle is R[i][i] .. R[i][dimN-1]
+  for (uint16 i = 0; i < dimN; i++) {
+    for (uint16 j = i; j < dimN; j++) {
+      double el = 0.0;
+      Unroll<dimM>::run([&](uint16 k) { el += Bp[k*dimN+i] * DB[k][j]; });
+      Rp[j-i] += el * coef;
+    }
+    Rp += dimN - i;
+  }
 }
 
 
+// [R] += coef * [B]^T*[V]
 template<uint16 dimM,uint16 dimN>
-void matBTVprod(Mat<dimM,dimN> &B, Vec<dimM> &V, double coef, Vec<dimN> &R)
+void matBTVprod(const Mat<dimM,dimN> &B, const Vec<dimM> &V, double coef, Vec<dimN> &R)
 {
 #ifndef NLA3D_USE_BLAS
-	double *Bp = B.ptr();
-	uint16 i,j;
-	for (i=0;i<dimN;i++)
-		for (j=0;j<dimM;j++)
-			R[i] += Bp[j*dimN+i]*V[j]*coef;
+  const double* Bp = B.ptr();
+  const double* Vp = V.ptr();
+  double* Rp = R.ptr();
+  for (uint16 i = 0; i < dimN; i++) {
+    double el = 0.0;
+    Unroll<dimM>::run([&](uint16 j) { el += Bp[j*dimN+i] * Vp[j]; });
+    Rp[i] += el * coef;
+  }
 #else
-  cblas_dgemv(CblasRowMajor, CblasTrans, dimM, dimN, coef, B.ptr(), dimN, V.ptr(), 1, 0.0, R.ptr(), 1);
+  cblas_dgemv(CblasRowMajor, CblasTrans, dimM, dimN, coef, B.ptr(), dimN, V.ptr(), 1, 1.0, R.ptr(), 1);
 #endif
 }
 
+
+// [R] += coef * [B]*[V]
 template<uint16 dimM,uint16 dimN>
-void matBVprod(Mat<dimM,dimN> &B,Vec<dimN> &V, double coef, Vec<dimM> &R) {
+void matBVprod(const Mat<dimM,dimN> &B, const Vec<dimN> &V, double coef, Vec<dimM> &R) {
 #ifndef NLA3D_USE_BLAS
-	double *Bp = B.ptr();
-	uint16 i,j;
-	for (i=0;i<dimM;i++)
-		for (j=0;j<dimN;j++)
-			R[i] += Bp[i*dimN+j]*V[j]*coef;
+  const double* Bp = B.ptr();
+  const double* Vp = V.ptr();
+  double* Rp = R.ptr();
+  for (uint16 i = 0; i < dimM; i++) {
+    double el = 0.0;
+    Unroll<dimN>::run([&](uint16 j) { el += Bp[i*dimN+j] * Vp[j]; });
+    Rp[i] += el * coef;
+  }
 #else
-  cblas_dgemv(CblasRowMajor, CblasNoTrans, dimM, dimN, coef, B.ptr(), dimN, V.ptr(), 1, 0.0, R.ptr(), 1);
+  cblas_dgemv(CblasRowMajor, CblasNoTrans, dimM, dimN, coef, B.ptr(), dimN, V.ptr(), 1, 1.0, R.ptr(), 1);
 #endif
 }
 
+
+// [R] += coef * [B]*[V], [B] is symmetric
 template<uint16 dimM>
-void matBVprod(MatSym<dimM> &B,Vec<dimM> &V, double coef, Vec<dimM> &R) {
-  // TODO: this this inefficient version
-  // convert to regular matrix
-  Mat<dimM, dimM> mB = B.toMat();
-	double *Bp = mB.ptr();
-	uint16 i,j;
-	for (i=0;i<dimM;i++)
-		for (j=0;j<dimM;j++)
-			R[i] += Bp[i*dimM+j]*V[j]*coef;
+void matBVprod(const MatSym<dimM> &B, const Vec<dimM> &V, double coef, Vec<dimM> &R) {
+  matBVprod(B.toMat(), V, coef, R);
 }
 
 
+// [R] += coef * [A]*[B]
 template<uint16 dimM1,uint16 dimN1,uint16 dimN2>
-void matABprod(Mat<dimM1,dimN1> &A, Mat<dimN1,dimN2> &B, const double coef, Mat<dimM1,dimN2> &R) {
+void matABprod(const Mat<dimM1,dimN1> &A, const Mat<dimN1,dimN2> &B, const double coef, Mat<dimM1,dimN2> &R) {
 #ifndef NLA3D_USE_BLAS
-	uint16 i,j,k;
-	double *Rp = R.ptr();
-	double *Ap = A.ptr();
-	double *Bp = B.ptr();
-	for (i=0;i<dimM1;i++) {
-		for (j=0;j<dimN2;j++) {
-			for (k=0;k<dimN1;k++)
-				*Rp += Ap[i*dimN1+k]*Bp[k*dimN2+j]*coef;
-			Rp++;
-		}
-	}
+  const double* Ap = A.ptr();
+  const double* Bp = B.ptr();
+  double* Rp = R.ptr();
+  for (uint16 i = 0; i < dimM1; i++) {
+    for (uint16 j = 0; j < dimN2; j++) {
+      double el = 0.0;
+      Unroll<dimN1>::run([&](uint16 k) { el += Ap[i*dimN1+k] * Bp[k*dimN2+j]; });
+      Rp[i*dimN2+j] += el * coef;
+    }
+  }
 #else
-  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, dimM1, dimN2, dimN1, coef, A.ptr(), dimN1, B.ptr(), dimN2, 0.0, R.ptr(), dimN2);
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, dimM1, dimN2, dimN1, coef, A.ptr(), dimN1, B.ptr(), dimN2, 1.0, R.ptr(), dimN2);
 #endif
 }
 
+
+// [R] += coef * [A]^T*[B]
 template<uint16 dimM1,uint16 dimN1,uint16 dimN2>
-void matATBprod(Mat<dimM1,dimN1> &A, Mat<dimM1,dimN2> &B, const double coef, Mat<dimN1,dimN2> &R)  {
+void matATBprod(const Mat<dimM1,dimN1> &A, const Mat<dimM1,dimN2> &B, const double coef, Mat<dimN1,dimN2> &R)  {
 #ifndef NLA3D_USE_BLAS
-	uint16 i,j,k;
-	double *Rp = R.ptr();
-	double *Ap = A.ptr();
-	double *Bp = B.ptr();
-	for (i=0;i<dimN1;i++)
-	{
-		for (j=0;j<dimN2;j++)
-		{
-			for (k=0;k<dimM1;k++)
-				*Rp += Ap[k*dimN1+i]*Bp[k*dimN2+j]*coef;
-			Rp++;
-		}
-	}
+  const double* Ap = A.ptr();
+  const double* Bp = B.ptr();
+  double* Rp = R.ptr();
+  for (uint16 i = 0; i < dimN1; i++) {
+    for (uint16 j = 0; j < dimN2; j++) {
+      double el = 0.0;
+      Unroll<dimM1>::run([&](uint16 k) { el += Ap[k*dimN1+i] * Bp[k*dimN2+j]; });
+      Rp[i*dimN2+j] += el * coef;
+    }
+  }
 #else
-  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, dimN1, dimN2, dimM1, coef, A.ptr(), dimN1, B.ptr(), dimN2, 0.0, R.ptr(), dimN2);
+  cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, dimN1, dimN2, dimM1, coef, A.ptr(), dimN1, B.ptr(), dimN2, 1.0, R.ptr(), dimN2);
 #endif
 }
 
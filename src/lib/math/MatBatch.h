@@ -0,0 +1,31 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+
+#pragma once
+#include "sys.h"
+
+namespace nla3d {
+namespace math {
+
+// Batched small matrices in structure-of-arrays layout: W matrices of the same size are processed
+// at once, entry e (in Mat/MatSym storage order) of lane l is kept in p[e * W + l]. Batched kernels
+// are written as templates over W: W = 1 gives the kernel for a single matrix, W = BATCH_LANES -
+// for a batch. Both perform for every lane the same floating point operations in the same order, so
+// batched results are identical to the results of one-by-one processing. The innermost loops run
+// over lanes with the fixed trip count and without dependencies between lanes, so they are
+// vectorized by the compiler (SSE2, AVX, AVX-512 depending on target architecture flags).
+const uint16 BATCH_LANES = 8;
+
+#define FOR_EACH_LANE(l, W) \
+  for (uint16 l = 0; l < W; l++)
+
+
+// fill `n` entries of W lanes with zeros
+template <uint16 W>
+inline void zeroBatch(uint32 n, double* p) {
+  std::fill(p, p + n * W, 0.0);
+}
+
+} // namespace math
+} // namespace nla3d
@@ -3,6 +3,9 @@
 // https://github.com/dmitryikh/nla3d 
 
 #include "SparseMatrix.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace nla3d {
 namespace math {
@@ -37,12 +40,28 @@ void SparsityInfo::clear() {
   columns = nullptr;
 
   compressed = false;
+  counting = false;
+  rowFill.clear();
+  rowFill.shrink_to_fit();
   numberOfValues = 0;
+
+  blockSize = 1;
+  upper = false;
+  blocks.reset();
+  rowBlocks.clear();
+  rowBlocks.shrink_to_fit();
+  columnBlocks.clear();
+  columnBlocks.shrink_to_fit();
+  blockRowStart.clear();
+  blockRowStart.shrink_to_fit();
 }
 
 
 void SparsityInfo::reinit(uint32 _nrows, uint32 _ncols, uint32 _max_in_row) {
-  assert (_max_in_row > 0);
+  if (_max_in_row == 0) {
+    startCounting(_nrows, _ncols);
+    return;
+  }
   clear();
 
   nRows = _nrows;
@@ -60,13 +79,123 @@ void SparsityInfo::reinit(uint32 _nrows, uint32 _ncols, uint32 _max_in_row) {
 }
 
 
+void SparsityInfo::startCounting(uint32 _nrows, uint32 _ncols) {
+  clear();
+
+  nRows = _nrows;
+  nColumns = _ncols;
+  maxInRow = 0;
+  counting = true;
+
+  // iofeir[_row] accumulates number of entries in _row
+	iofeir = new uint32[nRows+1];
+  std::fill_n(iofeir, nRows + 1, 0);
+}
+
+
+void SparsityInfo::countEntry(uint32 _i, uint32 _j) {
+  assert(counting == true);
+  assert(_i > 0 && _i <= nRows);
+  assert(_j > 0 && _j <= nColumns);
+  if (blocks) {
+    assert(!upper || _i <= _j);
+    blocks->countEntry(rowBlock(_i - 1) + 1, columnBlock(_j - 1) + 1);
+    return;
+  }
+  iofeir[_i]++;
+}
+
+
+void SparsityInfo::startFilling() {
+  assert(counting == true);
+  if (blocks) {
+    blocks->startFilling();
+    counting = false;
+    return;
+  }
+  iofeir[0] = 1;
+  for (uint32 i = 1; i <= nRows; i++) {
+    iofeir[i] += iofeir[i-1];
+  }
+  numberOfValues = iofeir[nRows] - 1;
+
+	columns = new uint32[numberOfValues];
+  rowFill.resize(nRows);
+  for (uint32 i = 0; i < nRows; i++) {
+    rowFill[i] = iofeir[i] - 1;
+  }
+  counting = false;
+}
+
+
+void SparsityInfo::setBlockPartition(const std::vector<uint32>& _rowBlocks,
+                                     const std::vector<uint32>& _columnBlocks, bool _upper) {
+  CHECK(counting) << "Block storage should be set in counting state before any entry is registered";
+  CHECK(_rowBlocks.size() && _rowBlocks.front() == 0 && _rowBlocks.back() == nRows);
+  CHECK(_columnBlocks.size() && _columnBlocks.front() == 0 && _columnBlocks.back() == nColumns);
+  CHECK(!_upper || _rowBlocks == _columnBlocks)
+    << "Upper triangle storage needs the same groups of rows and columns";
+  uint16 _blockSize = 1;
+  for (auto groups : {&_rowBlocks, &_columnBlocks}) {
+    for (size_t k = 0; k + 1 < groups->size(); k++) {
+      uint32 size = (*groups)[k + 1] - (*groups)[k];
+      CHECK(size > 0 && size <= maxBlockSize) << "Unsupported block size " << size;
+      _blockSize = std::max(_blockSize, static_cast<uint16>(size));
+    }
+  }
+
+  uint32 _nrows = nRows;
+  uint32 _ncols = nColumns;
+  // scalar counters are not needed anymore
+  clear();
+  nRows = _nrows;
+  nColumns = _ncols;
+  counting = true;
+
+  blockSize = _blockSize;
+  upper = _upper;
+  rowBlocks = _rowBlocks;
+  columnBlocks = _columnBlocks;
+  blocks.reset(new SparsityInfo);
+  blocks->startCounting(static_cast<uint32>(rowBlocks.size()) - 1,
+                        static_cast<uint32>(columnBlocks.size()) - 1);
+}
+
+
+void SparsityInfo::setBlockSize(uint16 _blockSize, bool _upper) {
+  CHECK(_blockSize > 0);
+  CHECK(nRows % _blockSize == 0 && nColumns % _blockSize == 0)
+    << "Matrix size should be divisible by the block size";
+  std::vector<uint32> _rowBlocks, _columnBlocks;
+  for (uint32 i = 0; i <= nRows; i += _blockSize) {
+    _rowBlocks.push_back(i);
+  }
+  for (uint32 j = 0; j <= nColumns; j += _blockSize) {
+    _columnBlocks.push_back(j);
+  }
+  setBlockPartition(_rowBlocks, _columnBlocks, _upper);
+}
+
+
 // row and column positions are started from 1
 void SparsityInfo::addEntry(uint32 _i, uint32 _j) {
-  assert(iofeir != nullptr);
-  assert(columns != nullptr);
   assert(_i > 0 && _i <= nRows);
   assert(_j > 0 && _j <= nColumns);
   assert(compressed == false);
+  assert(counting == false);
+  if (blocks) {
+    assert(!upper || _i <= _j);
+    blocks->addEntry(rowBlock(_i - 1) + 1, columnBlock(_j - 1) + 1);
+    return;
+  }
+  assert(iofeir != nullptr);
+  assert(columns != nullptr);
+  if (rowFill.size()) {
+    // two-pass construction: the place for the entry was reserved by countEntry(..)
+    assert(rowFill[_i-1] < iofeir[_i] - 1);
+    columns[rowFill[_i-1]++] = _j;
+    return;
+  }
   // NOTE: before compressions columns are not sorted
   uint32 st = iofeir[_i-1] - 1;
   uint32 en = iofeir[_i] - 1;
@@ -87,6 +216,49 @@ void SparsityInfo::addEntry(uint32 _i, uint32 _j) {
 
 void SparsityInfo::compress() {
   if (compressed) return;
+  if (counting) startFilling();
+
+  if (blocks) {
+    blocks->compress();
+    uint32 nBlockRows = blocks->nRows;
+    blockRowStart.assign(nBlockRows + 1, 0);
+    for (uint32 br = 0; br < nBlockRows; br++) {
+      // the diagonal block keeps only its upper triangle
+      uint32 rb = rowBlocks[br + 1] - rowBlocks[br];
+      uint32 lower = hasDiagBlock(br) ? rb * (rb - 1) / 2 : 0;
+      blockRowStart[br + 1] = blockRowStart[br] + rb * blockRowLength(br) - lower;
+    }
+    numberOfValues = blockRowStart[nBlockRows];
+    compressed = true;
+    return;
+  }
+
+  if (rowFill.size()) {
+    // two-pass construction: sort rows and remove repeated entries in place
+    uint32 next = 0;
+    for (uint32 i = 0; i < nRows; i++) {
+      uint32 st = iofeir[i] - 1;
+      uint32 en = rowFill[i];
+      std::sort(&columns[st], &columns[en]);
+      en = std::unique(&columns[st], &columns[en]) - columns;
+      iofeir[i] = next + 1;
+      for (uint32 j = st; j < en; j++) {
+        columns[next++] = columns[j];
+      }
+    }
+    iofeir[nRows] = next + 1;
+    if (next < numberOfValues) {
+      uint32* old_columns = columns;
+      columns = new uint32[next];
+      std::copy(old_columns, old_columns + next, columns);
+      delete[] old_columns;
+    }
+    numberOfValues = next;
+    rowFill.clear();
+    rowFill.shrink_to_fit();
+    compressed = true;
+    return;
+  }
 
   uint32 next = 0;
   uint32 nextRow = 0;
@@ -114,11 +286,63 @@ void SparsityInfo::compress() {
 }
 
 
+uint32 SparsityInfo::blockRowLength(uint32 _br) {
+  uint32 length = 0;
+  for (uint32 k = blocks->iofeir[_br] - 1; k < blocks->iofeir[_br + 1] - 1; k++) {
+    uint32 bc = blocks->columns[k] - 1;
+    length += columnBlocks[bc + 1] - columnBlocks[bc];
+  }
+  return length;
+}
+
+
+uint32 SparsityInfo::nElementsInRow(uint32 _row) {
+  assert(_row > 0 && _row <= nRows);
+  if (blocks) {
+    uint32 br = rowBlock(_row - 1);
+    uint32 r = _row - 1 - rowBlocks[br];
+    return blockRowLength(br) - (hasDiagBlock(br) ? r : 0);
+  }
+  assert(iofeir != nullptr);
+  return iofeir[_row] - iofeir[_row-1];
+}
+
+
 uint32 SparsityInfo::getIndex(uint32 _i, uint32 _j) {
-  assert(columns);
-  assert(iofeir);
 	assert(_i > 0 && _i <= nRows);
 	assert(_j > 0 && _j <= nColumns);
+  if (blocks) {
+    uint32 br = rowBlock(_i - 1);
+    uint32 bc = columnBlock(_j - 1);
+    uint32 r = _i - 1 - rowBlocks[br];
+    uint32 c = _j - 1 - columnBlocks[bc];
+    uint32 ind = blocks->getIndex(br + 1, bc + 1);
+    if (ind == invalid) return invalid;
+
+    // values of the block row go row by row, the row `r` of the diagonal block has only its upper
+    // triangle part (`r` values less than other rows)
+    uint32 first = blocks->iofeir[br] - 1;
+    bool diag = hasDiagBlock(br);
+    uint32 rb = rowBlocks[br + 1] - rowBlocks[br];
+    uint32 lower = diag ? rb * (rb - 1) / 2 : 0;
+    uint32 length = (blockRowStart[br + 1] - blockRowStart[br] + lower) / rb;
+    uint32 offset = 0;
+    for (uint32 k = first; k < ind; k++) {
+      uint32 col = blocks->columns[k] - 1;
+      offset += columnBlocks[col + 1] - columnBlocks[col];
+    }
+    uint32 start = blockRowStart[br] + r * length - (diag ? r * (r - 1) / 2 : 0);
+    if (!diag) {
+      return start + offset + c;
+    }
+    if (ind == first) {
+      // lower triangle of the diagonal block isn't stored
+      return (c >= r) ? start + c - r : invalid;
+    }
+    return start + offset - r + c;
+  }
+  assert(columns);
+  assert(iofeir);
 
   uint32 ind;
 	uint32 st = iofeir[_i-1] - 1;
@@ -154,10 +378,45 @@ uint32 SparsityInfo::getIndex(uint32 _i, uint32 _j) {
 }
 
 
+CsrIndexArrays::CsrIndexArrays(SparsityInfo& si) {
+  assert(si.compressed);
+  if (!si.blocks) {
+    iofeir = si.iofeir;
+    columns = si.columns;
+    return;
+  }
+
+  const SparsityInfo& blocks = *si.blocks;
+  iofeirData.resize(si.nRows + 1);
+  columnsData.resize(si.numberOfValues);
+  uint32 next = 0;
+  for (uint32 br = 0; br < blocks.nRows; br++) {
+    uint32 first = blocks.iofeir[br] - 1;
+    uint32 last = blocks.iofeir[br + 1] - 1;
+    bool diag = si.hasDiagBlock(br);
+    for (uint32 i = si.rowBlocks[br]; i < si.rowBlocks[br + 1]; i++) {
+      iofeirData[i] = next + 1;
+      for (uint32 k = first; k < last; k++) {
+        uint32 bc = blocks.columns[k] - 1;
+        uint32 j = (diag && k == first) ? i : si.columnBlocks[bc];
+        for ( ; j < si.columnBlocks[bc + 1]; j++) {
+          columnsData[next++] = j + 1;
+        }
+      }
+    }
+  }
+  iofeirData[si.nRows] = next + 1;
+  assert(next == si.numberOfValues);
+  iofeir = iofeirData.data();
+  columns = columnsData.data();
+}
+
+
 void BaseSparseMatrix::printInternalData(std::ostream& out) {
   assert(si);
   assert(values);
   assert(si->compressed);
+  CsrIndexArrays csr(*si);
 
 	out << "values = {";
 	for (uint32 i = 0; i < si->numberOfValues; i++) {
@@ -167,15 +426,15 @@ void BaseSparseMatrix::printInternalData(std::ostream& out) {
 
 	out << "columns = {";
 	for (uint32 i = 0; i < si->nRows; i++) {
-		for (uint32 j = si->iofeir[i] - 1; j < si->iofeir[i + 1] - 1; j++) {
-			out << si->columns[j] << "\t";
+		for (uint32 j = csr.iofeir[i] - 1; j < csr.iofeir[i + 1] - 1; j++) {
+			out << csr.columns[j] << "\t";
     }
 	}
 	out << "}" << std::endl;
 
 	out << "iofeir = {";
 	for (uint32 i = 0; i <= si->nRows; i++) {
-		out << si->iofeir[i] << "\t";
+		out << csr.iofeir[i] << "\t";
   }
 	out << "}" << std::endl;
 }
@@ -185,6 +444,7 @@ void BaseSparseMatrix::writeCoordinateTextFormat(std::ostream& out) {
   assert(si);
   assert(values);
   assert(si->compressed);
+  CsrIndexArrays csr(*si);
   // we need to return back old preferences after usage
   auto old_precision = out.precision(15);
   auto old_flags = out.setf(std::ios_base::scientific, std::ios_base::floatfield);
@@ -192,8 +452,8 @@ void BaseSparseMatrix::writeCoordinateTextFormat(std::ostream& out) {
   out << si->nRows << ' ' << si->nColumns << ' ' << si->numberOfValues << std::endl;
   uint32 total = 0;
   for (uint32 i = 1; i <= si->nRows; i++) {
-    for (uint32 j = si->iofeir[i - 1] - 1; j < si->iofeir[i] - 1; j++) {
-        out << i << ' ' << si->columns[j] << ' ' << values[j] << std::endl;
+    for (uint32 j = csr.iofeir[i - 1] - 1; j < csr.iofeir[i] - 1; j++) {
+        out << i << ' ' << csr.columns[j] << ' ' << values[j] << std::endl;
         total++;
     }
   }
@@ -238,13 +498,15 @@ bool BaseSparseMatrix::compare(const BaseSparseMatrix& op2, double th) {
   }
 
   // third round. compare sparsity patterns
+  CsrIndexArrays csr1(*op1.si);
+  CsrIndexArrays csr2(*op2.si);
   for (uint32 i = 0; i <= op1.nRows(); i++) {
-    if (op1.si->iofeir[i] != op2.si->iofeir[i]) {
+    if (csr1.iofeir[i] != csr2.iofeir[i]) {
       return false;
     }
   }
   for (uint32 i = 0; i < op1.nValues(); i++) {
-    if (op1.si->columns[i] != op2.si->columns[i]) {
+    if (csr1.columns[i] != csr2.columns[i]) {
       return false;
     }
   }
@@ -284,24 +546,14 @@ BaseSparseMatrix::~BaseSparseMatrix() {
 
 void BaseSparseMatrix::reinit(uint32 _nrows, uint32 _ncols, const std::vector<SparseEntry>& entries) {
   // after this procedure we will obtain matrix in already compressed state
-  // TODO: this is not optimal way to fill new Sparse Matrix, actually we can allocate exactly
-  // number of non-zeros at once, as far as we know all entries before initialization
   // NOTE: For SparseSymMatrix the caller should be sure that all entries are in upper triangle.
   //
-  // in case of all zeros matrix
-  if (entries.size() == 0) {
-    si = std::shared_ptr<SparsityInfo>(new SparsityInfo(_nrows, _ncols, 1));
-    compress();
-    return;
-  }
-  // calculate number of entries in every row
-  std::vector<uint32> entriesInRow(_nrows, 0);
+  // init new SparsityInfo in two-pass mode: exactly number of non-zeros is allocated at once
+  si = std::shared_ptr<SparsityInfo>(new SparsityInfo(_nrows, _ncols, 0));
   for (auto& v : entries) {
-    entriesInRow[v.i - 1] += 1;
+    si->countEntry(v.i, v.j);
   }
-  uint32 _max_in_row = *std::max_element(entriesInRow.begin(), entriesInRow.end());
-  // init new SparsityInfo
-  si = std::shared_ptr<SparsityInfo>(new SparsityInfo(_nrows, _ncols, _max_in_row));
+  si->startFilling();
 
   // add non-zero entries into SparsityInfo
   for (auto& v : entries) {
@@ -424,7 +676,9 @@ SparseSymMatrix::SparseSymMatrix(uint32 _nrows, uint32 _max_in_row) :
     BaseSparseMatrix(_nrows, _nrows, _max_in_row)
 {
   assert(si);
-  // NOTE: need to add diagonal elements because MKL PARDISO need it anyway
+  // NOTE: need to add diagonal elements because MKL PARDISO need it anyway. In two-pass
+  // construction mode (_max_in_row == 0) all entries are registered by the caller.
+  if (_max_in_row == 0) return;
   for (uint32 i = 1; i <= si->nRows; i++) {
     si->addEntry(i, i);
   }
@@ -494,28 +748,412 @@ double SparseSymMatrix::value(uint32 _i, uint32 _j) const {
 }
 
 
+// Matrix-vector products below are split between OpenMP threads when the matrix has at least
+// `minValuesForThreads` non-zeros (for smaller matrices the threads overhead is higher than the gain).
+// In the serial build the drivers just run the product over all rows.
+#ifdef _OPENMP
+static const uint32 minValuesForThreads = 32768;
+
+
+static int numberOfThreads(uint32 nValues) {
+  if (nValues >= minValuesForThreads) {
+    return omp_get_max_threads();
+  }
+  return 1;
+}
+
+
+// split rows [0, nRows) into `nChunks` ranges [chunks[t], chunks[t+1]) with almost equal number of
+// non-zero entries. rowValues[i] - index of the first value of the row i (rowValues[nRows] - the end)
+static void splitRowsByValues(const uint32* rowValues, uint32 nRows, int nChunks,
+                              std::vector<uint32>& chunks) {
+  chunks.assign(nChunks + 1, nRows);
+  chunks[0] = 0;
+  uint64 nValues = rowValues[nRows] - rowValues[0];
+  for (int t = 1; t < nChunks; t++) {
+    uint64 target = rowValues[0] + nValues * t / nChunks;
+    chunks[t] = std::lower_bound(rowValues, rowValues + nRows, target) - rowValues;
+  }
+}
+
+
+// Run `product(rowStart, rowEnd)` over the rows (block rows for block storage) split between threads.
+// The product should write only to the entries of its own rows.
+template <typename Product>
+static void parallelRowsProduct(const uint32* rowValues, uint32 nRows, Product product) {
+  int nThreads = numberOfThreads(rowValues[nRows] - rowValues[0]);
+  if (nThreads == 1) {
+    product(0, nRows);
+    return;
+  }
+
+  std::vector<uint32> chunks;
+  splitRowsByValues(rowValues, nRows, nThreads, chunks);
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    product(chunks[t], chunks[t+1]);
+  }
+}
+
+
+// Run `product(rowStart, rowEnd, r, y)` over the rows split between threads. Row products write
+// only to their own entries of `r`, therefore there are no conflicts. Scattered parts (symmetric
+// and transposed products) are written to `y`, that's why every thread has its own buffer for `y`
+// which are summed up in parallel over the result entries at the end.
+// If `ownedFromStart` is true, the product of rows [rowStart, rowEnd) scatters only to the entries
+// starting from rowFirst[rowStart] (upper triangle storage), rowFirst[i] is the first entry of the
+// result owned by the row i, i = 0..nRows (nullptr means rowFirst[i] == i). In one thread `y` is
+// the same as `r`.
+template <typename Product>
+static void parallelProduct(const uint32* rowValues, uint32 nRows, const uint32* rowFirst,
+                            uint32 nResult, bool ownedFromStart, double* r, Product product) {
+  int nThreads = numberOfThreads(rowValues[nRows] - rowValues[0]);
+  if (nThreads == 1) {
+    product(0, nRows, r, r);
+    return;
+  }
+
+  std::vector<uint32> chunks;
+  splitRowsByValues(rowValues, nRows, nThreads, chunks);
+  std::unique_ptr<double[]> buffers(new double[(size_t) nThreads * nResult]);
+  std::vector<uint32> chunkFirst(nThreads + 1);
+  for (int t = 0; t <= nThreads; t++) {
+    chunkFirst[t] = rowFirst ? rowFirst[chunks[t]] : chunks[t];
+  }
+
+#pragma omp parallel num_threads(nThreads)
+  {
+    const int t = omp_get_thread_num();
+    double* y = buffers.get() + (size_t) t * nResult;
+    const uint32 yStart = ownedFromStart ? chunkFirst[t] : 0;
+    std::fill(y + std::min(yStart, nResult), y + nResult, 0.0);
+    product(chunks[t], chunks[t+1], r, y);
+
+#pragma omp barrier
+#pragma omp for schedule(static)
+    for (uint32 i = 0; i < nResult; i++) {
+      double sum = 0.0;
+      for (int t2 = 0; t2 < nThreads; t2++) {
+        if (ownedFromStart && chunkFirst[t2] > i) break;
+        sum += buffers[(size_t) t2 * nResult + i];
+      }
+      r[i] += sum;
+    }
+  }
+}
+#else
+template <typename Product>
+static void parallelRowsProduct(const uint32*, uint32 nRows, Product product) {
+  product(0, nRows);
+}
+
+
+template <typename Product>
+static void parallelProduct(const uint32*, uint32 nRows, const uint32*, uint32, bool, double* r,
+                            Product product) {
+  product(0, nRows, r, r);
+}
+#endif
+
+
+// product of rows [rowStart, rowEnd) of upper triangle symmetric matrix: the row part goes to `r`,
+// the transposed (lower triangle) part goes to `y`
+static void symRowsProduct(const uint32* iofeir, const uint32* columns, const double* values,
+                           const double* v, const double coef, uint32 rowStart, uint32 rowEnd,
+                           double* r, double* y) {
+  for (uint32 i = rowStart; i < rowEnd; i++) {
+    uint32 st = iofeir[i] - 1;
+    uint32 en = iofeir[i+1] - 1;
+    double sum = 0.0;
+    // columns are sorted, therefore diagonal entry goes first
+    if (st < en && columns[st] == i + 1) {
+      sum += values[st] * v[i];
+      st++;
+    }
+    const double cvi = coef * v[i];
+    // column numbers in the row are unique, so the scatter to `y` doesn't have conflicts
+#pragma omp simd reduction(+:sum)
+    for (uint32 j = st; j < en; j++) {
+      const uint32 col = columns[j] - 1;
+      sum += values[j] * v[col];
+      y[col] += values[j] * cvi;
+    }
+    r[i] += coef * sum;
+  }
+}
+
+
+static void rowsProduct(const uint32* iofeir, const uint32* columns, const double* values,
+                        const double* v, const double coef, uint32 rowStart, uint32 rowEnd,
+                        double* r) {
+  for (uint32 i = rowStart; i < rowEnd; i++) {
+    double sum = 0.0;
+#pragma omp simd reduction(+:sum)
+    for (uint32 j = iofeir[i] - 1; j < iofeir[i+1] - 1; j++) {
+      sum += values[j] * v[columns[j] - 1];
+    }
+    r[i] += coef * sum;
+  }
+}
+
+
+// product of rows [rowStart, rowEnd) of the transposed general matrix: y[col] += coef * a * v[i]
+static void transRowsProduct(const uint32* iofeir, const uint32* columns, const double* values,
+                             const double* v, const double coef, uint32 rowStart, uint32 rowEnd,
+                             double* y) {
+  for (uint32 i = rowStart; i < rowEnd; i++) {
+    const double cvi = coef * v[i];
+#pragma omp simd
+    for (uint32 j = iofeir[i] - 1; j < iofeir[i+1] - 1; j++) {
+      y[columns[j] - 1] += values[j] * cvi;
+    }
+  }
+}
+
+
+// Arrays of block storage used by the products below (see SparsityInfo::setBlockPartition()):
+// sparsity of the blocks, first rows (columns) of the groups and the first value of every block row
+struct BlockArrays {
+  const uint32* iofeir;
+  const uint32* columns;
+  const uint32* rowBlocks;
+  const uint32* columnBlocks;
+  const uint32* rowValues;
+};
+
+
+// call `KERNEL<s>` (`KERNEL<rb, s>` for the second macro) with compile time size `s` equal to
+// `size`
+static_assert(SparsityInfo::maxBlockSize == 3, "Block products are instantiated for sizes 1..3");
+#define DISPATCH_BLOCK_SIZE(size, KERNEL, ...) \
+  switch (size) { \
+    case 1: KERNEL<1>(__VA_ARGS__); break; \
+    case 2: KERNEL<2>(__VA_ARGS__); break; \
+    case 3: KERNEL<3>(__VA_ARGS__); break; \
+    default: assert(false); \
+  }
+
+#define DISPATCH_COLUMN_BLOCK_SIZE(size, KERNEL, rb, ...) \
+  switch (size) { \
+    case 1: KERNEL<rb, 1>(__VA_ARGS__); break; \
+    case 2: KERNEL<rb, 2>(__VA_ARGS__); break; \
+    case 3: KERNEL<rb, 3>(__VA_ARGS__); break; \
+    default: assert(false); \
+  }
+
+
+// Block storage versions of the products above. Row ranges are given in block rows. All `rb` rows
+// of a block row are processed at once: the vector entries of a block column are loaded once for
+// all rows and the block products are kept in registers. The products of `rb` x `cb` blocks are
+// instantiated for all sizes of the groups.
+template <uint16 rb, uint16 cb>
+static inline void symBlockProduct(const double** row, const double* vj, const double* cvi,
+                                   double* sum, double* yj) {
+  double t[cb];
+  for (uint16 c = 0; c < cb; c++) {
+    t[c] = 0.0;
+  }
+  for (uint16 ii = 0; ii < rb; ii++) {
+    for (uint16 c = 0; c < cb; c++) {
+      sum[ii] += row[ii][c] * vj[c];
+      t[c] += row[ii][c] * cvi[ii];
+    }
+    row[ii] += cb;
+  }
+  for (uint16 c = 0; c < cb; c++) {
+    yj[c] += t[c];
+  }
+}
+
+
+template <uint16 rb>
+static void symBlockRowProduct(const BlockArrays& a, const double* values, const double* v,
+                               const double coef, uint32 br, double* r, double* y) {
+  uint32 k = a.iofeir[br] - 1;
+  const uint32 last = a.iofeir[br + 1] - 1;
+  const uint32 i0 = a.rowBlocks[br];
+  const bool diag = (k < last && a.columns[k] == br + 1);
+  // the length of the rows if the diagonal block were stored fully
+  const uint32 lower = diag ? rb * (rb - 1) / 2 : 0;
+  const uint32 length = (a.rowValues[br + 1] - a.rowValues[br] + lower) / rb;
+
+  double cvi[rb];
+  double sum[rb];
+  const double* row[rb];
+  row[0] = values + a.rowValues[br];
+  for (uint16 ii = 0; ii < rb; ii++) {
+    cvi[ii] = coef * v[i0 + ii];
+    sum[ii] = 0.0;
+    if (ii + 1 < rb) {
+      row[ii + 1] = row[ii] + length - (diag ? ii : 0);
+    }
+  }
+
+  if (diag) {
+    // upper triangle of the diagonal block
+    for (uint16 ii = 0; ii < rb; ii++) {
+      sum[ii] += row[ii][0] * v[i0 + ii];
+      for (uint16 c = ii + 1; c < rb; c++) {
+        sum[ii] += row[ii][c - ii] * v[i0 + c];
+        y[i0 + c] += row[ii][c - ii] * cvi[ii];
+      }
+      row[ii] += rb - ii;
+    }
+    k++;
+  }
+
+  for (; k < last; k++) {
+    const uint32 bc = a.columns[k] - 1;
+    const uint32 j0 = a.columnBlocks[bc];
+    DISPATCH_COLUMN_BLOCK_SIZE(a.columnBlocks[bc + 1] - j0, symBlockProduct, rb, row, v + j0, cvi,
+                               sum, y + j0);
+  }
+
+  for (uint16 ii = 0; ii < rb; ii++) {
+    r[i0 + ii] += coef * sum[ii];
+  }
+}
+
+
+static void symBlockRowsProduct(const BlockArrays& a, const double* values, const double* v,
+                                const double coef, uint32 rowStart, uint32 rowEnd, double* r,
+                                double* y) {
+  for (uint32 br = rowStart; br < rowEnd; br++) {
+    DISPATCH_BLOCK_SIZE(a.rowBlocks[br + 1] - a.rowBlocks[br], symBlockRowProduct, a, values, v,
+                        coef, br, r, y);
+  }
+}
+
+
+template <uint16 rb, uint16 cb>
+static inline void blockProduct(const double* block, uint32 length, const double* vj,
+                                double* sum) {
+  for (uint16 ii = 0; ii < rb; ii++) {
+    for (uint16 c = 0; c < cb; c++) {
+      sum[ii] += block[ii * length + c] * vj[c];
+    }
+  }
+}
+
+
+template <uint16 rb>
+static void blockRowProduct(const BlockArrays& a, const double* values, const double* v,
+                            const double coef, uint32 br, double* r) {
+  const uint32 first = a.iofeir[br] - 1;
+  const uint32 last = a.iofeir[br + 1] - 1;
+  const double* row = values + a.rowValues[br];
+  const uint32 length = (a.rowValues[br + 1] - a.rowValues[br]) / rb;
+
+  double sum[rb];
+  for (uint16 ii = 0; ii < rb; ii++) {
+    sum[ii] = 0.0;
+  }
+  uint32 pos = 0;
+  for (uint32 k = first; k < last; k++) {
+    const uint32 bc = a.columns[k] - 1;
+    const uint32 j0 = a.columnBlocks[bc];
+    const uint32 cb = a.columnBlocks[bc + 1] - j0;
+    DISPATCH_COLUMN_BLOCK_SIZE(cb, blockProduct, rb, row + pos, length, v + j0, sum);
+    pos += cb;
+  }
+  for (uint16 ii = 0; ii < rb; ii++) {
+    r[a.rowBlocks[br] + ii] += coef * sum[ii];
+  }
+}
+
+
+static void blockRowsProduct(const BlockArrays& a, const double* values, const double* v,
+                             const double coef, uint32 rowStart, uint32 rowEnd, double* r) {
+  for (uint32 br = rowStart; br < rowEnd; br++) {
+    DISPATCH_BLOCK_SIZE(a.rowBlocks[br + 1] - a.rowBlocks[br], blockRowProduct, a, values, v, coef,
+                        br, r);
+  }
+}
+
+
+template <uint16 rb, uint16 cb>
+static inline void transBlockProduct(const double* block, uint32 length, const double* cvi,
+                                     double* yj) {
+  for (uint16 c = 0; c < cb; c++) {
+    double t = 0.0;
+    for (uint16 ii = 0; ii < rb; ii++) {
+      t += block[ii * length + c] * cvi[ii];
+    }
+    yj[c] += t;
+  }
+}
+
+
+template <uint16 rb>
+static void transBlockRowProduct(const BlockArrays& a, const double* values, const double* v,
+                                 const double coef, uint32 br, double* y) {
+  const uint32 first = a.iofeir[br] - 1;
+  const uint32 last = a.iofeir[br + 1] - 1;
+  const double* row = values + a.rowValues[br];
+  const uint32 length = (a.rowValues[br + 1] - a.rowValues[br]) / rb;
+
+  double cvi[rb];
+  for (uint16 ii = 0; ii < rb; ii++) {
+    cvi[ii] = coef * v[a.rowBlocks[br] + ii];
+  }
+  uint32 pos = 0;
+  for (uint32 k = first; k < last; k++) {
+    const uint32 bc = a.columns[k] - 1;
+    const uint32 j0 = a.columnBlocks[bc];
+    const uint32 cb = a.columnBlocks[bc + 1] - j0;
+    DISPATCH_COLUMN_BLOCK_SIZE(cb, transBlockProduct, rb, row + pos, length, cvi, y + j0);
+    pos += cb;
+  }
+}
+
+
+static void transBlockRowsProduct(const BlockArrays& a, const double* values, const double* v,
+                                  const double coef, uint32 rowStart, uint32 rowEnd, double* y) {
+  for (uint32 br = rowStart; br < rowEnd; br++) {
+    DISPATCH_BLOCK_SIZE(a.rowBlocks[br + 1] - a.rowBlocks[br], transBlockRowProduct, a, values, v,
+                        coef, br, y);
+  }
+}
+
+#undef DISPATCH_BLOCK_SIZE
+#undef DISPATCH_COLUMN_BLOCK_SIZE
+
+
 void matBVprod(SparseSymMatrix &B, const dVec &V, const double coef, dVec &R) {
+  assert(B.nRows() == V.size());
+  assert(R.size() >= B.nRows());
+  matBVprod(B, V.ptr(), coef, R.ptr());
+}
+
+
+void matBVprod(SparseSymMatrix &B, const double* v, const double coef, double* r) {
   assert(B.si);
   assert(B.si->compressed);
   assert(B.values);
-  assert(B.nRows() == V.size());
-  assert(R.size() >= B.nRows());
-  // TODO: Try to use BLAS routines and measure speedup
 
-	const double eps = 1e-20;
+  const uint32 n = B.nRows();
+  if (B.si->numberOfValues == 0) return;
 
-  for (uint32 i = 1; i <= B.nRows(); i++) {
-    // walk on lower triangle
-    for (uint32 j = 1; j <= i; j++)
-      if (fabs(V[j-1]) > eps)
-        R[i-1] += B.value(j, i) * V[j-1] * coef;
+  const double* values = B.values;
 
-    // walk on upper triangle
-    // TODO: could be done in more efficient way
-    for (uint32 j = i + 1; j <= B.nRows(); j++)
-      if (fabs(V[j-1]) > eps)
-        R[i-1] += B.value(i, j) * V[j-1] * coef;
+  SparsityInfo& si = *B.si;
+  if (si.blocks) {
+    const BlockArrays a = {si.blocks->iofeir, si.blocks->columns, si.rowBlocks.data(),
+                           si.columnBlocks.data(), si.blockRowStart.data()};
+    parallelProduct(a.rowValues, si.blocks->nRows, a.rowBlocks, n, true, r,
+        [&] (uint32 rowStart, uint32 rowEnd, double* r, double* y) {
+          symBlockRowsProduct(a, values, v, coef, rowStart, rowEnd, r, y);
+        });
+    return;
   }
+
+  const uint32* iofeir = si.iofeir;
+  const uint32* columns = si.columns;
+  parallelProduct(iofeir, n, nullptr, n, true, r,
+      [&] (uint32 rowStart, uint32 rowEnd, double* r, double* y) {
+        symRowsProduct(iofeir, columns, values, v, coef, rowStart, rowEnd, r, y);
+      });
 }
 
 
@@ -525,39 +1163,64 @@ void matBVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R) {
   assert(B.values);
   assert(B.nColumns() == V.size());
   assert(R.size() >= B.nRows());
-  // TODO: Try to use BLAS routines and measure speedup
 
-  for (uint32 i = 1; i <= B.nRows(); i++) {
+  const uint32 n = B.nRows();
+  if (B.si->numberOfValues == 0) return;
 
-    //if no elements in the current row return zero res
-    if (B.si->iofeir[i] - B.si->iofeir[i-1] == 0)
-      continue;
+  const double* values = B.values;
+  const double* v = V.ptr();
+  double* r = R.ptr();
 
-    uint32 st = B.si->iofeir[i-1] - 1;
-    uint32 en = B.si->iofeir[i] - 2;
-
-    for (uint32 j = st; j <= en; j++)
-      R[i-1] += B.values[j] * V[B.si->columns[j]-1] * coef;
+  SparsityInfo& si = *B.si;
+  if (si.blocks) {
+    const BlockArrays a = {si.blocks->iofeir, si.blocks->columns, si.rowBlocks.data(),
+                           si.columnBlocks.data(), si.blockRowStart.data()};
+    parallelRowsProduct(a.rowValues, si.blocks->nRows, [&] (uint32 rowStart, uint32 rowEnd) {
+      blockRowsProduct(a, values, v, coef, rowStart, rowEnd, r);
+    });
+    return;
   }
+
+  const uint32* iofeir = si.iofeir;
+  const uint32* columns = si.columns;
+  parallelRowsProduct(iofeir, n, [&] (uint32 rowStart, uint32 rowEnd) {
+    rowsProduct(iofeir, columns, values, v, coef, rowStart, rowEnd, r);
+  });
 }
 
+
 void matBTVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R) {
   assert(B.si);
   assert(B.si->compressed);
   assert(B.values);
   assert(B.nRows() == V.size());
   assert(R.size() >= B.nColumns());
-  // TODO: Try to use BLAS routines and measure speedup
 
-	for (uint32 i = 1; i <= B.si->nRows; i++) {
-		if (B.si->iofeir[i] - B.si->iofeir[i-1] == 0) {
-			continue;
-    }
-		uint32 st = B.si->iofeir[i-1] - 1;
-		uint32 en = B.si->iofeir[i] - 2;
-		for (uint32 j = st; j <= en; j++)
-      R[B.si->columns[j] - 1] += B.values[j] * V[i-1] * coef;
-	}
+  const uint32 n = B.nRows();
+  const uint32 m = B.nColumns();
+  if (B.si->numberOfValues == 0) return;
+
+  const double* values = B.values;
+  const double* v = V.ptr();
+  double* r = R.ptr();
+
+  SparsityInfo& si = *B.si;
+  if (si.blocks) {
+    const BlockArrays a = {si.blocks->iofeir, si.blocks->columns, si.rowBlocks.data(),
+                           si.columnBlocks.data(), si.blockRowStart.data()};
+    parallelProduct(a.rowValues, si.blocks->nRows, nullptr, m, false, r,
+        [&] (uint32 rowStart, uint32 rowEnd, double*, double* y) {
+          transBlockRowsProduct(a, values, v, coef, rowStart, rowEnd, y);
+        });
+    return;
+  }
+
+  const uint32* iofeir = si.iofeir;
+  const uint32* columns = si.columns;
+  parallelProduct(iofeir, n, nullptr, m, false, r,
+      [&] (uint32 rowStart, uint32 rowEnd, double*, double* y) {
+        transRowsProduct(iofeir, columns, values, v, coef, rowStart, rowEnd, y);
+      });
 }
   
 } // namespace math
@@ -27,10 +27,39 @@ class SparsityInfo {
     SparsityInfo(uint32 _nrows, uint32 _ncols, uint32 _max_in_row);
     ~SparsityInfo();
 
+    // _max_in_row == 0 means exact two-pass construction: SparsityInfo is put into counting state
+    // (see startCounting())
     void reinit(uint32 _nrows, uint32 _ncols, uint32 _max_in_row);
     // add information than (_row, _column) entries has non-zero value
     // _i, _j indexes are started from 1
     void addEntry(uint32 _i, uint32 _j);
+
+    // Two-pass construction of the sparsity without maxInRow limit: at first all entries are
+    // counted with countEntry(..), then startFilling() allocates exactly the counted number of
+    // positions and the same entries should be added by addEntry(..). Repeated entries are allowed,
+    // they are removed in compress().
+    void startCounting(uint32 _nrows, uint32 _ncols);
+    void countEntry(uint32 _i, uint32 _j);
+    void startFilling();
+
+    // Block storage: rows and columns are split into small groups (DoFs of a node, of an element,
+    // ..) and the sparsity is kept only for the dense blocks formed by the groups. It cuts the
+    // memory for column indexes by the number of entries in a block and allows register-blocked
+    // matrix-vector products. `_rowBlocks` holds the first row (0-based) of every group of rows
+    // followed by nRows, `_columnBlocks` - the same for columns. Groups of 1 to maxBlockSize rows
+    // are supported. Values are placed in the same order as in scalar CSR (row by row), the
+    // diagonal blocks of upper triangle storage (`_upper` = true, row and column groups should be
+    // the same) hold only their upper triangle. Should be called in counting state (two-pass
+    // construction), scalar entries passed to countEntry/addEntry register the whole block.
+    void setBlockPartition(const std::vector<uint32>& _rowBlocks,
+                           const std::vector<uint32>& _columnBlocks, bool _upper);
+    // block storage with all groups of `_blockSize` rows and columns
+    void setBlockSize(uint16 _blockSize, bool _upper);
+    bool isBlockStorage();
+    // the largest group of rows in block storage (1 for scalar storage)
+    uint16 getBlockSize();
+    static const uint16 maxBlockSize = 3;
+
     // perform compression procedure. After that positions of non-zero entries can't be changed
     void compress();
     bool isCompressed();
@@ -39,16 +68,27 @@ class SparsityInfo {
     uint32 nElementsInRow(uint32 _row);
     // get index in values array (see SparseMatrix implementation) for entry position _i, _j
     uint32 getIndex(uint32 _i, uint32 _j);
+    // memory used by the index arrays (in bytes)
+    uint64 getIndexMemory();
 
     friend class BaseSparseMatrix;
     friend class SparseMatrix;
     friend class SparseSymMatrix;
-    friend void matBVprod(SparseSymMatrix &B, const dVec &V, const double coef, dVec &R);
+    friend class CsrIndexArrays;
+    friend void matBVprod(SparseSymMatrix &B, const double* v, const double coef, double* r);
     friend void matBVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R);
     friend void matBTVprod(SparseMatrix &B, const dVec &V, const double coef, dVec &R);
 
   private:
     void clear();
+    // block storage: group of rows (columns) containing the row (column) `_pos` (0-based)
+    uint32 rowBlock(uint32 _pos);
+    uint32 columnBlock(uint32 _pos);
+    // block storage: whether the block row `_br` starts with the diagonal block (upper storage)
+    bool hasDiagBlock(uint32 _br);
+    // block storage: number of values in a row of the block row `_br` if the diagonal block were
+    // stored fully (the sum of all block columns sizes)
+    uint32 blockRowLength(uint32 _br);
 
     // Data arrays to implement compressed sparse row format with 3 arrays (3-array CSR).
     // Format was implemented by using MKL manual.
@@ -63,6 +103,21 @@ class SparsityInfo {
     uint32 numberOfValues = 0;
     uint32 maxInRow = 0;
     bool compressed = false;
+    // two-pass construction state: iofeir holds number of entries in rows while counting,
+    // rowFill[_row-1] is the next free position in the row while filling
+    bool counting = false;
+    std::vector<uint32> rowFill;
+
+    // block storage (see setBlockPartition()): sparsity of the blocks, groups of rows and columns
+    // and index of the first value of every block row (blockRowStart[nBlockRows] ==
+    // numberOfValues). Scalar `iofeir` and `columns` aren't kept for block storage (see
+    // CsrIndexArrays).
+    uint16 blockSize = 1;
+    bool upper = false;
+    std::unique_ptr<SparsityInfo> blocks;
+    std::vector<uint32> rowBlocks;
+    std::vector<uint32> columnBlocks;
+    std::vector<uint32> blockRowStart;
 
     // size of the matrix
     uint32 nRows = 0;
@@ -71,6 +126,23 @@ class SparsityInfo {
     static const uint32 invalid;
 };
 
+// Scalar CSR index arrays (1-based `iofeir` and `columns`, see SparsityInfo) of a sparse matrix.
+// For scalar storage they point to the arrays of SparsityInfo, block storage is expanded into the
+// arrays owned by the object. Code working with raw CSR arrays (equation solvers) keeps the object
+// only while it needs them, so the expansion doesn't live as long as the matrix.
+class CsrIndexArrays {
+  public:
+    CsrIndexArrays(SparsityInfo& si);
+
+    const uint32* iofeir = nullptr;
+    const uint32* columns = nullptr;
+
+  private:
+    std::vector<uint32> iofeirData;
+    std::vector<uint32> columnsData;
+};
+
+
 // structure to describe entry in sparse matrix. Used in one of several matrix initialization
 // approaches.
 struct SparseEntry {
@@ -93,6 +165,9 @@ class BaseSparseMatrix {
     void reinit(uint32 _nrows, uint32 _ncols, const std::vector<SparseEntry>& entries);
     // perform compression procedure, after this new entries can't be added to matrix
     void compress();
+    // finish counting of entries in two-pass sparsity construction, after this the counted
+    // entries should be added by addEntry(..) (see SparsityInfo::startCounting())
+    void startFilling();
 
     // for debug purpose
     void printInternalData (std::ostream& out);
@@ -112,6 +187,7 @@ class BaseSparseMatrix {
 
     // getters
     double* getValuesArray();
+    // CSR index arrays of scalar storage. For block storage use CsrIndexArrays.
     uint32* getColumnsArray();
     uint32* getIofeirArray();
     uint32 nValues() const;
@@ -141,6 +217,12 @@ class SparseMatrix : public BaseSparseMatrix {
 
     // add non-zero entry to sparse matrix. This should be called before compress(). 
     void addEntry(uint32 _i, uint32 _j);
+    // count non-zero entry for two-pass sparsity construction (see SparsityInfo::startCounting())
+    void countEntry(uint32 _i, uint32 _j);
+    // use block storage (see SparsityInfo::setBlockPartition())
+    void setBlockPartition(const std::vector<uint32>& _rowBlocks,
+                           const std::vector<uint32>& _columnBlocks);
+    void setBlockSize(uint16 _blockSize);
 
     // add value to the _i, _j entry. This should be called after compress().
     void addValue(uint32 _i, uint32 _j, double value);
@@ -169,6 +251,11 @@ class SparseSymMatrix : public BaseSparseMatrix {
     
     // add non-zero entry to sparse matrix. This should be called before compress(). 
     void addEntry(uint32 _i, uint32 _j);
+    // count non-zero entry for two-pass sparsity construction (see SparsityInfo::startCounting())
+    void countEntry(uint32 _i, uint32 _j);
+    // use block storage (see SparsityInfo::setBlockPartition())
+    void setBlockPartition(const std::vector<uint32>& _blocks);
+    void setBlockSize(uint16 _blockSize);
 
     // add value to the _i, _j entry. This should be called after compress().
     void addValue(uint32 _i, uint32 _j, double value);
@@ -183,6 +270,8 @@ class SparseSymMatrix : public BaseSparseMatrix {
     double value(uint32 _i, uint32 _j) const;
 
     friend void matBVprod(SparseSymMatrix &B, const dVec &V, const double coef, dVec &R);
+    // the same product on raw arrays of nRows() size
+    friend void matBVprod(SparseSymMatrix &B, const double* v, const double coef, double* r);
 };
 
 
@@ -190,10 +279,38 @@ inline bool SparsityInfo::isCompressed() {
     return compressed;
 }
 
-inline uint32 SparsityInfo::nElementsInRow(uint32 _row) {
-    assert(iofeir != nullptr);
-    assert(_row > 0 && _row <= nRows);
-    return iofeir[_row] - iofeir[_row-1];
+inline uint64 SparsityInfo::getIndexMemory() {
+  uint64 mem = 0;
+  if (iofeir) mem += (nRows + 1) * sizeof(uint32);
+  if (columns) mem += (uint64) numberOfValues * sizeof(uint32);
+  if (blocks) {
+    mem += blocks->getIndexMemory();
+    mem += (rowBlocks.size() + columnBlocks.size() + blockRowStart.size()) * sizeof(uint32);
+  }
+  return mem;
+}
+
+inline bool SparsityInfo::isBlockStorage() {
+  return blocks != nullptr;
+}
+
+inline uint16 SparsityInfo::getBlockSize() {
+  return blockSize;
+}
+
+inline uint32 SparsityInfo::rowBlock(uint32 _pos) {
+  return static_cast<uint32>(std::upper_bound(rowBlocks.begin(), rowBlocks.end(), _pos) -
+                             rowBlocks.begin()) - 1;
+}
+
+inline uint32 SparsityInfo::columnBlock(uint32 _pos) {
+  return static_cast<uint32>(std::upper_bound(columnBlocks.begin(), columnBlocks.end(), _pos) -
+                             columnBlocks.begin()) - 1;
+}
+
+inline bool SparsityInfo::hasDiagBlock(uint32 _br) {
+  uint32 first = blocks->iofeir[_br] - 1;
+  return upper && first < blocks->iofeir[_br + 1] - 1 && blocks->columns[first] == _br + 1;
 }
 
 
@@ -211,12 +328,14 @@ inline double* BaseSparseMatrix::getValuesArray() {
 inline uint32* BaseSparseMatrix::getColumnsArray() {
   assert(si);
   assert(si->compressed);
+  CHECK(!si->blocks) << "Block storage doesn't keep scalar CSR arrays, use CsrIndexArrays";
   return si->columns;
 }
 
 inline uint32* BaseSparseMatrix::getIofeirArray() {
   assert(si);
   assert(si->compressed);
+  CHECK(!si->blocks) << "Block storage doesn't keep scalar CSR arrays, use CsrIndexArrays";
   return si->iofeir;
 }
 
@@ -240,6 +359,11 @@ inline std::shared_ptr<SparsityInfo> BaseSparseMatrix::getSparsityInfo() {
   return si;
 }
 
+inline void BaseSparseMatrix::startFilling() {
+  assert(si);
+  si->startFilling();
+}
+
 inline bool BaseSparseMatrix::isCompressed() {
   assert(si);
   return si->compressed;
@@ -251,6 +375,22 @@ inline void SparseMatrix::addEntry(uint32 _i, uint32 _j) {
   si->addEntry(_i, _j);
 }
 
+inline void SparseMatrix::countEntry(uint32 _i, uint32 _j) {
+  assert(si);
+  si->countEntry(_i, _j);
+}
+
+inline void SparseMatrix::setBlockPartition(const std::vector<uint32>& _rowBlocks,
+                                            const std::vector<uint32>& _columnBlocks) {
+  assert(si);
+  si->setBlockPartition(_rowBlocks, _columnBlocks, false);
+}
+
+inline void SparseMatrix::setBlockSize(uint16 _blockSize) {
+  assert(si);
+  si->setBlockSize(_blockSize, false);
+}
+
 inline void SparseMatrix::addValue(uint32 _i, uint32 _j, double value) {
   this->operator()(_i, _j) += value;
 }
@@ -264,6 +404,23 @@ inline void SparseSymMatrix::addEntry(uint32 _i, uint32 _j) {
   si->addEntry(_i, _j);
 }
 
+inline void SparseSymMatrix::countEntry(uint32 _i, uint32 _j) {
+  assert(si);
+
+	if (_i > _j) std::swap(_i, _j);
+  si->countEntry(_i, _j);
+}
+
+inline void SparseSymMatrix::setBlockPartition(const std::vector<uint32>& _blocks) {
+  assert(si);
+  si->setBlockPartition(_blocks, _blocks, true);
+}
+
+inline void SparseSymMatrix::setBlockSize(uint16 _blockSize) {
+  assert(si);
+  si->setBlockSize(_blockSize, true);
+}
+
 inline void SparseSymMatrix::addValue(uint32 _i, uint32 _j, double value) {
   this->operator()(_i, _j) += value;
 }
@@ -84,6 +84,12 @@ double* dVec::ptr() {
 }
 
 
+const double* dVec::ptr() const {
+  assert(data);
+  return data;
+}
+
+
 void dVec::clear() {
   if (memory_owner && data) {
     delete[] data;
@@ -55,6 +55,7 @@ public:
   template <uint16 dim1>
     friend Vec operator* (const double op1, const Vec<dim1> &op2);
 	double* ptr ();
+	const double* ptr () const;
 private:
 	double data[dim];
 };
@@ -168,6 +169,10 @@ template<uint16 dim> double* Vec<dim>::ptr ()
 {
 	return data;
 }
+template<uint16 dim> const double* Vec<dim>::ptr () const
+{
+	return data;
+}
 //-------------------------------------------------------
 template<uint16 dim> bool Vec<dim>::compare (Vec<dim>& V, double eps)
 {
@@ -213,6 +218,7 @@ class dVec {
     uint32 size() const;
     void zero();
     double* ptr();
+    const double* ptr() const;
     void clear();
     void fill(double val);
 
@@ -24,6 +24,9 @@ namespace options {
   std::string materialName = "";
   ElementType elementType = ElementType::SOLID81;
   bool useVtk = true;
+  bool useLineSearch = true;
+  bool useAdaptiveStepping = false;
+  bool useBlockStorage = false;
   std::string modelFilename = "";
   std::vector<double> materialConstants;
   std::string refCurveFilename = ""; 
@@ -34,6 +37,16 @@ namespace options {
   uint32 rigidBodyMasterNode = 0;
   std::string rigidBodySlavesComponent = "";
   std::vector<Dof::dofType> rigidBodyDofs;
+
+  // the native sparse LDL^T solver needs a fill-reducing ordering, PARDISO computes its own one
+#ifdef NLA3D_USE_MKL
+  FEStorage::EquationOrdering ordering = FEStorage::NATURAL_ORDERING;
+#else
+  FEStorage::EquationOrdering ordering = FEStorage::NESTED_DISSECTION_ORDERING;
+#endif
+
+  NonlinearFESolver::IterationMethod iterationMethod = NonlinearFESolver::FULL_NEWTON;
+  uint16 refactorizeIterations = 0;
 };
 
 bool parse_args (int argc, char* argv[]) {
@@ -47,6 +60,18 @@ bool parse_args (int argc, char* argv[]) {
     options::useVtk = false;
   }
 
+  if(cmdOptionExists(argv, argv+argc, "-nolinesearch")) {
+    options::useLineSearch = false;
+  }
+
+  if(cmdOptionExists(argv, argv+argc, "-cutback")) {
+    options::useAdaptiveStepping = true;
+  }
+
+  if(cmdOptionExists(argv, argv+argc, "-blockstorage")) {
+    options::useBlockStorage = true;
+  }
+
   char* tmp = getCmdOption(argv, argv + argc, "-iterations");
   if (tmp) {
     options::numberOfIterations = atoi(tmp);
@@ -120,6 +145,43 @@ bool parse_args (int argc, char* argv[]) {
     }
   }
 
+  tmp = getCmdOption(argv, argv + argc, "-ordering");
+  if (tmp) {
+    std::string name = tmp;
+    if (name == "natural") {
+      options::ordering = FEStorage::NATURAL_ORDERING;
+    } else if (name == "rcm") {
+      options::ordering = FEStorage::RCM_ORDERING;
+    } else if (name == "amd") {
+      options::ordering = FEStorage::AMD_ORDERING;
+    } else if (name == "nd") {
+      options::ordering = FEStorage::NESTED_DISSECTION_ORDERING;
+    } else {
+      LOG(ERROR) << "Unknown equations ordering " << name << ". Use natural, rcm, amd or nd.";
+      std::exit(1);
+    }
+  }
+
+  tmp = getCmdOption(argv, argv + argc, "-method");
+  if (tmp) {
+    std::string name = tmp;
+    if (name == "newton") {
+      options::iterationMethod = NonlinearFESolver::FULL_NEWTON;
+    } else if (name == "modified") {
+      options::iterationMethod = NonlinearFESolver::MODIFIED_NEWTON;
+    } else if (name == "bfgs") {
+      options::iterationMethod = NonlinearFESolver::BFGS;
+    } else {
+      LOG(ERROR) << "Unknown iteration method " << name << ". Use newton, modified or bfgs.";
+      std::exit(1);
+    }
+  }
+
+  tmp = getCmdOption(argv, argv + argc, "-refactorize");
+  if (tmp) {
+    options::refactorizeIterations = atoi(tmp);
+  }
+
   return true;
 }
 
@@ -130,10 +192,16 @@ void usage () {
       << "\t[-iterations 'number of iterations']\n"
       << "\t[-loadsteps 'number of loadsteps']\n"
       << "\t[-novtk]\n"
+      << "\t[-nolinesearch]\n"
+      << "\t[-cutback]\n"
+      << "\t[-blockstorage]\n"
       << "\t[-refcurve 'file with curve']\n"
       << "\t[-threshold 'epsilob for comparison']\n"
       << "\t[-reaction 'component name' ['DoF' ..]]\n"
-      << "\t[-rigidbody 'master node' 'component of slaves' ['DoF' ..]]";
+      << "\t[-rigidbody 'master node' 'component of slaves' ['DoF' ..]]\n"
+      << "\t[-ordering natural|rcm|amd|nd]\n"
+      << "\t[-method newton|modified|bfgs]\n"
+      << "\t[-refactorize 'number of iterations']";
 }
 
 int main (int argc, char* argv[]) {
@@ -178,6 +246,8 @@ int main (int argc, char* argv[]) {
     mat->Ci(i) = options::materialConstants[i];
   }
   storage.material = mat;
+  storage.setEquationOrdering(options::ordering);
+  storage.setBlockStorage(options::useBlockStorage);
   LOG(INFO) << "Material: " << mat->toString();
 
   LOG(INFO) << "Loaded components:";
@@ -224,6 +294,10 @@ int main (int argc, char* argv[]) {
   solver.attachFEStorage (&storage);
   solver.numberOfIterations = options::numberOfIterations;
   solver.numberOfLoadsteps = options::numberOfLoadsteps;
+  solver.useLineSearch = options::useLineSearch;
+  solver.useAdaptiveStepping = options::useAdaptiveStepping;
+  solver.iterationMethod = options::iterationMethod;
+  solver.refactorizeIterations = options::refactorizeIterations;
     // NOTE: use PARDISO eq. solver by default (if accessible..)
 #ifdef NLA3D_USE_MKL
     math::PARDISO_equationSolver eqSolver = math::PARDISO_equationSolver();
@@ -10,6 +10,7 @@
 #include "materials/MaterialFactory.h"
 #include "FEReaders.h"
 #include "elements/TETRA0.h"
+#include "math/EquationSolver.h"
 #include <tuple>
 
 using namespace nla3d;
@@ -20,6 +21,17 @@ typedef std::vector<math::MatSym<3>> stress_vec_t;
 disp_vec_t readDispData (std::string filename);
 stress_vec_t readStressData (std::string filename);
 
+// AMG preconditioner without rigid body modes
+class ScalarAMGEquationSolver : public math::PCGEquationSolver {
+public:
+    virtual bool isNearNullSpaceNeeded() { return false; }
+};
+
+void buildModel (MeshData& md, FEStorage& storage, FESolver& solver);
+uint32 solveWithAMG (MeshData& md, math::PCGEquationSolver& pcg, FEStorage& reference);
+void checkElementCache (MeshData& md);
+void checkElementStates (FEStorage& storage);
+
 int main (int argc, char* argv[]) {
     std::string cdb_filename;
     std::string res_disp_filename;
@@ -45,7 +57,62 @@ int main (int argc, char* argv[]) {
 
 	FEStorage storage;
 	LinearFESolver solver;
+    buildModel(md, storage, solver);
+
+#ifdef NLA3D_USE_MKL
+    math::PARDISO_equationSolver eqSolver = math::PARDISO_equationSolver();
+    solver.attachEquationSolver(&eqSolver);
+#endif
+	solver.attachFEStorage (&storage);
+
+	// VtkProcessor* vtk = new VtkProcessor (&storage, "tetra");
+    // solver.addPostProcessor(vtk);
+    // vtk->writeAllResults();
 
+    solver.solve();
+
+    // check displacements results with Ansys data
+    if (res_disp_filename != "") {
+        auto ans_disps = readDispData(res_disp_filename);
+        for (uint32 i = 1; i <= storage.nNodes(); i++) {
+            const double dx = storage.getNodeDofSolution(i, Dof::UX);
+            const double dy = storage.getNodeDofSolution(i, Dof::UY);
+            const double dz = storage.getNodeDofSolution(i, Dof::UZ);
+            const auto& ans_disp = ans_disps[i - 1];
+            CHECK_EQTH(dx, std::get<0>(ans_disp), 1.0e-10);
+            CHECK_EQTH(dy, std::get<1>(ans_disp), 1.0e-10);
+            CHECK_EQTH(dz, std::get<2>(ans_disp), 1.0e-10);
+        }
+    }
+
+    // check stress results with Ansys data
+    if (res_stress_filename != "") {
+        auto ans_stresses = readStressData(res_stress_filename);
+        math::MatSym<3> mat;
+        for (uint32 i = 1; i <= storage.nElements(); i++) {
+            mat.zero();
+            storage.getElement(i).getTensor(&mat, tensorQuery::E);
+            CHECK(mat.compare(ans_stresses[i - 1], 1.0e-3));
+        }
+    }
+
+    // the same model with PCG + AMG: FESolver passes rigid body modes to the preconditioner through
+    // EquationSolver::setNearNullSpace(). Without them AMG coarsens the elasticity problem like a
+    // scalar one and CG needs more iterations.
+    math::PCGEquationSolver pcg;
+    ScalarAMGEquationSolver scalarPcg;
+    uint32 iterations = solveWithAMG(md, pcg, storage);
+    uint32 scalarIterations = solveWithAMG(md, scalarPcg, storage);
+    LOG(INFO) << "PCG + AMG iterations: " << iterations << " with rigid body modes, "
+              << scalarIterations << " without";
+    CHECK(iterations < scalarIterations);
+
+    checkElementCache(md);
+    checkElementStates(storage);
+}
+
+
+void buildModel (MeshData& md, FEStorage& storage, FESolver& solver) {
 	// add nodes
 	auto sind = storage.createNodes(md.nodesNumbers.size());
 	for (uint32 i = 0; i < sind.size(); i++) {
@@ -73,45 +140,140 @@ int main (int argc, char* argv[]) {
     for (auto& v : md.fixBcs) {
       solver.addFix(v.node, v.node_dof, v.value);
     }
+}
 
-#ifdef NLA3D_USE_MKL
-    math::PARDISO_equationSolver eqSolver = math::PARDISO_equationSolver();
-    solver.attachEquationSolver(&eqSolver);
-#endif
-	solver.attachFEStorage (&storage);
-
-	// VtkProcessor* vtk = new VtkProcessor (&storage, "tetra");
-    // solver.addPostProcessor(vtk);
-    // vtk->writeAllResults();
 
+// solve the model with `pcg` (AMG preconditioner), check displacements against the direct solution
+// in `reference` and return the number of CG iterations
+uint32 solveWithAMG (MeshData& md, math::PCGEquationSolver& pcg, FEStorage& reference) {
+    FEStorage storage;
+    LinearFESolver solver;
+    buildModel(md, storage, solver);
+    pcg.setPreconditioner(math::PCGEquationSolver::AMG);
+    pcg.setTolerance(1.0e-12);
+    solver.attachEquationSolver(&pcg);
+    solver.attachFEStorage(&storage);
     solver.solve();
 
-    // check displacements results with Ansys data
-    if (res_disp_filename != "") {
-        auto ans_disps = readDispData(res_disp_filename);
-        for (uint32 i = 1; i <= storage.nNodes(); i++) {
-            const double dx = storage.getNodeDofSolution(i, Dof::UX);
-            const double dy = storage.getNodeDofSolution(i, Dof::UY);
-            const double dz = storage.getNodeDofSolution(i, Dof::UZ);
-            const auto& ans_disp = ans_disps[i - 1];
-            CHECK_EQTH(dx, std::get<0>(ans_disp), 1.0e-10);
-            CHECK_EQTH(dy, std::get<1>(ans_disp), 1.0e-10);
-            CHECK_EQTH(dz, std::get<2>(ans_disp), 1.0e-10);
+    for (uint32 i = 1; i <= storage.nNodes(); i++) {
+        for (auto type : {Dof::UX, Dof::UY, Dof::UZ}) {
+            CHECK_EQTH(storage.getNodeDofSolution(i, type), reference.getNodeDofSolution(i, type),
+                       1.0e-10);
         }
     }
+    return pcg.getLastIterations();
+}
 
-    // check stress results with Ansys data
-    if (res_stress_filename != "") {
-        auto ans_stresses = readStressData(res_stress_filename);
-        math::MatSym<3> mat;
+// global matrices assembled from the element cache (see FEStorage::setElementCache()) should be
+// the same as the ones computed by the elements
+void checkElementCache (MeshData& md) {
+    FEStorage cached, fresh;
+    LinearFESolver solverCached, solverFresh;
+    buildModel(md, cached, solverCached);
+    buildModel(md, fresh, solverFresh);
+    fresh.setElementCache(false);
+    for (auto storage : {&cached, &fresh}) {
+        storage->initDofs();
+        for (auto& v : md.fixBcs) {
+            storage->setConstrainedNodeDof(v.node, v.node_dof);
+        }
+        storage->assignEquationNumbers();
+        storage->initSolutionData();
+    }
+    auto assembleAndCompare = [&cached, &fresh] () {
+        cached.assembleGlobalEqMatrices();
+        fresh.assembleGlobalEqMatrices();
+        math::BlockSparseSymMatrix<2>& K = *cached.getK();
+        math::BlockSparseSymMatrix<2>& Kfresh = *fresh.getK();
+        CHECK(K.block(1)->compare(*Kfresh.block(1), 0.0));
+        CHECK(K.block(2)->compare(*Kfresh.block(2), 0.0));
+        CHECK(K.block(1, 2)->compare(*Kfresh.block(1, 2), 0.0));
+        CHECK(cached.getF()->compare(*fresh.getF(), 0.0));
+    };
+
+    // the first assembly fills the cache, the second one replays it
+    assembleAndCompare();
+    assembleAndCompare();
+
+    // strains and stresses found by update() aren't loads, the elements stay linear after the
+    // solution
+    for (auto storage : {&cached, &fresh}) {
+        for (uint32 i = 1; i <= storage->nElements(); i++) {
+            ElementTETRA0& el = dynamic_cast<ElementTETRA0&>(storage->getElement(i));
+            el.strains = {1.0e-3, 0.0, 0.0, 2.0e-3, 0.0, 0.0};
+            el.stress = {1.0, 0.0, 0.0, 2.0, 0.0, 0.0};
+            CHECK(el.isLinear());
+        }
+    }
+    assembleAndCompare();
+
+    // thermal loads depend on the temperature, such elements are computed on every assembly
+    double previousNorm = 0.0;
+    for (double T : {10.0, 20.0}) {
+        for (auto storage : {&cached, &fresh}) {
+            for (uint32 i = 1; i <= storage->nElements(); i++) {
+                ElementTETRA0& el = dynamic_cast<ElementTETRA0&>(storage->getElement(i));
+                el.alpha = 1.0e-5;
+                el.T = T;
+                CHECK(!el.isLinear());
+            }
+        }
+        assembleAndCompare();
+        math::dVec& F = *cached.getF();
+        double norm = 0.0;
+        for (uint32 i = 0; i < F.size(); i++) {
+            norm += F[i] * F[i];
+        }
+        CHECK(norm > previousNorm);
+        previousNorm = norm;
+    }
+
+    // initial strain loads are computed on every assembly as well
+    for (auto storage : {&cached, &fresh}) {
+        for (uint32 i = 1; i <= storage->nElements(); i++) {
+            ElementTETRA0& el = dynamic_cast<ElementTETRA0&>(storage->getElement(i));
+            el.T = 0.0;
+            el.initialStrains = {1.0e-5, 0.0, 0.0, 0.0, 0.0, 0.0};
+            CHECK(!el.isLinear());
+        }
+    }
+    assembleAndCompare();
+    math::dVec& F = *cached.getF();
+    double norm = 0.0;
+    for (uint32 i = 0; i < F.size(); i++) {
+        norm += F[i] * F[i];
+    }
+    CHECK(norm > 0.0);
+}
+
+
+// strains and stresses of the solved model are rolled back by FEStorage::restoreElementStates()
+void checkElementStates (FEStorage& storage) {
+    auto elementStresses = [&storage] () {
+        std::vector<double> stresses;
         for (uint32 i = 1; i <= storage.nElements(); i++) {
+            math::MatSym<3> mat;
             mat.zero();
-            storage.getElement(i).getTensor(&mat, tensorQuery::E);
-            CHECK(mat.compare(ans_stresses[i - 1], 1.0e-3));
+            CHECK(storage.getElement(i).getTensor(&mat, tensorQuery::E));
+            stresses.insert(stresses.end(), mat.ptr(), mat.ptr() + 6);
         }
+        return stresses;
+    };
+    storage.saveElementStates();
+    std::vector<double> saved = elementStresses();
+    math::dVec& U = *storage.getU();
+    math::dVec U0 = U;
+    for (uint32 i = 0; i < U.size(); i++) {
+        U[i] *= 2.0;
     }
+    storage.updateResults();
+    CHECK(elementStresses() != saved);
+    U = U0;
+    storage.restoreElementStates();
+    CHECK(elementStresses() == saved);
 }
 
+
 disp_vec_t readDispData (std::string filename) {
     disp_vec_t disp_vec;
     std::ifstream file(filename);
@@ -176,4 +176,82 @@ int main () {
 
   // next step to no where..
   CHECK(tc.nextStep(dt) == false);
+
+  // substeps of loadsteps with rolled back steps:
+  // Step 1: dt = 0.5 (stopped at 0.25), currentTime = 0.25, rolled back after 3 iterations
+  // Step 1: dt = 0.125, currentTime = 0.125, numberOfEquilibrium = 1
+  // Step 2: dt = 0.125, currentTime = 0.25, numberOfEquilibrium = 2
+  // Step 3: dt = 0.25 (stopped at 0.5), currentTime = 0.5, rolled back after 1 iteration and
+  //         repeated with dt = 0.25, numberOfEquilibrium = 1
+  // Step 4: dt = 0.5 (stop time is endTime up to round-off), currentTime = 1.0
+  TimeControl tc2;
+  tc2.setStartTime(0.0);
+  tc2.setEndTime(1.0);
+
+  CHECK(tc2.nextStep(0.5, 0.25));
+  tc2.nextEquilibriumStep();
+  tc2.nextEquilibriumStep();
+  tc2.nextEquilibriumStep();
+  CHECK(tc2.getCurrentStep() == 1);
+  CHECK(tc2.getCurrentTime() == 0.25);
+  CHECK(tc2.getStopTime() == 0.25);
+  CHECK(tc2.getCurrentEquilibriumStep() == 3);
+  CHECK(tc2.getTotalNumberOfEquilibriumSteps() == 3);
+
+  CHECK(tc2.rollbackStep() == 0.25);
+  CHECK(tc2.getCurrentStep() == 1);
+  CHECK(tc2.getNumberOfConvergedSteps() == 0);
+  CHECK(tc2.getCurrentEquilibriumStep() == 0);
+  // iterations of the discarded step are still counted
+  CHECK(tc2.getTotalNumberOfEquilibriumSteps() == 3);
+  CHECK(tc2.getCurrentTime() == 0.0);
+
+  // Step 1
+  CHECK(tc2.nextStep(0.125, 0.25));
+  tc2.nextEquilibriumStep();
+  CHECK(tc2.getCurrentStep() == 1);
+  CHECK(tc2.getNumberOfConvergedSteps() == 0);
+  CHECK(tc2.getCurrentEquilibriumStep() == 1);
+  CHECK(tc2.getTotalNumberOfEquilibriumSteps() == 4);
+  CHECK(tc2.getCurrentTime() == 0.125);
+  CHECK(tc2.getCurrentTimeDelta() == 0.125);
+
+  // Step 2
+  CHECK(tc2.nextStep(0.125, 0.25));
+  tc2.nextEquilibriumStep();
+  tc2.nextEquilibriumStep();
+  CHECK(tc2.getCurrentStep() == 2);
+  CHECK(tc2.getNumberOfConvergedSteps() == 1);
+  CHECK(tc2.getCurrentEquilibriumStep() == 2);
+  CHECK(tc2.getTotalNumberOfEquilibriumSteps() == 6);
+  CHECK(tc2.getCurrentTime() == 0.25);
+
+  // Step 3
+  CHECK(tc2.nextStep(0.5, 0.5));
+  tc2.nextEquilibriumStep();
+  CHECK(tc2.getCurrentStep() == 3);
+  CHECK(tc2.getNumberOfConvergedSteps() == 2);
+  CHECK(tc2.getCurrentTime() == 0.5);
+  CHECK(tc2.getStopTime() == 0.5);
+
+  // rollback returns to the previous converged time, not to the start of the loadstep
+  CHECK(tc2.rollbackStep() == 0.25);
+  CHECK(tc2.getCurrentTime() == 0.25);
+  CHECK(tc2.getCurrentStep() == 3);
+  CHECK(tc2.getNumberOfConvergedSteps() == 2);
+  CHECK(tc2.nextStep(0.25, 0.5));
+  tc2.nextEquilibriumStep();
+  CHECK(tc2.getCurrentStep() == 3);
+  CHECK(tc2.getCurrentTime() == 0.5);
+  CHECK(tc2.getTotalNumberOfEquilibriumSteps() == 8);
+
+  // Step 4
+  CHECK(tc2.nextStep(0.5, 1.0 - 1.0e-12));
+  tc2.nextEquilibriumStep();
+  CHECK(tc2.getCurrentStep() == 4);
+  CHECK(tc2.getNumberOfConvergedSteps() == 3);
+  CHECK(tc2.getCurrentTime() == 1.0);
+  CHECK(tc2.getStopTime() == 1.0);
+  CHECK(tc2.nextStep(0.5, 1.0) == false);
+  CHECK(tc2.getNumberOfConvergedSteps() == 4);
 }
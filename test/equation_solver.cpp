@@ -0,0 +1,178 @@
+#include "sys.h"
+#include "math/Vec.h"
+#include "math/SparseMatrix.h"
+#include "math/EquationSolver.h"
+#include "math/AMGPreconditioner.h"
+
+using namespace std;
+using namespace nla3d::math;
+
+// fill 1D Laplace-like matrix [-1 2+shift -1] of size n. Last `nMpc` equations are coupled only
+// with the first one and have zero diagonal like Lagrange multipliers equations do.
+void fillMatrix(SparseSymMatrix& mat, uint32 n, uint32 nMpc, double shift) {
+  uint32 nReg = n - nMpc;
+  for (uint32 i = 1; i <= nReg; i++) {
+    mat.addEntry(i, i);
+    if (i < nReg) {
+      mat.addEntry(i, i + 1);
+    }
+  }
+  for (uint32 i = nReg + 1; i <= n; i++) {
+    mat.addEntry(i - nReg, i);
+  }
+  mat.compress();
+  for (uint32 i = 1; i <= nReg; i++) {
+    mat.addValue(i, i, 2.0 + shift);
+    if (i < nReg) {
+      mat.addValue(i, i + 1, -1.0);
+    }
+  }
+  for (uint32 i = nReg + 1; i <= n; i++) {
+    mat.addValue(i - nReg, i, 1.0);
+  }
+}
+
+
+// 5-point Laplace operator on m x m grid with diagonal shift. IC(0) is not exact for it.
+void fillLaplace2D(SparseSymMatrix& mat, uint32 m, double shift) {
+  for (uint32 i = 0; i < m; i++) {
+    for (uint32 j = 0; j < m; j++) {
+      uint32 row = i * m + j + 1;
+      if (j + 1 < m) mat.addEntry(row, row + 1);
+      if (i + 1 < m) mat.addEntry(row, row + m);
+    }
+  }
+  mat.compress();
+  for (uint32 i = 0; i < m; i++) {
+    for (uint32 j = 0; j < m; j++) {
+      uint32 row = i * m + j + 1;
+      mat.addValue(row, row, 4.0 + shift);
+      if (j + 1 < m) mat.addValue(row, row + 1, -1.0);
+      if (i + 1 < m) mat.addValue(row, row + m, -1.0);
+    }
+  }
+}
+
+
+void compareSolvers(SparseSymMatrix& mat, bool positive) {
+  uint32 n = mat.nRows();
+  dVec rhs(n);
+  for (uint32 i = 0; i < n; i++) {
+    rhs[i] = 1.0 + i % 3;
+  }
+  dVec x1(n), x2(n);
+
+  GaussDenseEquationSolver gauss;
+  SparseLDLTEquationSolver ldlt;
+  ldlt.setPositive(positive);
+
+  // NOTE: GaussDenseEquationSolver spoils rhs
+  dVec rhs1(n);
+  rhs1 = rhs;
+  gauss.solveEquations(&mat, rhs1.ptr(), x1.ptr());
+  ldlt.solveEquations(&mat, rhs.ptr(), x2.ptr());
+  for (uint32 i = 0; i < n; i++) {
+    CHECK(fabs(x1[i] - x2[i]) < 1.0e-10) << "x1[" << i << "] = " << x1[i] << ", x2[" << i << "] = "
+      << x2[i];
+  }
+
+  // refactorize with new values (symbolic analysis is reused) and check residual
+  for (uint32 i = 1; i <= n; i++) {
+    mat.addValue(i, i, 0.5);
+  }
+  ldlt.factorizeEquations(&mat);
+  ldlt.substituteEquations(&mat, rhs.ptr(), x2.ptr());
+  dVec res(n);
+  matBVprod(mat, x2, 1.0, res);
+  for (uint32 i = 0; i < n; i++) {
+    CHECK(fabs(res[i] - rhs[i]) < 1.0e-10) << "res[" << i << "] = " << res[i];
+  }
+}
+
+
+void checkPCG(SparseSymMatrix& mat, PCGEquationSolver::Preconditioner prec) {
+  uint32 n = mat.nRows();
+  dVec rhs(n), x1(n), x2(n);
+  for (uint32 i = 0; i < n; i++) {
+    rhs[i] = 1.0 + i % 3;
+  }
+
+  SparseLDLTEquationSolver ldlt;
+  ldlt.solveEquations(&mat, rhs.ptr(), x1.ptr());
+
+  PCGEquationSolver pcg;
+  pcg.setPreconditioner(prec);
+  pcg.setTolerance(1.0e-12);
+  pcg.setOmega(1.2);
+  pcg.solveEquations(&mat, rhs.ptr(), x2.ptr());
+  CHECK(pcg.getLastResidual() < 1.0e-12);
+  for (uint32 i = 0; i < n; i++) {
+    CHECK(fabs(x1[i] - x2[i]) < 1.0e-8) << "x1[" << i << "] = " << x1[i] << ", x2[" << i << "] = "
+      << x2[i];
+  }
+
+  // warm start from the solution should finish immediately
+  pcg.solveEquations(&mat, rhs.ptr(), x2.ptr());
+  CHECK_EQ(pcg.getLastIterations(), 0);
+}
+
+
+int main() {
+  cout << "SparseLDLTEquationSolver: positive definite matrix" << endl;
+  {
+    SparseSymMatrix mat(50);
+    fillMatrix(mat, 50, 0, 0.1);
+    compareSolvers(mat, true);
+  }
+
+  cout << "SparseLDLTEquationSolver: indefinite matrix with MPC-like equations" << endl;
+  {
+    SparseSymMatrix mat(50);
+    fillMatrix(mat, 50, 3, 0.1);
+    compareSolvers(mat, false);
+  }
+
+  cout << "PCGEquationSolver: JACOBI, SSOR, IC0 preconditioners" << endl;
+  {
+    SparseSymMatrix mat(100);
+    fillLaplace2D(mat, 10, 0.01);
+    checkPCG(mat, PCGEquationSolver::JACOBI);
+    checkPCG(mat, PCGEquationSolver::SSOR);
+    checkPCG(mat, PCGEquationSolver::IC0);
+  }
+
+  cout << "PCGEquationSolver: AMG preconditioner, iterations shouldn't grow with the mesh size" << endl;
+  {
+    for (uint32 m = 16; m <= 64; m *= 2) {
+      SparseSymMatrix mat(m * m, 5);
+      fillLaplace2D(mat, m, 0.0);
+
+      dVec rhs(m * m), x(m * m), res(m * m);
+      for (uint32 i = 0; i < m * m; i++) {
+        rhs[i] = 1.0;
+      }
+      PCGEquationSolver pcg;
+      pcg.setPreconditioner(PCGEquationSolver::AMG);
+      pcg.setTolerance(1.0e-10);
+      pcg.solveEquations(&mat, rhs.ptr(), x.ptr());
+      matBVprod(mat, x, 1.0, res);
+      for (uint32 i = 0; i < m * m; i++) {
+        CHECK(fabs(res[i] - rhs[i]) < 1.0e-7) << "res[" << i << "] = " << res[i];
+      }
+      CHECK(pcg.getLastIterations() < 30);
+    }
+  }
+
+  cout << "AMGPreconditioner: hierarchy with several levels" << endl;
+  {
+    uint32 m = 64;
+    SparseSymMatrix mat(m * m, 5);
+    fillLaplace2D(mat, m, 0.0);
+    AMGPreconditioner amg;
+    amg.setCoarseSize(50);
+    amg.setup(&mat);
+    CHECK(amg.nLevels() > 2);
+    CHECK(amg.getOperatorComplexity() < 2.0);
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include "sys.h"
+#include "math/GraphOrdering.h"
+
+using namespace std;
+using namespace nla3d::math;
+
+// graph of m x m grid with 9-point stencil, vertices are shuffled
+void makeGrid(uint32 m, vector<uint32>& xadj, vector<uint32>& adj) {
+  uint32 n = m * m;
+  vector<uint32> shuffle(n);
+  for (uint32 i = 0; i < n; i++) {
+    shuffle[i] = (i * 7919) % n;
+  }
+  vector<vector<uint32> > nbrs(n);
+  for (uint32 i = 0; i < m; i++) {
+    for (uint32 j = 0; j < m; j++) {
+      for (int32 di = -1; di <= 1; di++) {
+        for (int32 dj = -1; dj <= 1; dj++) {
+          int32 i2 = i + di;
+          int32 j2 = j + dj;
+          if ((di == 0 && dj == 0) || i2 < 0 || j2 < 0 || i2 >= (int32) m || j2 >= (int32) m) {
+            continue;
+          }
+          nbrs[shuffle[i * m + j]].push_back(shuffle[i2 * m + j2]);
+        }
+      }
+    }
+  }
+  xadj.assign(1, 0);
+  adj.clear();
+  for (uint32 v = 0; v < n; v++) {
+    adj.insert(adj.end(), nbrs[v].begin(), nbrs[v].end());
+    xadj.push_back(adj.size());
+  }
+}
+
+
+// check that `perm` is a permutation and return the bandwidth of the reordered graph
+uint32 checkPermutation(const vector<uint32>& xadj, const vector<uint32>& adj,
+                        const vector<uint32>& perm) {
+  uint32 n = xadj.size() - 1;
+  CHECK_EQ(perm.size(), n);
+  vector<int32> pinv(n, -1);
+  for (uint32 k = 0; k < n; k++) {
+    CHECK(perm[k] < n);
+    CHECK_EQ(pinv[perm[k]], -1);
+    pinv[perm[k]] = k;
+  }
+  uint32 bandwidth = 0;
+  for (uint32 v = 0; v < n; v++) {
+    for (uint32 p = xadj[v]; p < xadj[v + 1]; p++) {
+      bandwidth = max(bandwidth, (uint32) abs(pinv[v] - pinv[adj[p]]));
+    }
+  }
+  return bandwidth;
+}
+
+
+int main() {
+  uint32 m = 30;
+  vector<uint32> xadj, adj, perm;
+  makeGrid(m, xadj, adj);
+  vector<uint32> natural(m * m);
+  for (uint32 i = 0; i < m * m; i++) {
+    natural[i] = i;
+  }
+  uint32 bandwidth = checkPermutation(xadj, adj, natural);
+  cout << "Shuffled grid bandwidth = " << bandwidth << endl;
+
+  reverseCuthillMcKee(xadj, adj, perm);
+  uint32 rcmBandwidth = checkPermutation(xadj, adj, perm);
+  cout << "RCM bandwidth = " << rcmBandwidth << endl;
+  // bandwidth of the grid in the row by row numbering is m + 1
+  CHECK(rcmBandwidth <= 2 * m);
+
+  approximateMinimumDegree(xadj, adj, perm);
+  checkPermutation(xadj, adj, perm);
+
+  nestedDissection(xadj, adj, perm, 16);
+  checkPermutation(xadj, adj, perm);
+
+  // graph with several connected components and isolated vertices
+  xadj = {0, 1, 2, 2, 4, 5, 6, 6};
+  adj = {1, 0, 4, 5, 3, 3};
+  reverseCuthillMcKee(xadj, adj, perm);
+  checkPermutation(xadj, adj, perm);
+  approximateMinimumDegree(xadj, adj, perm);
+  checkPermutation(xadj, adj, perm);
+  nestedDissection(xadj, adj, perm, 1);
+  checkPermutation(xadj, adj, perm);
+  return 0;
+}
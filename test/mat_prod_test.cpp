@@ -176,6 +176,99 @@ bool test_matBTDBprod () {
 	return true;
 }
 
+// pseudo random entries in [-1, 1]
+double randomEntry() {
+  static uint32 seed = 12345;
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % 20001 / 10000.0 - 1.0;
+}
+
+// products for the sizes used by elements against straightforward reference loops
+template<uint16 dimM, uint16 dimN>
+bool test_elementSizes () {
+  Mat<dimM,dimN> B;
+  MatSym<dimM> D;
+  Vec<dimM> V;
+  Vec<dimN> W;
+  Mat<dimN,dimN> C;
+  for (uint16 i = 0; i < dimM; i++) {
+    V[i] = randomEntry();
+    for (uint16 j = 0; j < dimN; j++) {
+      B[i][j] = randomEntry();
+    }
+    for (uint16 j = i; j < dimM; j++) {
+      D.comp(i, j) = randomEntry();
+    }
+  }
+  for (uint16 i = 0; i < dimN; i++) {
+    W[i] = randomEntry();
+    for (uint16 j = 0; j < dimN; j++) {
+      C[i][j] = randomEntry();
+    }
+  }
+  Mat<dimM,dimM> Dm = D.toMat();
+
+  MatSym<dimN> R, Rf;
+  R.zero();
+  Rf.zero();
+  matBTDBprod(B, D, 0.5, R);
+  for (uint16 i = 0; i < dimN; i++) {
+    for (uint16 j = i; j < dimN; j++) {
+      for (uint16 k = 0; k < dimM; k++) {
+        for (uint16 l = 0; l < dimM; l++) {
+          Rf.comp(i, j) += 0.5 * B[k][i] * Dm[k][l] * B[l][j];
+        }
+      }
+    }
+  }
+  CHECK(R.compare(Rf, eps)) << "test_elementSizes: matBTDBprod " << dimM << "x" << dimN;
+
+  Vec<dimN> RV, RVf;
+  matBTVprod(B, V, 2.0, RV);
+  Vec<dimM> RW, RWf, RD, RDf;
+  matBVprod(B, W, 2.0, RW);
+  matBVprod(D, V, 2.0, RD);
+  for (uint16 i = 0; i < dimM; i++) {
+    for (uint16 j = 0; j < dimN; j++) {
+      RVf[j] += 2.0 * B[i][j] * V[i];
+      RWf[i] += 2.0 * B[i][j] * W[j];
+    }
+    for (uint16 j = 0; j < dimM; j++) {
+      RDf[i] += 2.0 * Dm[i][j] * V[j];
+    }
+  }
+  CHECK(RV.compare(RVf, eps)) << "test_elementSizes: matBTVprod " << dimM << "x" << dimN;
+  CHECK(RW.compare(RWf, eps)) << "test_elementSizes: matBVprod " << dimM << "x" << dimN;
+  CHECK(RD.compare(RDf, eps)) << "test_elementSizes: matBVprod(MatSym) " << dimM;
+
+  Mat<dimM,dimN> RA, RAf;
+  Mat<dimN,dimN> RT, RTf;
+  RA.zero();
+  RAf.zero();
+  RT.zero();
+  RTf.zero();
+  matABprod(B, C, 1.0, RA);
+  matATBprod(B, B, 1.0, RT);
+  for (uint16 i = 0; i < dimM; i++) {
+    for (uint16 j = 0; j < dimN; j++) {
+      for (uint16 k = 0; k < dimN; k++) {
+        RAf[i][j] += B[i][k] * C[k][j];
+      }
+    }
+  }
+  for (uint16 i = 0; i < dimN; i++) {
+    for (uint16 j = 0; j < dimN; j++) {
+      for (uint16 k = 0; k < dimM; k++) {
+        RTf[i][j] += B[k][i] * B[k][j];
+      }
+    }
+  }
+  CHECK(RA.compare(RAf, eps)) << "test_elementSizes: matABprod " << dimM << "x" << dimN;
+  CHECK(RT.compare(RTf, eps)) << "test_elementSizes: matATBprod " << dimM << "x" << dimN;
+  CHECK((B * C).compare(RAf, eps)) << "test_elementSizes: operator* " << dimM << "x" << dimN;
+  return true;
+}
+
 int main (int argc, char* argv[]) {
   char* tmp = getCmdOption(argv, argv + argc, "-dir");
   if (tmp) {
@@ -193,4 +286,10 @@ int main (int argc, char* argv[]) {
 	test_matABprod();
 	test_matATBprod();
 	test_matBTDBprod();
+  test_elementSizes<6, 24>();
+  test_elementSizes<9, 24>();
+  test_elementSizes<3, 8>();
+  test_elementSizes<4, 8>();
+  test_elementSizes<6, 12>();
+  test_elementSizes<24, 24>();
 }
@@ -0,0 +1,135 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+//
+// Equilibrium iterations of NonlinearFESolver on the rubber damper model (PLANE41, Neo-Hookean).
+#include "sys.h"
+#include "FEStorage.h"
+#include "FESolver.h"
+#include "FEReaders.h"
+#include "materials/MaterialFactory.h"
+
+using namespace nla3d;
+using namespace nla3d::math;
+
+void buildModel(MeshData& md, FEStorage& storage, NonlinearFESolver& solver) {
+  Material* mat = CHECK_NOTNULL(MaterialFactory::createMaterial("Neo-Hookean"));
+  mat->Ci(0) = 1.0;
+  mat->Ci(1) = 500.0;
+  storage.material = mat;
+
+  auto sind = storage.createNodes(md.nodesNumbers.size());
+  for (uint32 i = 0; i < sind.size(); i++) {
+    storage.getNode(sind[i]).pos = md.nodesPos[i];
+  }
+  auto ind = md.getCellsByAttribute("TYPE", 1);
+  sind = storage.createElements(ind.size(), ElementType::PLANE41);
+  for (uint32 i = 0; i < sind.size(); i++) {
+    Element& el = storage.getElement(sind[i]);
+    for (uint16 j = 0; j < el.getNNodes(); j++) {
+      el.getNodeNumber(j) = md.cellNodes[ind[i]][j];
+    }
+  }
+  for (auto& v : md.loadBcs) {
+    solver.addLoad(v.node, v.node_dof, v.value);
+  }
+  for (auto& v : md.fixBcs) {
+    solver.addFix(v.node, v.node_dof, v.value);
+  }
+  solver.attachFEStorage(&storage);
+  solver.numberOfLoadsteps = 2;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::string cdb_filename;
+  if (argc > 1) {
+    cdb_filename = argv[1];
+  } else {
+    LOG(FATAL) << "You should provide the path to mesh (cdb file)";
+  }
+
+  MeshData md;
+  if (!readCdbFile(cdb_filename, md)) {
+    LOG(FATAL) << "Can't read FE info from " << cdb_filename << "file. exiting..";
+  }
+  md.compressNumbers();
+
+  // Line search assembles the matrix along with the residual of the full step, shortened trial
+  // steps assemble only the residual. The full step is always accepted on this model, so the line
+  // search costs nothing
+  {
+    FEStorage storage, storageNoLS;
+    NonlinearFESolver solver, solverNoLS;
+    buildModel(md, storage, solver);
+    buildModel(md, storageNoLS, solverNoLS);
+    solverNoLS.useLineSearch = false;
+    solver.solve();
+    solverNoLS.solve();
+
+    uint16 iterations = solver.timeControl.getTotalNumberOfEquilibriumSteps();
+    CHECK_EQ(iterations, solverNoLS.timeControl.getTotalNumberOfEquilibriumSteps());
+    CHECK_EQ(storage.getNumberOfAssemblies(), storageNoLS.getNumberOfAssemblies());
+    CHECK_EQ(storage.getNumberOfResidualAssemblies(), 0);
+    CHECK_EQ(storageNoLS.getNumberOfResidualAssemblies(), 0);
+
+    dVec& U = *storage.getU();
+    dVec& UNoLS = *storageNoLS.getU();
+    for (uint32 i = 0; i < U.size(); i++) {
+      CHECK(fabs(U[i] - UNoLS[i]) <= 1.0e-10 * (1.0 + fabs(UNoLS[i])));
+    }
+  }
+
+  // Adaptive stepping: a step which doesn't converge in numberOfIterations is rolled back and
+  // repeated with smaller time increments
+  {
+    FEStorage storage, storageFine;
+    NonlinearFESolver solver, solverFine;
+    buildModel(md, storage, solver);
+    buildModel(md, storageFine, solverFine);
+    solver.useAdaptiveStepping = true;
+    solver.numberOfIterations = 3;
+    solverFine.numberOfLoadsteps = 8;
+    solver.solve();
+    solverFine.solve();
+    CHECK_GT(solver.timeControl.getNumberOfConvergedSteps(), solver.numberOfLoadsteps);
+
+    // the same equilibrium state as with small loadsteps from the start
+    dVec& U = *storage.getU();
+    dVec& UFine = *storageFine.getU();
+    double maxU = 0.0;
+    double maxDiff = 0.0;
+    for (uint32 i = 0; i < U.size(); i++) {
+      maxU = std::max(maxU, fabs(UFine[i]));
+      maxDiff = std::max(maxDiff, fabs(U[i] - UFine[i]));
+    }
+    CHECK(maxDiff <= 1.0e-3 * maxU) << "max difference " << maxDiff << " of " << maxU;
+
+    // element states of the last converged step are restored after a failed trial state
+    auto elementStates = [&storage] () {
+      std::vector<double> states;
+      for (uint32 en = 1; en <= storage.nElements(); en++) {
+        MatSym<3> C;
+        C.zero();
+        CHECK(storage.getElement(en).getTensor(&C, tensorQuery::C));
+        for (uint16 i = 0; i < 6; i++) {
+          states.push_back(C.ptr()[i]);
+        }
+      }
+      return states;
+    };
+    storage.saveElementStates();
+    std::vector<double> converged = elementStates();
+    dVec U0 = U;
+    for (uint32 i = 0; i < U.size(); i++) {
+      U[i] *= 1.5;
+    }
+    storage.updateResults();
+    CHECK(elementStates() != converged);
+    U = U0;
+    storage.restoreElementStates();
+    CHECK(elementStates() == converged);
+  }
+
+  return 0;
+}
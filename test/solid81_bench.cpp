@@ -0,0 +1,249 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+//
+// Microbenchmark of SOLID81 element kernels: straightforward dense version of the element kernel
+// (full B matrices, generic matrix products) vs ElementSOLID81::computeK() which uses the structure
+// of B matrices, element by element vs the batched kernel ElementSOLID81::computeKBatch(). The
+// batched kernel should give exactly the same local matrices as computeK(). The rhs only kernels
+// computeF() and computeFBatch() should give exactly the same rhs as computeK().
+#include "sys.h"
+#include "FEStorage.h"
+#include "FEReaders.h"
+#include "materials/MaterialFactory.h"
+#include "elements/SOLID81.h"
+#include "math/MatBatch.h"
+#include <chrono>
+
+using namespace nla3d;
+using namespace nla3d::math;
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsFrom(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+// the element kernel with dense B matrices as it's written in the element's theory
+void denseComputeK(ElementSOLID81& el, ElementMatrices& em) {
+  double Kpp = 0.0;
+  double Fp = 0.0;
+  Vec<24> Kup;
+  Vec<24> Fu;
+  Mat_Hyper_Isotrop_General* mat = dynamic_cast<Mat_Hyper_Isotrop_General*> (el.getStorage().getMaterial());
+  double k = mat->getK();
+  MatSym<6> matD_d;
+  Vec<6> vecD_p;
+  Mat<6,24> matB;
+  MatSym<9> matS;
+  Mat<6,9> matO;
+  Mat<9,24> matB_NL;
+  MatSym<24> Kuu;
+  double p_e = el.getStorage().getElementDofSolution(el.getElNum(), Dof::HYDRO_PRESSURE);
+  Kuu.zero();
+  for (uint16 np = 0; np < el.nOfIntPoints(); np++) {
+    double dWt = el.intWeight(np);
+    mat->getDdDp_UP(6, solidmech::defaultTensorComponents, el.C[np].ptr(), p_e, matD_d.ptr(), vecD_p.ptr());
+    double J = solidmech::J_C(el.C[np].ptr());
+    matB.zero();
+    matS.zero();
+    matO.zero();
+    matB_NL.zero();
+    el.make_B_L(np, matB);
+    el.make_S(np, matS);
+    el.make_Omega(np, matO);
+    el.make_B_NL(np, matB_NL);
+    matABprod(matO, matB_NL, 2.0, matB);
+    matBTDBprod(matB, matD_d, 0.5*dWt, Kuu);
+    matBTDBprod(matB_NL, matS, dWt, Kuu);
+    matBTVprod(matB, el.S[np], -0.5*dWt, Fu);
+    matBTVprod(matB, vecD_p, 0.5*dWt, Kup);
+    Fp += -(J - 1 - p_e/k)*dWt;
+    Kpp += -1.0/k*dWt;
+  }
+  el.assemble3(Kuu, Kup, Kpp, Fu, Fp, em);
+}
+
+
+// max difference between `a` and `b` entries related to max entry of `b`
+double relativeDifference(const std::vector<double>& a, const std::vector<double>& b) {
+  double diff = 0.0;
+  double norm = 0.0;
+  for (size_t i = 0; i < a.size(); i++) {
+    diff = std::max(diff, fabs(a[i] - b[i]));
+    norm = std::max(norm, fabs(b[i]));
+  }
+  return diff / std::max(norm, 1.0e-300);
+}
+
+
+bool sameMatrices(const ElementMatrices& a, const ElementMatrices& b) {
+  return a.eq == b.eq && a.Ke == b.Ke && a.Fe == b.Fe;
+}
+
+
+int main(int argc, char* argv[]) {
+  std::string cdb_filename;
+  uint32 nRuns = 5;
+
+  if (argc > 1) {
+    cdb_filename = argv[1];
+  } else {
+    LOG(FATAL) << "You should provide the path to mesh (cdb file)";
+  }
+  if (argc > 2) {
+    nRuns = atoi(argv[2]);
+  }
+
+  MeshData md;
+  if (!readCdbFile(cdb_filename, md)) {
+    LOG(FATAL) << "Can't read FE info from " << cdb_filename << "file. exiting..";
+  }
+  md.compressNumbers();
+
+  FEStorage storage;
+  Material* mat = CHECK_NOTNULL(MaterialFactory::createMaterial("Neo-Hookean"));
+  mat->Ci(0) = 10.0;
+  mat->Ci(1) = 5000.0;
+  storage.material = mat;
+
+  auto sind = storage.createNodes(md.nodesNumbers.size());
+  for (uint32 i = 0; i < sind.size(); i++) {
+    storage.getNode(sind[i]).pos = md.nodesPos[i];
+  }
+  auto ind = md.getCellsByAttribute("TYPE", 1);
+  sind = storage.createElements(ind.size(), ElementType::SOLID81);
+  for (uint32 i = 0; i < sind.size(); i++) {
+    Element& el = storage.getElement(sind[i]);
+    for (uint16 j = 0; j < el.getNNodes(); j++) {
+      el.getNodeNumber(j) = md.cellNodes[ind[i]][j];
+    }
+  }
+
+  storage.initDofs();
+  for (auto& v : md.fixBcs) {
+    storage.setConstrainedNodeDof(v.node, v.node_dof);
+  }
+  storage.assignEquationNumbers();
+  storage.initSolutionData();
+
+  // deform the model to have non-trivial stresses and strains in integration points
+  dVec& U = *storage.getU();
+  for (uint32 i = 1; i <= storage.nNodes(); i++) {
+    const Vec<3>& pos = storage.getNode(i).pos;
+    Dof::dofType dofs[] = {Dof::UX, Dof::UY, Dof::UZ};
+    for (uint16 d = 0; d < 3; d++) {
+      uint32 eq = storage.getNodeDofEqNumber(i, dofs[d]);
+      U[eq - 1] = 0.01 * sin(pos[0] + 2.0 * pos[1] + 3.0 * pos[2] + d);
+    }
+  }
+  for (uint32 i = 1; i <= storage.nElements(); i++) {
+    uint32 eq = storage.getElementDofEqNumber(i, Dof::HYDRO_PRESSURE);
+    U[eq - 1] = 0.1 * cos(0.1 * i);
+  }
+  storage.updateResults();
+
+  uint32 nEl = storage.nElements();
+  std::vector<ElementMatrices> ref(nEl), em(BATCH_LANES);
+  ElementMatrices dense;
+
+  // computeK against dense version
+  double maxDiff = 0.0;
+  for (uint32 i = 0; i < nEl; i++) {
+    denseComputeK(dynamic_cast<ElementSOLID81&>(storage.getElement(i + 1)), dense);
+    storage.getElement(i + 1).computeK(ref[i]);
+    maxDiff = std::max(maxDiff, relativeDifference(ref[i].Ke, dense.Ke));
+    maxDiff = std::max(maxDiff, relativeDifference(ref[i].Fe, dense.Fe));
+  }
+  CHECK(maxDiff < 1.0e-12) << "computeK results differ from dense version: " << maxDiff;
+
+  // the best time of runs is taken to reduce noise of other processes
+  double denseTime = 1.0e300;
+  for (uint32 run = 0; run < nRuns; run++) {
+    auto start = Clock::now();
+    for (uint32 i = 0; i < nEl; i++) {
+      denseComputeK(dynamic_cast<ElementSOLID81&>(storage.getElement(i + 1)), dense);
+    }
+    denseTime = std::min(denseTime, secondsFrom(start));
+  }
+
+  // element by element
+  double scalarTime = 1.0e300;
+  for (uint32 run = 0; run < nRuns; run++) {
+    auto start = Clock::now();
+    for (uint32 i = 0; i < nEl; i++) {
+      CHECK(storage.getElement(i + 1).computeK(ref[i]));
+    }
+    scalarTime = std::min(scalarTime, secondsFrom(start));
+  }
+
+  // batches of consecutive elements
+  bool same = true;
+  double batchTime = 1.0e300;
+  for (uint32 run = 0; run < nRuns; run++) {
+    auto start = Clock::now();
+    for (uint32 i = 0; i < nEl; i += BATCH_LANES) {
+      uint16 n = static_cast<uint16> (std::min<uint32>(BATCH_LANES, nEl - i));
+      Element* batch[BATCH_LANES];
+      for (uint16 l = 0; l < n; l++) {
+        batch[l] = &storage.getElement(i + l + 1);
+      }
+      CHECK(batch[0]->computeKBatch(batch, n, em.data()));
+      if (run == 0) {
+        for (uint16 l = 0; l < n; l++) {
+          same = same && sameMatrices(ref[i + l], em[l]);
+        }
+      }
+    }
+    batchTime = std::min(batchTime, secondsFrom(start));
+  }
+  CHECK(same) << "computeKBatch results differ from computeK ones";
+
+  // rhs only, element by element and by batches
+  ElementMatrices rhs;
+  double rhsTime = 1.0e300;
+  for (uint32 run = 0; run < nRuns; run++) {
+    auto start = Clock::now();
+    for (uint32 i = 0; i < nEl; i++) {
+      CHECK(storage.getElement(i + 1).computeF(rhs));
+      if (run == 0) {
+        same = same && rhs.eq == ref[i].eq && rhs.Fe == ref[i].Fe;
+      }
+    }
+    rhsTime = std::min(rhsTime, secondsFrom(start));
+  }
+  CHECK(same) << "computeF results differ from computeK ones";
+  double rhsBatchTime = 1.0e300;
+  for (uint32 run = 0; run < nRuns; run++) {
+    auto start = Clock::now();
+    for (uint32 i = 0; i < nEl; i += BATCH_LANES) {
+      uint16 n = static_cast<uint16> (std::min<uint32>(BATCH_LANES, nEl - i));
+      Element* batch[BATCH_LANES];
+      for (uint16 l = 0; l < n; l++) {
+        batch[l] = &storage.getElement(i + l + 1);
+      }
+      CHECK(batch[0]->computeFBatch(batch, n, em.data()));
+      if (run == 0) {
+        for (uint16 l = 0; l < n; l++) {
+          same = same && em[l].eq == ref[i + l].eq && em[l].Fe == ref[i + l].Fe;
+        }
+      }
+    }
+    rhsBatchTime = std::min(rhsBatchTime, secondsFrom(start));
+  }
+  CHECK(same) << "computeFBatch results differ from computeK ones";
+
+  LOG(INFO) << nEl << " SOLID81 elements, " << nRuns << " runs";
+  LOG(INFO) << "dense kernel: " << denseTime / nEl * 1.0e6 << " us per element";
+  LOG(INFO) << "computeK: " << scalarTime / nEl * 1.0e6 << " us per element, speedup "
+            << denseTime / scalarTime << " (max relative difference " << maxDiff << ")";
+  LOG(INFO) << "computeKBatch (" << BATCH_LANES << " lanes): " << batchTime / nEl * 1.0e6
+            << " us per element, speedup " << scalarTime / batchTime;
+  LOG(INFO) << "computeF: " << rhsTime / nEl * 1.0e6 << " us per element, speedup "
+            << scalarTime / rhsTime;
+  LOG(INFO) << "computeFBatch: " << rhsBatchTime / nEl * 1.0e6 << " us per element, speedup "
+            << batchTime / rhsBatchTime;
+
+  return 0;
+}
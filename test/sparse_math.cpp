@@ -477,4 +477,164 @@ int main() {
     CHECK(res2.compare(res));
   }
 
+  cout << "Banded matrices products (large enough to be split between threads)" << endl;
+  {
+    const uint32 n = 4000;
+    const uint32 band = 10;
+    std::vector<SparseEntry> entries;
+    for (uint32 i = 1; i <= n; i++) {
+      for (uint32 j = i; j <= std::min(n, i + band); j++) {
+        entries.push_back({i, j, (double) ((i + 2 * j) % 7) - 3.0});
+      }
+    }
+    // two-pass sparsity construction (each entry is added twice)
+    SparseSymMatrix S(n, 0);
+    SparseMatrix A(n, n, 0);
+    for (auto& e : entries) {
+      S.countEntry(e.j, e.i);
+      S.countEntry(e.i, e.j);
+      A.countEntry(e.i, e.j);
+    }
+    S.startFilling();
+    A.startFilling();
+    for (auto& e : entries) {
+      S.addEntry(e.j, e.i);
+      S.addEntry(e.i, e.j);
+      A.addEntry(e.i, e.j);
+    }
+    S.compress();
+    A.compress();
+    CHECK_EQ(S.nValues(), entries.size());
+    CHECK_EQ(A.nValues(), entries.size());
+    for (auto& e : entries) {
+      S.addValue(e.i, e.j, e.v);
+      A.addValue(e.i, e.j, e.v);
+    }
+
+    dVec x(n);
+    for (uint32 i = 0; i < n; i++) {
+      x[i] = (double) (i % 5);
+    }
+    dVec refSym(n), refA(n), refAT(n);
+    for (auto& e : entries) {
+      refSym[e.i - 1] += 2.0 * e.v * x[e.j - 1];
+      if (e.i != e.j) refSym[e.j - 1] += 2.0 * e.v * x[e.i - 1];
+      refA[e.i - 1] += e.v * x[e.j - 1];
+      refAT[e.j - 1] += e.v * x[e.i - 1];
+    }
+
+    dVec resSym(n), resA(n), resAT(n);
+    matBVprod(S, x, 2.0, resSym);
+    matBVprod(A, x, 1.0, resA);
+    matBTVprod(A, x, 1.0, resAT);
+    for (uint32 i = 0; i < n; i++) {
+      CHECK_EQ(resSym[i], refSym[i]);
+      CHECK_EQ(resA[i], refA[i]);
+      CHECK_EQ(resAT[i], refAT[i]);
+    }
+  }
+
+  cout << "Block storage vs scalar storage" << endl;
+  // uniform 3x3 blocks and groups of 1, 2 and 3 rows (like nodes, elements and MPC equations of a
+  // FE model)
+  for (bool uniform : {true, false}) {
+    // blocks for pairs of "nodes" (i, i), (i, i + 1), (i, i + 5), the last node is isolated
+    const uint32 nNodes = 2000;
+    std::vector<uint32> groups(1, 0);
+    for (uint32 i = 1; i <= nNodes; i++) {
+      groups.push_back(groups.back() + (uniform ? 3 : 1 + i % 3));
+    }
+    std::vector<std::pair<uint32, uint32> > nodePairs;
+    for (uint32 i = 1; i < nNodes; i++) {
+      nodePairs.push_back({i, i});
+      if (i + 1 < nNodes) nodePairs.push_back({i, i + 1});
+      if (i + 5 < nNodes) nodePairs.push_back({i, i + 5});
+    }
+
+    const uint32 n = groups.back();
+    SparseSymMatrix S(n, 0), SB(n, 0);
+    SparseMatrix A(n, n, 0), AB(n, n, 0);
+    if (uniform) {
+      SB.setBlockSize(3);
+      AB.setBlockSize(3);
+    } else {
+      SB.setBlockPartition(groups);
+      AB.setBlockPartition(groups, groups);
+    }
+    for (uint16 pass = 0; pass < 2; pass++) {
+      for (auto& p : nodePairs) {
+        for (uint32 i = groups[p.first - 1] + 1; i <= groups[p.first]; i++) {
+          for (uint32 j = groups[p.second - 1] + 1; j <= groups[p.second]; j++) {
+            if (pass == 0) {
+              S.countEntry(std::min(i, j), std::max(i, j));
+              SB.countEntry(std::min(i, j), std::max(i, j));
+              A.countEntry(i, j);
+              AB.countEntry(i, j);
+            } else {
+              S.addEntry(std::min(i, j), std::max(i, j));
+              SB.addEntry(std::min(i, j), std::max(i, j));
+              A.addEntry(i, j);
+              AB.addEntry(i, j);
+            }
+          }
+        }
+      }
+      if (pass == 0) {
+        S.startFilling();
+        SB.startFilling();
+        A.startFilling();
+        AB.startFilling();
+      }
+    }
+    S.compress();
+    SB.compress();
+    A.compress();
+    AB.compress();
+    CHECK_EQ(SB.getSparsityInfo()->getBlockSize(), 3);
+    CHECK_EQ(SB.nValues(), S.nValues());
+    CHECK_EQ(AB.nValues(), A.nValues());
+    // block storage needs at least 1.5 times less memory for indexes
+    CHECK_LT(SB.getSparsityInfo()->getIndexMemory() * 3, S.getSparsityInfo()->getIndexMemory() * 2);
+    CHECK_LT(AB.getSparsityInfo()->getIndexMemory() * 3, A.getSparsityInfo()->getIndexMemory() * 2);
+
+    // the values are placed in the same order as in scalar CSR
+    for (uint32 i = 1; i <= n; i++) {
+      CHECK_EQ(SB.getSparsityInfo()->nElementsInRow(i), S.getSparsityInfo()->nElementsInRow(i));
+      CHECK_EQ(AB.getSparsityInfo()->nElementsInRow(i), A.getSparsityInfo()->nElementsInRow(i));
+      for (uint32 j = S.getIofeirArray()[i-1]; j < S.getIofeirArray()[i]; j++) {
+        uint32 col = S.getColumnsArray()[j-1];
+        CHECK_EQ(SB.getSparsityInfo()->getIndex(i, col), j - 1);
+        S.addValue(i, col, (double) ((i + 3 * col) % 11) - 5.0);
+        SB.addValue(i, col, (double) ((i + 3 * col) % 11) - 5.0);
+      }
+      for (uint32 j = A.getIofeirArray()[i-1]; j < A.getIofeirArray()[i]; j++) {
+        uint32 col = A.getColumnsArray()[j-1];
+        CHECK_EQ(AB.getSparsityInfo()->getIndex(i, col), j - 1);
+        A.addValue(i, col, (double) ((2 * i + col) % 7) - 3.0);
+        AB.addValue(i, col, (double) ((2 * i + col) % 7) - 3.0);
+      }
+    }
+    // scalar CSR arrays built from blocks are the same
+    CHECK(SB.compare(S));
+    CHECK(AB.compare(A));
+
+    dVec x(n);
+    for (uint32 i = 0; i < n; i++) {
+      x[i] = (double) (i % 5) - 1.0;
+    }
+    dVec res(n), resB(n);
+    matBVprod(S, x, 2.0, res);
+    matBVprod(SB, x, 2.0, resB);
+    CHECK(resB.compare(res, 0.0));
+    res.zero();
+    resB.zero();
+    matBVprod(A, x, 1.0, res);
+    matBVprod(AB, x, 1.0, resB);
+    CHECK(resB.compare(res, 0.0));
+    res.zero();
+    resB.zero();
+    matBTVprod(A, x, 1.0, res);
+    matBTVprod(AB, x, 1.0, resB);
+    CHECK(resB.compare(res, 0.0));
+  }
 }
@@ -0,0 +1,270 @@
+// This file is a part of nla3d project. For information about authors and
+// licensing go to project's repository on github:
+// https://github.com/dmitryikh/nla3d
+//
+// Benchmark of sparse matrix-vector products (matBVprod/matBTVprod) on the global stiffness matrix
+// of a FE model. Sparse matrix-vector product is memory bound, so the throughput is compared with
+// the throughput of a simple STREAM-like triad on arrays of the same size.
+#include "sys.h"
+#include "FEStorage.h"
+#include "FEReaders.h"
+#include "materials/MaterialFactory.h"
+#include <chrono>
+
+using namespace nla3d;
+using namespace nla3d::math;
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsFrom(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+// straightforward serial version of symmetric (upper triangle storage) product
+void referenceSymProduct(SparseSymMatrix& B, const CsrIndexArrays& csr, const dVec& V, double coef,
+                         dVec& R) {
+  const uint32* iofeir = csr.iofeir;
+  const uint32* columns = csr.columns;
+  double* values = B.getValuesArray();
+  for (uint32 i = 0; i < B.nRows(); i++) {
+    for (uint32 j = iofeir[i] - 1; j < iofeir[i+1] - 1; j++) {
+      uint32 col = columns[j] - 1;
+      R[i] += coef * values[j] * V[col];
+      if (col != i) {
+        R[col] += coef * values[j] * V[i];
+      }
+    }
+  }
+}
+
+
+double maxDifference(const dVec& a, const dVec& b) {
+  double diff = 0.0;
+  double norm = 0.0;
+  for (uint32 i = 0; i < a.size(); i++) {
+    diff = std::max(diff, fabs(a[i] - b[i]));
+    norm = std::max(norm, fabs(a[i]));
+  }
+  return diff / std::max(norm, 1.0e-300);
+}
+
+
+// Symmetric matrix with 3 DoFs per node (pure displacement formulation) for the mesh `md`. `blockSize`
+// is 1 for scalar storage and 3 for nodal block storage. The values depend only on the position of
+// the entry, so the matrices are the same for both storages.
+void buildNodalMatrix(MeshData& md, uint16 blockSize, SparseSymMatrix& mat) {
+  const uint16 b = 3;
+  uint32 n = md.nodesNumbers.size() * b;
+  mat.reinit(n, 0);
+  if (blockSize > 1) {
+    mat.setBlockSize(blockSize);
+  }
+  for (uint16 pass = 0; pass < 2; pass++) {
+    for (auto& cell : md.cellNodes) {
+      for (auto n1 : cell) {
+        for (auto n2 : cell) {
+          if (n1 > n2) continue;
+          // in block storage the first entry of the block registers the whole block
+          for (uint16 r = 0; r < (blockSize > 1 ? 1 : b); r++) {
+            for (uint16 c = 0; c < (blockSize > 1 ? 1 : b); c++) {
+              uint32 i = (n1 - 1) * b + r + 1;
+              uint32 j = (n2 - 1) * b + c + 1;
+              if (i > j) continue;
+              if (pass == 0) {
+                mat.countEntry(i, j);
+              } else {
+                mat.addEntry(i, j);
+              }
+            }
+          }
+        }
+      }
+    }
+    if (pass == 0) {
+      mat.startFilling();
+    }
+  }
+  mat.compress();
+
+  // values of both storages are placed in scalar CSR order
+  double* values = mat.getValuesArray();
+  for (uint32 k = 0; k < mat.nValues(); k++) {
+    values[k] = 1.0 + 0.1 * (k % 13);
+  }
+}
+
+
+// SOLID81 model of the mesh `md` with assembled global matrices. The model has nodal and element
+// DoFs, so block storage of the matrices has groups of different sizes.
+void buildModel(MeshData& md, bool blockStorage, FEStorage& storage) {
+  Material* mat = CHECK_NOTNULL(MaterialFactory::createMaterial("Neo-Hookean"));
+  mat->Ci(0) = 10.0;
+  mat->Ci(1) = 5000.0;
+  storage.material = mat;
+
+  auto sind = storage.createNodes(md.nodesNumbers.size());
+  for (uint32 i = 0; i < sind.size(); i++) {
+    storage.getNode(sind[i]).pos = md.nodesPos[i];
+  }
+  auto ind = md.getCellsByAttribute("TYPE", 1);
+  sind = storage.createElements(ind.size(), ElementType::SOLID81);
+  for (uint32 i = 0; i < sind.size(); i++) {
+    Element& el = storage.getElement(sind[i]);
+    for (uint16 j = 0; j < el.getNNodes(); j++) {
+      el.getNodeNumber(j) = md.cellNodes[ind[i]][j];
+    }
+  }
+
+  storage.initDofs();
+  for (auto& v : md.fixBcs) {
+    storage.setConstrainedNodeDof(v.node, v.node_dof);
+  }
+  // K22 is factorized by SparseLDLTEquationSolver in main()
+  storage.setEquationOrdering(FEStorage::NESTED_DISSECTION_ORDERING);
+  storage.assignEquationNumbers();
+  storage.setBlockStorage(blockStorage);
+  storage.initSolutionData();
+  storage.assembleGlobalEqMatrices();
+}
+
+
+int main(int argc, char* argv[]) {
+  std::string cdb_filename;
+  uint32 nRuns = 50;
+
+  if (argc > 1) {
+    cdb_filename = argv[1];
+  } else {
+    LOG(FATAL) << "You should provide the path to mesh (cdb file)";
+  }
+  if (argc > 2) {
+    nRuns = atoi(argv[2]);
+  }
+
+  MeshData md;
+  if (!readCdbFile(cdb_filename, md)) {
+    LOG(FATAL) << "Can't read FE info from " << cdb_filename << "file. exiting..";
+  }
+  md.compressNumbers();
+
+  FEStorage storage, scalarStorage;
+  buildModel(md, true, storage);
+  buildModel(md, false, scalarStorage);
+
+  SparseSymMatrix& K22 = *storage.getK()->block(2);
+  SparseMatrix& K12 = *storage.getK()->block(1, 2);
+  uint32 n = K22.nRows();
+  uint32 nc = K12.nRows();
+  uint64 nnz = K22.nValues();
+
+  dVec V(n), R(n), Rref(n);
+  for (uint32 i = 0; i < n; i++) {
+    V[i] = 1.0 + 0.001 * (i % 1000);
+  }
+  dVec Vc(nc, 1.0), Rc(nc);
+
+  // check the result against straightforward implementation
+  CsrIndexArrays csr(*K22.getSparsityInfo());
+  matBVprod(K22, V, 1.0, R);
+  referenceSymProduct(K22, csr, V, 1.0, Rref);
+  double diff = maxDifference(Rref, R);
+  CHECK(diff < 1.0e-12) << "matBVprod differs from the reference: " << diff;
+
+  // the same matrix in scalar storage: the values are the same, the indexes take much more memory
+  SparseSymMatrix& K22s = *scalarStorage.getK()->block(2);
+  CHECK(K22.compare(K22s));
+  uint64 indexMemory = K22.getSparsityInfo()->getIndexMemory();
+  uint64 scalarIndexMemory = K22s.getSparsityInfo()->getIndexMemory();
+  CHECK(indexMemory * 3 < scalarIndexMemory)
+    << "block storage index memory " << indexMemory << " vs scalar " << scalarIndexMemory;
+  dVec Rs(n);
+  matBVprod(K22s, V, 1.0, Rs);
+  diff = maxDifference(Rs, R);
+  CHECK(diff < 1.0e-12) << "block storage product differs from scalar one: " << diff;
+  // solvers expand scalar CSR arrays into their own temporaries, the matrix keeps only blocks
+  SparseLDLTEquationSolver ldlt;
+  ldlt.setPositive(false);
+  ldlt.factorizeEquations(&K22);
+  CHECK_EQ(K22.getSparsityInfo()->getIndexMemory(), indexMemory);
+
+  // symmetric product
+  auto start = Clock::now();
+  for (uint32 run = 0; run < nRuns; run++) {
+    matBVprod(K22, V, 1.0, R);
+  }
+  double symTime = secondsFrom(start) / nRuns;
+  // values, indexes, V and R (read and write)
+  double symBytes = nnz * sizeof(double) + indexMemory + 3.0 * n * sizeof(double);
+
+  start = Clock::now();
+  for (uint32 run = 0; run < nRuns; run++) {
+    referenceSymProduct(K22, csr, V, 1.0, Rref);
+  }
+  double refTime = secondsFrom(start) / nRuns;
+
+  // products with constrained part of the matrix (reaction recovery in FESolver)
+  start = Clock::now();
+  for (uint32 run = 0; run < nRuns; run++) {
+    matBVprod(K12, V, 1.0, Rc);
+    matBTVprod(K12, Vc, 1.0, R);
+  }
+  double constrTime = secondsFrom(start) / nRuns;
+
+  // STREAM-like triad on arrays which occupy the same memory as the matrix
+  uint32 triadSize = (uint32) (symBytes / (3 * sizeof(double)));
+  std::vector<double> a(triadSize, 0.0), b(triadSize, 1.0), c(triadSize, 2.0);
+  start = Clock::now();
+  for (uint32 run = 0; run < nRuns; run++) {
+#pragma omp parallel for schedule(static)
+    for (uint32 i = 0; i < triadSize; i++) {
+      a[i] = b[i] + 0.5 * c[i];
+    }
+  }
+  double triadTime = secondsFrom(start) / nRuns;
+  CHECK(a[triadSize / 2] == 2.0);
+
+  // scalar vs nodal block storage of displacement-only matrix of the same mesh
+  SparseSymMatrix S, SB;
+  buildNodalMatrix(md, 1, S);
+  buildNodalMatrix(md, 3, SB);
+  uint32 nn = S.nRows();
+  dVec Vn(nn), Rn(nn), RnB(nn);
+  for (uint32 i = 0; i < nn; i++) {
+    Vn[i] = 1.0 + 0.001 * (i % 1000);
+  }
+  matBVprod(S, Vn, 1.0, Rn);
+  matBVprod(SB, Vn, 1.0, RnB);
+  diff = maxDifference(Rn, RnB);
+  CHECK(diff < 1.0e-12) << "block storage product differs from scalar one: " << diff;
+
+  start = Clock::now();
+  for (uint32 run = 0; run < nRuns; run++) {
+    matBVprod(S, Vn, 1.0, Rn);
+  }
+  double scalarTime = secondsFrom(start) / nRuns;
+  start = Clock::now();
+  for (uint32 run = 0; run < nRuns; run++) {
+    matBVprod(SB, Vn, 1.0, RnB);
+  }
+  double blockTime = secondsFrom(start) / nRuns;
+
+  LOG(INFO) << "Matrix K22: " << n << " rows, " << nnz << " non-zeros (upper triangle), index "
+            << "memory " << indexMemory << " bytes (" << scalarIndexMemory << " bytes in scalar "
+            << "storage)";
+  LOG(INFO) << "matBVprod(SparseSymMatrix): " << symTime * 1000.0 << " ms, "
+            << symBytes / symTime * 1.0e-9 << " GB/s";
+  LOG(INFO) << "serial reference product: " << refTime * 1000.0 << " ms, "
+            << symBytes / refTime * 1.0e-9 << " GB/s";
+  LOG(INFO) << "matBVprod + matBTVprod(K12): " << constrTime * 1000.0 << " ms ("
+            << K12.nValues() << " non-zeros)";
+  LOG(INFO) << "triad: " << triadTime * 1000.0 << " ms, "
+            << 3.0 * triadSize * sizeof(double) / triadTime * 1.0e-9 << " GB/s";
+  LOG(INFO) << "Nodal matrix: " << nn << " rows, " << S.nValues() << " non-zeros";
+  LOG(INFO) << "scalar storage: " << scalarTime * 1000.0 << " ms, index memory "
+            << S.getSparsityInfo()->getIndexMemory() << " bytes";
+  LOG(INFO) << "3x3 block storage: " << blockTime * 1000.0 << " ms, index memory "
+            << SB.getSparsityInfo()->getIndexMemory() << " bytes";
+
+  return 0;
+}